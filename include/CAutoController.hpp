@@ -2,6 +2,13 @@
 // Created by Ronal on 5/7/2024.
 //
 
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -9,30 +16,89 @@
 #include <opencv2/opencv_modules.hpp>
 #include <spdlog/spdlog.h>
 
+#include "CBoundedQueue.hpp"
+#include "CCarLocalizer.hpp"
+#include "CFrameRing.hpp"
+#include "CMarkerTracker.hpp"
+#include "CPerfStats.hpp"
+
 class CAutoController {
 private:
-    cv::Mat *_carImg, *_overheadImg, _masked_img;
+    enum commandType {
+        RUN_TO_POINT,
+        END_RUN_TO_POINT,
+        AUTO_TARGET,
+        END_AUTO_TARGET,
+    };
+
+    // start and end calls are queued for the control worker, which applies them at its next tick
+    struct command {
+        commandType type;
+        cv::Point point;
+        int speed;
+        int target;
+        uint64_t run;       // number of runs started when the command was queued
+    };
 
-    std::vector<int> _autoInput;
+    // everything the control worker publishes in one tick, plain data so it can be copied under the seqlock
+    struct output {
+        int autoInput[4];
+        int locationX, locationY;
+        int destinationX, destinationY;
+        int64_t inputCaptured;      // capture time of the frame the inputs came from, clock ticks
+    };
 
-    std::vector<bool> _threadExit;
+    cv::Mat *_carImg;
+    CFrameRing *_overheadRing;
 
+    // only touched by the control worker
     cv::Point _destination;
-    cv::Point _location;
     int _target;
     int _speed;
-    std::mutex _imgLock;
+    bool _runningToPoint;
+    bool _autoTargeting;
+    uint64_t _run;
+    output _state;
+
+    std::thread _worker;
+    std::atomic<bool> _workerExit{false};
+    std::atomic<int> _rateHz{200};
+    CBoundedQueue<command> _commands{16};
+    std::atomic<uint64_t> _runsStarted{0};
+    std::atomic<uint64_t> _runsDone{0};
 
-    static void autoTargetThread(CAutoController* ptr);
-    static void runToPointThread(CAutoController* ptr);
+    // readers retry while the sequence is odd or changed under them
+    output _output{};
+    std::atomic<uint32_t> _outputSeq{0};
+
+    static void controlThread(CAutoController* ptr);
+    void controlTick();
+    void handleCommand(const command &c);
+    bool queueCommand(const command &c);
+    void publish();
+    output readOutput() const;
+    cv::Point2f toArena(const cv::Point2f &point);
     void autoTarget();
     void runToPoint();
+    void finishRun();
+
+    // searches around the last position, kept between iterations so labelling can reuse its storage
+    CCarLocalizer _localizer;
+    CCarLocalizer::result _car{};
+    std::atomic<uint64_t> _fullScans{0};
+
+    // maps mask pixels to arena pixels when the mask is in camera space, set from other threads
+    std::mutex _transformLock;
+    cv::Mat _homography;
+    int _arenaSize = 0;
+    std::vector<cv::Point2f> _transformIn, _transformOut;
 
     std::vector<int> _marker_ids;
-    std::vector<std::vector<cv::Point2f>> _marker_corners, _rejected_candidates;
-    cv::aruco::DetectorParameters _detector_params;
-    cv::aruco::Dictionary _dictionary;
-    cv::aruco::ArucoDetector _detector;
+    std::vector<std::vector<cv::Point2f>> _marker_corners;
+    CMarkerTracker _marker_tracker;
+
+    std::atomic<uint64_t> _iterations{0};
+    std::atomic<uint64_t> _iteration_us{0};
 
 public:
     enum controlType {
@@ -51,14 +117,30 @@ public:
     CAutoController();
     ~CAutoController();
 
-    bool init(cv::Mat *car, cv::Mat *above);
+    // starts the control worker, which runs until destruction
+    bool init(cv::Mat *car, CFrameRing *above);
+    void setControlRate(int hz);
+    int getControlRate() const;
+
+    // masks from the camera rather than the warped arena, only the car's position is warped
+    // an empty homography means the mask already is in arena pixels
+    void setOverheadTransform(const cv::Mat &homography, int arenaSize);
+
     void startAutoTarget(int id);
     void endAutoTarget();
-    void startRunToPoint(cv::Point point, int speed);
+    // false if the command queue was full, try again later
+    bool startRunToPoint(cv::Point point, int speed);
     void endRunToPoint();
     int getAutoInput(int type);
     bool isRunning();
 
     cv::Point get_car();
     cv::Point get_destination();
+
+    uint64_t get_iteration_count() const;
+    uint64_t get_iteration_us() const;
+    uint64_t getFullScanCount() const;
+
+    // when the frame behind the current auto inputs was captured, the clock's epoch before the first one
+    std::chrono::steady_clock::time_point getInputCaptured() const;
 };
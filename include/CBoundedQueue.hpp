@@ -0,0 +1,118 @@
+/**
+ * CBoundedQueue.hpp - bounded lock-free multi-producer multi-consumer queue
+ * 2024-06-19
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief Fixed capacity lock-free queue (Dmitry Vyukov's bounded MPMC design).
+ *
+ * Each cell carries a sequence number that tells producers and consumers whether it is free or full, so push and pop
+ * only contend on their own position counter. Never allocates after construction.
+ * @tparam T Element type, should be cheap to copy (e.g. a pointer).
+ * @author vika
+ */
+template<typename T>
+class CBoundedQueue {
+public:
+
+    /**
+     * @brief Constructor for CBoundedQueue
+     * @param capacity Maximum number of elements, rounded up to a power of two.
+     */
+    explicit CBoundedQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        _mask = size - 1;
+        _cells = std::make_unique<cell[]>(size);
+        for (size_t i = 0; i < size; i++) _cells[i].sequence.store(i, std::memory_order_relaxed);
+        _enqueue_pos.store(0, std::memory_order_relaxed);
+        _dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Add an element.
+     * @param value The element.
+     * @return False if the queue is full.
+     */
+    bool try_push(const T &value) {
+        cell *c;
+        size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            c = &_cells[pos & _mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t) seq - (intptr_t) pos;
+            if (diff == 0) {
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->value = value;
+        c->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Remove the oldest element.
+     * @param value Receives the element.
+     * @return False if the queue is empty.
+     */
+    bool try_pop(T &value) {
+        cell *c;
+        size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            c = &_cells[pos & _mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t) seq - (intptr_t) (pos + 1);
+            if (diff == 0) {
+                if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        value = c->value;
+        c->sequence.store(pos + _mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Get the number of elements. Only approximate while other threads are pushing or popping.
+     * @return The number of elements.
+     */
+    size_t size_approx() const {
+        size_t enq = _enqueue_pos.load(std::memory_order_relaxed);
+        size_t deq = _dequeue_pos.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    /**
+     * @brief Get the maximum number of elements.
+     * @return The capacity.
+     */
+    size_t capacity() const {
+        return _mask + 1;
+    }
+
+private:
+    struct cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<cell[]> _cells;
+    size_t _mask;
+    alignas(64) std::atomic<size_t> _enqueue_pos;   ///< Own cache lines so producers and consumers don't false share.
+    alignas(64) std::atomic<size_t> _dequeue_pos;
+};
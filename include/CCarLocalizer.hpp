@@ -0,0 +1,78 @@
+/**
+ * CCarLocalizer.hpp - finds the car in the arena mask, searching around where it was last seen
+ * 2024-06-29
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief Finds the car as the largest connected blob in a binary mask, with a sub-pixel centroid.
+ *
+ * Once the car has been found only a window around its last position is labelled. If it is not found there, the window
+ * is doubled on each following frame until it covers the whole mask, after which the whole mask is searched until the
+ * car turns up again. A blob touching the window's edge may be cut off, so the search is repeated straight away in a
+ * window twice the size before its centroid is trusted.
+ *
+ * Blobs are compared by pixel count rather than bounding box, so thin streaks of noise don't beat the car.
+ * @author vika
+ */
+class CCarLocalizer {
+public:
+
+    /**
+     * @brief Where the car was found.
+     */
+    struct result {
+        bool found;
+        cv::Point2f centroid;   ///< Sub-pixel centre of mass, in mask pixels.
+        int area;               ///< Pixels in the blob.
+        cv::Rect bounds;        ///< Bounding box, in mask pixels.
+    };
+
+    /**
+     * @brief Constructor for CCarLocalizer
+     * @param window Side of the search window around the last position, in mask pixels.
+     * @param min_area Smallest blob taken for the car, in pixels.
+     */
+    explicit CCarLocalizer(int window = 128, int min_area = 16);
+
+    /**
+     * @brief Destructor for CCarLocalizer
+     */
+    ~CCarLocalizer();
+
+    /**
+     * @brief Find the car in the next mask.
+     * @param mask Binary mask, 8 bit, single channel.
+     * @return Where the car is. Not found if no blob is big enough.
+     */
+    result locate(const cv::Mat &mask);
+
+    /**
+     * @brief Forget the last position so the next mask is fully searched.
+     */
+    void reset();
+
+    /**
+     * @brief Check whether the last call to locate() searched the whole mask.
+     * @return True if the last search was a full-mask scan.
+     */
+    bool was_full_scan() const;
+
+private:
+    bool search(const cv::Mat &mask, const cv::Rect &window, result &found);
+
+    cv::Mat _labels, _stats, _centroids;
+    int _window;
+    int _min_area;
+    bool _tracking;
+    cv::Point2f _last;
+    int _misses;            ///< Frames in a row the car was not found in its window.
+    bool _last_full_scan;
+};
@@ -6,13 +6,21 @@
 
 #pragma once
 
+#include <atomic>
 #include <thread>
 
 #include <spdlog/spdlog.h>
 #include <opencv2/opencv.hpp>
 
+#include "CPerfStats.hpp"
+#include "CWakeSignal.hpp"
+
 /**
  * @brief A class designed to be inherited from to provide functions common to all
+ *
+ * update() runs on its own thread. Without an update rate it runs back to back. With one, it runs whenever
+ * wake_update() is called, typically by a frame ring when a new frame is published, and otherwise at the update rate,
+ * so it only does work when there is something new and never waits for a frame that is already there.
  * @author vika
  */
 class CCommonBase {
@@ -39,7 +47,7 @@ public:
     virtual void draw() = 0;
 
     /**
-     * @brief Runs the update and draw functions.
+     * @brief Runs the update and draw functions until _do_exit is set, then waits for the update thread to finish.
      */
     void run();
 
@@ -55,11 +63,40 @@ public:
      */
     static void draw_thread(CCommonBase *who_called_me);
 
+    /**
+     * @brief Run update() as soon as it is free instead of at the next scheduled time. Safe to call from any thread.
+     */
+    void wake_update();
+
+    /**
+     * @brief Get the fraction of time spent in update() over the last second.
+     * @return 0 to 1.
+     */
+    double get_update_duty_cycle() const;
+
+    /**
+     * @brief Get how often update() ran over the last second.
+     * @return Updates per second.
+     */
+    double get_update_rate() const;
+
 protected:
+    /**
+     * @brief Set how often update() runs when not woken.
+     * @param hz Updates per second, 0 to run back to back.
+     */
+    void set_update_rate(int hz);
+
     cv::Size _window_size;      ///< The size of the window.
     std::chrono::steady_clock::time_point _perf_update_start;       ///< Start time for measuring performance.
     std::chrono::steady_clock::time_point _perf_draw_start;         ///< Start time for measuring performance.
     int _perf_update = 1;       ///< Measured update time in milliseconds.
     int _perf_draw = 1;         ///< Measured draw time in milliseconds.
-    bool _do_exit = false;           ///< Flag to exit program.
-};
\ No newline at end of file
+    std::atomic<bool> _do_exit{false};      ///< Flag to exit program.
+    CWakeSignal _update_signal;             ///< Wakes the update thread, e.g. when a frame ring publishes.
+
+private:
+    std::atomic<int64_t> _update_interval_us{0};
+    std::atomic<double> _update_duty{0};
+    std::atomic<double> _update_rate{0};
+};
@@ -0,0 +1,149 @@
+/**
+ * CControlPacket.hpp - control packet encoding for the udp channel
+ * 2024-06-14
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+/**
+ * @brief Encodes control values into reusable packets, in either the legacy text format or binary v1.
+ *
+ * Binary v1 is 26 bytes, all fields little-endian:
+ *
+ *  offset  size  field
+ *  0       1     magic (0x5A)
+ *  1       1     version (1)
+ *  2       2     buttons, bit 0..3 = A, B, X, Y
+ *  4       4     sequence number
+ *  8       4     send timestamp, microseconds since the client started (wraps)
+ *  12      12    6 x int16 axes: left x, left y, right x, right y, left trigger, right trigger
+ *  24      2     CRC-16/CCITT-FALSE of bytes 0..23
+ *
+ * Values are taken in the order of value_type: six axes followed by four buttons. In auto mode packets start out as
+ * text and switch to binary once the robot answers with a packet starting with the magic byte and a version it
+ * supports, so old firmware keeps receiving text.
+ * @author vika
+ */
+class CControlPacket {
+public:
+    enum format {
+        FORMAT_AUTO,
+        FORMAT_TEXT,
+        FORMAT_BINARY,
+    };
+
+    static constexpr uint8_t MAGIC = 0x5A;
+    static constexpr uint8_t VERSION = 1;
+    static constexpr size_t BINARY_SIZE = 26;
+    static constexpr int AXES = 6;
+    static constexpr int BUTTONS = 4;
+
+    /**
+     * @brief A decoded binary packet.
+     */
+    struct decoded {
+        uint32_t sequence;
+        uint32_t timestamp_us;
+        int16_t axes[AXES];
+        bool buttons[BUTTONS];
+    };
+
+    /**
+     * @brief Constructor for CControlPacket
+     */
+    CControlPacket();
+
+    /**
+     * @brief Destructor for CControlPacket
+     */
+    ~CControlPacket();
+
+    /**
+     * @brief Encode the next packet into the internal buffer. Does not allocate once the buffer has grown.
+     * @param values Control values in value_type order.
+     * @return The encoded packet, valid until the next call.
+     */
+    const std::vector<uint8_t> &encode(const std::vector<int> &values);
+
+    /**
+     * @brief Look at a packet received from the robot and switch to binary if it advertises the same version.
+     * @param data The received bytes.
+     * @param len Number of received bytes.
+     * @return True if this packet switched the encoding to binary.
+     */
+    bool accept_response(const uint8_t *data, size_t len);
+
+    /**
+     * @brief Go back to text until the robot advertises binary again. Used when the robot stops responding.
+     */
+    void fall_back();
+
+    /**
+     * @brief Set the configured format. Auto negotiates, text and binary are forced.
+     * @param f The format to use.
+     */
+    void set_format(format f);
+
+    /**
+     * @brief Get the configured format.
+     * @return The format set with set_format().
+     */
+    format get_format() const;
+
+    /**
+     * @brief Check whether packets are currently encoded as binary.
+     * @return True if binary, false if text.
+     */
+    bool is_binary() const;
+
+    /**
+     * @brief Decode a binary packet, for the receiving side and for checking encoded packets.
+     * @param data The packet bytes.
+     * @param len Number of bytes.
+     * @param out The decoded packet.
+     * @return True if the packet is a valid binary packet with a matching CRC.
+     */
+    static bool decode(const uint8_t *data, size_t len, decoded &out);
+
+    /**
+     * @brief CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF).
+     * @param data The bytes to checksum.
+     * @param len Number of bytes.
+     * @return The CRC.
+     */
+    static uint16_t crc16(const uint8_t *data, size_t len);
+
+    /**
+     * @brief Convert a format name from settings.json.
+     * @param name "auto", "text" or "binary".
+     * @return The format, auto if the name is not recognised.
+     */
+    static format format_from_string(const std::string &name);
+
+    /**
+     * @brief Convert a format to its name in settings.json.
+     * @param f The format.
+     * @return "auto", "text" or "binary".
+     */
+    static std::string format_to_string(format f);
+
+private:
+    void encode_text(const std::vector<int> &values);
+    void encode_binary(const std::vector<int> &values);
+
+    std::vector<uint8_t> _buf;
+    format _format;
+    bool _binary;
+    uint8_t _rejected_version;      ///< Last unsupported version a robot advertised, warned about once.
+    uint32_t _sequence;
+    std::chrono::steady_clock::time_point _start;
+};
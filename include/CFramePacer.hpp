@@ -0,0 +1,108 @@
+/**
+ * CFramePacer.hpp - decides when the UI needs to be drawn again
+ * 2024-06-26
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+/**
+ * @brief Frame pacing for an event driven draw loop.
+ *
+ * Frames are only drawn when something changed: input arrived, a new camera frame is ready, or the periodic refresh
+ * that keeps counters on screen moving is due. Frames are never drawn closer together than the max FPS allows, and
+ * while idle (window unfocused) never faster than the idle FPS. Between frames the caller sleeps for get_wait_ms(),
+ * typically in SDL_WaitEventTimeout so that input still wakes it immediately.
+ * @author vika
+ */
+class CFramePacer {
+public:
+
+    /**
+     * @brief Constructor for CFramePacer
+     * @param max_fps Fastest frame rate while active, 0 for no limit other than vsync.
+     * @param idle_fps Frame rate while idle, and of the refresh while nothing changes.
+     */
+    explicit CFramePacer(int max_fps = 60, int idle_fps = 5);
+
+    /**
+     * @brief Destructor for CFramePacer
+     */
+    ~CFramePacer();
+
+    /**
+     * @brief Set the fastest frame rate while active.
+     * @param fps Frames per second, 0 for no limit other than vsync.
+     */
+    void set_max_fps(int fps);
+
+    /**
+     * @brief Set the frame rate while idle, which is also the rate of the refresh while nothing changes.
+     * @param fps Frames per second, at least 1.
+     */
+    void set_idle_fps(int fps);
+
+    /**
+     * @brief Enter or leave idle mode.
+     * @param idle True while the window is unfocused or hidden.
+     */
+    void set_idle(bool idle);
+
+    /**
+     * @brief Check whether in idle mode.
+     * @return True if idle.
+     */
+    bool is_idle() const;
+
+    /**
+     * @brief Ask for frames to be drawn because something changed.
+     * @param frames Number of frames, more than one after input so the UI can settle (hover, popups, scrolling).
+     */
+    void request_frames(int frames = 1);
+
+    /**
+     * @brief Check whether a frame should be drawn now.
+     * @param now The current time.
+     * @return True if a frame is due.
+     */
+    bool should_draw(std::chrono::steady_clock::time_point now) const;
+
+    /**
+     * @brief Tell the pacer a frame was drawn.
+     * @param now The time the frame was started.
+     */
+    void drawn(std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Tell the pacer a due frame was not drawn, e.g. while minimized, so the next one is an interval away.
+     * @param now The time the frame was due and skipped.
+     */
+    void skipped(std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Get how long to sleep before the next frame is due, if nothing else happens first.
+     * @param now The current time.
+     * @return Time in milliseconds, 0 if a frame is due.
+     */
+    int get_wait_ms(std::chrono::steady_clock::time_point now) const;
+
+    /**
+     * @brief Get the rate frames are being drawn at.
+     * @return Frames per second, smoothed.
+     */
+    double get_fps() const;
+
+private:
+    std::chrono::steady_clock::time_point next_due() const;
+
+    std::chrono::steady_clock::duration _min_interval;     ///< 0 for no limit.
+    std::chrono::steady_clock::duration _idle_interval;
+    bool _idle;
+    int _pending_frames;
+    std::chrono::steady_clock::time_point _last_drawn;
+    double _fps;
+};
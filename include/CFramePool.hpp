@@ -0,0 +1,86 @@
+/**
+ * CFramePool.hpp - pooled cv::Mat storage, frames reuse buffers instead of going back to the heap
+ * 2024-06-30
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief A cv::MatAllocator that keeps released buffers and hands them out again to the next Mat of the same size.
+ *
+ * Once installed as the default allocator every cv::Mat allocates through it, including the outputs of clone(),
+ * cvtColor() and inRange(). A Mat's own reference count is the handle: when the last Mat sharing a buffer lets go,
+ * the buffer and its header go back to the pool instead of being freed, and the next Mat of that size gets them
+ * without touching the heap. After the first few frames the pipeline allocates nothing, which get_stats() shows.
+ *
+ * Sizes are rounded up so Mats that differ by a few bytes share buffers, small ones to a power of two and large
+ * ones to a whole page. The pool holds a limited number of buffers per size and in total, anything past that is
+ * freed as usual.
+ * @author vika
+ */
+class CFramePool : public cv::MatAllocator {
+public:
+
+    /**
+     * @brief Counters since the pool was created.
+     */
+    struct stats {
+        uint64_t heap_allocations;      ///< Buffers that had to come from the heap.
+        uint64_t heap_bytes;            ///< Bytes of those buffers.
+        uint64_t reused;                ///< Buffers handed out again from the pool.
+        uint64_t freed;                 ///< Buffers released back to the heap because the pool was full.
+        size_t pooled_bytes;            ///< Bytes waiting in the pool.
+        size_t live_bytes;              ///< Bytes in use by Mats.
+    };
+
+    /**
+     * @brief Get the pool, created the first time.
+     * @return The pool, never destroyed so Mats released during exit can still return their buffers.
+     */
+    static CFramePool &instance();
+
+    /**
+     * @brief Make the pool the default allocator for every cv::Mat created after this.
+     */
+    static void install();
+
+    /**
+     * @brief Get the pool's counters.
+     * @return The counters.
+     */
+    stats get_stats() const;
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usage_flags) const override;
+
+    bool allocate(cv::UMatData *data, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const override;
+
+    void deallocate(cv::UMatData *data) const override;
+
+private:
+    CFramePool();
+    ~CFramePool() override;
+
+    static size_t round_size(size_t size);
+
+    // free buffers by rounded size, each keeps its header so reuse allocates nothing at all
+    mutable std::mutex _mutex;
+    mutable std::unordered_map<size_t, std::vector<cv::UMatData *>> _free;
+    mutable size_t _pooled_bytes;
+
+    mutable std::atomic<uint64_t> _heap_allocations{0};
+    mutable std::atomic<uint64_t> _heap_bytes{0};
+    mutable std::atomic<uint64_t> _reused{0};
+    mutable std::atomic<uint64_t> _freed{0};
+    mutable std::atomic<size_t> _live_bytes{0};
+};
@@ -0,0 +1,134 @@
+/**
+ * CFrameRing.hpp - lock-free latest-frame handoff between threads
+ * 2024-06-03
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "CWakeSignal.hpp"
+
+#define FRAME_RING_SIGNALS 4    // most signals a ring can notify
+
+/**
+ * @brief Single-producer ring of reusable frames with generation counters.
+ *
+ * The producer fills the buffer returned by begin_write() and calls publish(). Each reader pins the newest complete
+ * frame with acquire() and reads it through view() without copying or blocking. A pinned slot is never written to
+ * until its reader acquires a newer frame, so a reader must not keep references (or cv::Mat header copies) to a view
+ * past its next acquire().
+ *
+ * Every frame carries the time it was captured, so stages further down the pipeline can tell how old their input is.
+ * @author vika
+ */
+class CFrameRing {
+public:
+
+    /**
+     * @brief Constructor for CFrameRing
+     * @param readers Number of reader ids that will call acquire(). The ring allocates readers + 2 slots so the
+     * producer always has a free slot to write into.
+     */
+    explicit CFrameRing(int readers = 2);
+
+    /**
+     * @brief Destructor for CFrameRing
+     */
+    ~CFrameRing();
+
+    /**
+     * @brief Get a free buffer for the producer to write the next frame into. Storage is reused between frames.
+     * @return Reference to the buffer. Only valid until publish() is called.
+     */
+    cv::Mat &begin_write();
+
+    /**
+     * @brief Make the buffer returned by begin_write() the newest frame, captured now.
+     */
+    void publish();
+
+    /**
+     * @brief Make the buffer returned by begin_write() the newest frame.
+     * @param captured When the frame, or the frame it was made from, was captured.
+     */
+    void publish(std::chrono::steady_clock::time_point captured);
+
+    /**
+     * @brief Pin the newest complete frame for a reader. Never blocks.
+     * @param reader The id of the reader, from 0 to readers - 1.
+     * @return True if a newer frame than the one previously pinned by this reader is now pinned.
+     */
+    bool acquire(int reader);
+
+    /**
+     * @brief Get the frame currently pinned by a reader.
+     * @param reader The id of the reader.
+     * @return Reference to the pinned frame, or an empty image if nothing has been pinned yet.
+     */
+    const cv::Mat &view(int reader) const;
+
+    /**
+     * @brief Get the generation of the frame currently pinned by a reader.
+     * @param reader The id of the reader.
+     * @return The generation, or 0 if nothing has been pinned yet.
+     */
+    uint64_t generation(int reader) const;
+
+    /**
+     * @brief Get when the frame currently pinned by a reader was captured.
+     * @param reader The id of the reader.
+     * @return The capture time, or the clock's epoch if nothing has been pinned yet.
+     */
+    std::chrono::steady_clock::time_point captured(int reader) const;
+
+    /**
+     * @brief Notify a signal whenever a frame is published, so a reader can sleep until there is a new one.
+     * @param signal The signal. Must outlive the ring or be removed first.
+     * @return False if the ring already notifies FRAME_RING_SIGNALS signals.
+     */
+    bool add_signal(CWakeSignal *signal);
+
+    /**
+     * @brief Stop notifying a signal. Once this returns the signal is no longer touched by publish().
+     * @param signal The signal.
+     */
+    void remove_signal(CWakeSignal *signal);
+
+    /**
+     * @brief Get the generation of the newest published frame.
+     * @return The generation, or 0 if nothing has been published yet.
+     */
+    uint64_t latest_generation() const;
+
+private:
+    struct slot {
+        cv::Mat img;
+        std::chrono::steady_clock::time_point captured;     ///< Only written while the producer owns the slot.
+        std::atomic<uint64_t> generation{0};    ///< 0 while the producer owns the slot.
+        std::atomic<int> readers{0};            ///< Number of readers pinning this slot.
+    };
+
+    struct pin {
+        int slot = -1;
+        uint64_t generation = 0;
+    };
+
+    int _slot_count;
+    std::unique_ptr<slot[]> _slots;
+    std::vector<pin> _pins;         ///< Each entry is only touched by its own reader.
+    std::atomic<int> _latest;
+    std::atomic<uint64_t> _latest_generation;
+    int _writing;
+    uint64_t _next_generation;
+    std::atomic<CWakeSignal *> _signals[FRAME_RING_SIGNALS];
+    std::atomic<int> _notifying;    ///< Set while publish() is notifying, so a removed signal can be waited out.
+    cv::Mat _empty;
+};
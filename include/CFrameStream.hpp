@@ -0,0 +1,188 @@
+/**
+ * CFrameStream.hpp - reassembly of arena frames from the tcp byte stream
+ * 2024-06-20
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CPacketQueue.hpp"
+
+/**
+ * @brief Splits the tcp byte stream back into whole arena frames, whatever the reads happen to contain.
+ *
+ * Two kinds of frames are recognised. In streaming mode the server pushes framed JPEGs, each preceded by a 20 byte
+ * little-endian header:
+ *
+ *  offset  size  field
+ *  0       2     magic ('Z', 'F')
+ *  2       1     version (1)
+ *  3       1     flags, reserved (0)
+ *  4       4     payload length
+ *  8       4     frame sequence number
+ *  12      8     capture timestamp, microseconds on the server's clock
+ *
+ * Old servers answer each "G 1" request with a bare JPEG, which is delimited by walking its marker segments to the
+ * start of scan and then looking for the end of image marker.
+ *
+ * The client controls streaming with text commands, like the legacy request:
+ *  - "S <n>" starts streaming with a window of n frames,
+ *  - "C <n>" allows n more frames, sent as frames are finished with,
+ *  - "G 1" requests a single frame.
+ *
+ * feed(), has_frame() and take_frame() are for the receiving thread only. The counters and is_streaming() can be read
+ * from any thread.
+ * @author vika
+ */
+class CFrameStream {
+public:
+    enum mode {
+        MODE_AUTO,      ///< Poll until the server starts pushing framed frames.
+        MODE_POLL,      ///< Request every frame, for servers without streaming.
+        MODE_STREAM,    ///< Only ask for the stream.
+    };
+
+    static constexpr uint8_t MAGIC_0 = 'Z';
+    static constexpr uint8_t MAGIC_1 = 'F';
+    static constexpr uint8_t VERSION = 1;
+    static constexpr size_t HEADER_SIZE = 20;
+
+    /**
+     * @brief A framed frame header.
+     */
+    struct header {
+        uint32_t length;
+        uint32_t sequence;
+        uint64_t capture_us;
+    };
+
+    /**
+     * @brief Constructor for CFrameStream
+     * @param max_frame Largest frame accepted, anything claiming to be bigger is treated as corrupt.
+     */
+    explicit CFrameStream(size_t max_frame = 4 * 1024 * 1024);
+
+    /**
+     * @brief Destructor for CFrameStream
+     */
+    ~CFrameStream();
+
+    /**
+     * @brief Append received bytes. A read may hold part of a frame or several frames.
+     * @param data The received bytes.
+     * @param len Number of received bytes.
+     */
+    void feed(const uint8_t *data, size_t len);
+
+    /**
+     * @brief Check whether a whole frame has been received, skipping anything between frames that isn't one.
+     * @return True if take_frame() will return a frame.
+     */
+    bool has_frame();
+
+    /**
+     * @brief Remove the frame found by has_frame(). Framed frames keep their header.
+     * @param out Receives the frame, or nullptr to discard it.
+     */
+    void take_frame(packet *out);
+
+    /**
+     * @brief Forget everything received so far, for a new connection.
+     */
+    void reset();
+
+    /**
+     * @brief Check whether the server has started pushing framed frames since the last reset().
+     * @return True if a framed frame was received.
+     */
+    bool is_streaming() const;
+
+    /**
+     * @brief Get the number of times bytes had to be skipped to find the next frame.
+     * @return The count.
+     */
+    uint64_t get_resync_count() const;
+
+    /**
+     * @brief Get the number of frames discarded with take_frame(nullptr).
+     * @return The count.
+     */
+    uint64_t get_discarded_count() const;
+
+    /**
+     * @brief Set which commands the client should send.
+     * @param m The mode.
+     */
+    void set_mode(mode m);
+
+    /**
+     * @brief Get the configured mode.
+     * @return The mode set with set_mode().
+     */
+    mode get_mode() const;
+
+    /**
+     * @brief Check whether frames still have to be requested one at a time.
+     * @return True in poll mode, and in auto mode until the server streams.
+     */
+    bool wants_polling() const;
+
+    /**
+     * @brief Read a framed frame header.
+     * @param data The frame bytes.
+     * @param len Number of bytes.
+     * @param out The header.
+     * @return True if the bytes start with a valid header and hold the whole payload.
+     */
+    static bool parse_header(const uint8_t *data, size_t len, header &out);
+
+    /**
+     * @brief Write a framed frame header, for servers and for checking the parser.
+     * @param h The header.
+     * @param out At least HEADER_SIZE bytes.
+     */
+    static void encode_header(const header &h, uint8_t *out);
+
+    /**
+     * @brief Write a command for the server, e.g. "C 2".
+     * @param out Receives the command.
+     * @param command The command letter.
+     * @param arg The argument.
+     */
+    static void encode_command(packet &out, char command, int arg);
+
+    /**
+     * @brief Convert a mode name from settings.json.
+     * @param name "auto", "poll" or "stream".
+     * @return The mode, auto if the name is not recognised.
+     */
+    static mode mode_from_string(const std::string &name);
+
+    /**
+     * @brief Convert a mode to its name in settings.json.
+     * @param m The mode.
+     * @return "auto", "poll" or "stream".
+     */
+    static std::string mode_to_string(mode m);
+
+private:
+    int scan_jpeg(const uint8_t *data, size_t avail);   ///< 1 if the jpeg is complete, 0 if not yet, -1 if corrupt.
+    void skip(size_t n);
+
+    std::vector<uint8_t> _buf;
+    size_t _head;           ///< Start of unconsumed bytes in _buf.
+    size_t _scan;           ///< How far into the current JPEG has been checked, so each byte is only looked at once.
+    bool _entropy;          ///< _scan is past the JPEG's start of scan.
+    size_t _ready;          ///< Length of the frame found by has_frame(), 0 if none.
+    size_t _max_frame;
+    mode _mode;
+    std::atomic<bool> _streaming;
+    std::atomic<uint64_t> _resyncs;
+    std::atomic<uint64_t> _discarded;
+};
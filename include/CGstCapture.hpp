@@ -0,0 +1,90 @@
+/**
+ * CGstCapture.hpp - gstreamer capture straight from an appsink, frames wrap the mapped buffers
+ * 2024-07-01
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include <opencv2/opencv.hpp>
+#include <spdlog/spdlog.h>
+
+/**
+ * @brief Reads the latest frame from a gstreamer pipeline without copying it.
+ *
+ * The pipeline's appsink is replaced by one that only keeps the newest buffer (drop=true max-buffers=1), so a slow
+ * reader skips to the current frame instead of working through a queue of stale ones. Frames are cv::Mats over the
+ * mapped buffer. The buffer stays mapped and held while any Mat shares it, and goes back to gstreamer when the last
+ * one is released, so keep frames only as long as they are needed and treat them as read only.
+ *
+ * For a local test without a camera:
+ *
+ *     CGstCapture capture;
+ *     capture.open("videotestsrc ! appsink");
+ * @author vika
+ */
+class CGstCapture {
+public:
+
+    /**
+     * @brief Constructor for CGstCapture
+     */
+    CGstCapture();
+
+    /**
+     * @brief Destructor for CGstCapture
+     */
+    ~CGstCapture();
+
+    /**
+     * @brief Start a pipeline and wait for its first frame.
+     * @param description Pipeline ending in an appsink, or only the source part. Any trailing appsink is replaced.
+     * @param timeout_ms How long to wait for the first frame.
+     * @return True if a frame arrived in time.
+     */
+    bool open(const std::string &description, int timeout_ms = 2000);
+
+    /**
+     * @brief Stop the pipeline. Frames already read stay valid.
+     */
+    void release();
+
+    /**
+     * @brief Check if a pipeline is running.
+     * @return True between a successful open() and release() or the pipeline ending.
+     */
+    bool is_opened() const;
+
+    /**
+     * @brief Read the newest frame, waiting a short while if there is none yet.
+     * @param frame Set to a CV_8UC3 BGR Mat over the buffer, the previous frame it held is released.
+     * @param captured If not null, set to when the buffer was captured according to its timestamp.
+     * @return True if there was a frame. The pipeline is released if it ended or failed.
+     */
+    bool read(cv::Mat &frame, std::chrono::steady_clock::time_point *captured = nullptr);
+
+    /**
+     * @brief Get the number of frames read since open().
+     * @return The count.
+     */
+    uint64_t get_frame_count() const;
+
+private:
+    bool check_bus();
+    std::chrono::steady_clock::time_point capture_time(GstSample *sample);
+
+    GstElement *_pipeline;
+    GstElement *_sink;
+    GstSample *_pending;        ///< First frame, pulled by open() and handed out by the next read().
+    uint64_t _frames;
+};
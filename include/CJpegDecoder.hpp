@@ -0,0 +1,133 @@
+/**
+ * CJpegDecoder.hpp - jpeg decoding off the network thread, newest frame first
+ * 2024-06-21
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "CFrameRing.hpp"
+#include "CPacketQueue.hpp"
+#include "CPerfStats.hpp"
+
+/**
+ * @brief Decodes received jpeg frames on a small pool of worker threads and publishes them to a frame ring.
+ *
+ * Only one encoded frame waits at a time. Submitting a new one replaces a frame no worker has started on yet, and a
+ * frame that finishes decoding after a newer one is thrown away, so the ring only ever moves forward. Each worker
+ * decodes into its own image and swaps it with the ring's free slot, so once frame sizes settle nothing is allocated
+ * or copied. Frames are published with the time their packet was stamped as received, so decode time counts towards
+ * their age.
+ * @author vika
+ */
+class CJpegDecoder {
+public:
+
+    /**
+     * @brief Constructor for CJpegDecoder
+     * @param output Ring that decoded frames are published to. The decoder is its only producer.
+     * @param pool Pool that submitted packets are returned to.
+     * @param workers Number of decoding threads.
+     */
+    CJpegDecoder(CFrameRing &output, CPacketPool &pool, int workers = 2);
+
+    /**
+     * @brief Destructor for CJpegDecoder. Stops the workers if still running.
+     */
+    ~CJpegDecoder();
+
+    /**
+     * @brief Start the worker threads.
+     */
+    void start();
+
+    /**
+     * @brief Stop the worker threads and wait for them to finish the frame they are decoding.
+     */
+    void stop();
+
+    /**
+     * @brief Hand over an encoded frame. Replaces the waiting frame if no worker has picked it up yet.
+     * @param p The packet, owned by the decoder from now on.
+     * @param offset Where the jpeg starts in the packet.
+     */
+    void submit(packet *p, size_t offset);
+
+    /**
+     * @brief Decode at reduced resolution, for when the full frame isn't needed.
+     * @param reduction 1 for full size, 2, 4 or 8 to divide both dimensions.
+     */
+    void set_reduction(int reduction);
+
+    /**
+     * @brief Get the resolution reduction.
+     * @return 1, 2, 4 or 8.
+     */
+    int get_reduction() const;
+
+    /**
+     * @brief Get the number of frames published.
+     * @return The count.
+     */
+    uint64_t get_decoded_count() const;
+
+    /**
+     * @brief Get the number of frames replaced before decoding or finished after a newer frame.
+     * @return The count.
+     */
+    uint64_t get_skipped_count() const;
+
+    /**
+     * @brief Get the number of frames that could not be decoded.
+     * @return The count.
+     */
+    uint64_t get_failed_count() const;
+
+    /**
+     * @brief Get how long the last decode took.
+     * @return Time in milliseconds.
+     */
+    double get_last_decode_ms() const;
+
+    /**
+     * @brief Get the average decode time since start.
+     * @return Time in milliseconds.
+     */
+    double get_average_decode_ms() const;
+
+private:
+    static void thread_decode(CJpegDecoder *who_called);
+    void decode_loop();
+
+    CFrameRing &_output;
+    CPacketPool &_pool;
+    int _worker_count;
+    std::vector<std::thread> _workers;
+    bool _running;
+
+    std::mutex _mutex;              ///< Guards the waiting frame and _running.
+    std::condition_variable _cv;
+    packet *_pending;
+    size_t _pending_offset;
+    uint64_t _pending_order;
+    uint64_t _submitted;
+
+    std::mutex _mutex_publish;      ///< Workers finish in any order, only one publishes at a time.
+    uint64_t _published_order;
+
+    std::atomic<int> _reduction;
+    std::atomic<uint64_t> _decoded;
+    std::atomic<uint64_t> _skipped;
+    std::atomic<uint64_t> _failed;
+    std::atomic<uint64_t> _last_decode_us;
+    std::atomic<uint64_t> _total_decode_us;
+};
@@ -0,0 +1,68 @@
+/**
+ * CMarkerTracker.hpp - persistent ArUco detector with ROI tracking between frames
+ * 2024-06-10
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief Detects ArUco markers, only searching around where they were last seen.
+ *
+ * The detector is configured once. While markers are being tracked only a padded region around each marker's last
+ * corners is searched. The whole frame is scanned when there is nothing to track, when a tracked marker is lost, and
+ * every few frames to pick up markers that just came into view.
+ * @author vika
+ */
+class CMarkerTracker {
+public:
+
+    /**
+     * @brief Constructor for CMarkerTracker
+     * @param full_scan_interval Scan the whole frame at least once every this many frames.
+     * @param roi_padding Padding around each marker's bounding box, as a fraction of the box size.
+     */
+    explicit CMarkerTracker(int full_scan_interval = 30, float roi_padding = 0.5f);
+
+    /**
+     * @brief Destructor for CMarkerTracker
+     */
+    ~CMarkerTracker();
+
+    /**
+     * @brief Detect markers in the next frame.
+     * @param image The frame to search.
+     * @param corners Corners of each detected marker, in frame coordinates.
+     * @param ids Id of each detected marker.
+     */
+    void detect(const cv::Mat &image, std::vector<std::vector<cv::Point2f>> &corners, std::vector<int> &ids);
+
+    /**
+     * @brief Forget all tracked markers so the next frame is fully scanned.
+     */
+    void reset();
+
+    /**
+     * @brief Check whether the last call to detect() scanned the whole frame.
+     * @return True if the last detection was a full-frame scan.
+     */
+    bool was_full_scan() const;
+
+private:
+    std::vector<cv::Rect> tracked_regions(const cv::Size &frame_size) const;
+
+    cv::aruco::ArucoDetector _detector;
+    std::vector<std::vector<cv::Point2f>> _tracked_corners;
+    std::vector<int> _tracked_ids;
+    std::vector<std::vector<cv::Point2f>> _roi_corners;
+    std::vector<int> _roi_ids;
+    cv::Size _last_frame_size;
+    int _full_scan_interval;
+    int _frames_since_full_scan;
+    float _roi_padding;
+    bool _last_full_scan;
+};
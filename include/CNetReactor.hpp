@@ -0,0 +1,110 @@
+/**
+ * CNetReactor.hpp - event driven loop for networking
+ * 2024-06-17
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Runs networking callbacks on a single thread that sleeps until there is something to do.
+ *
+ * The thread wakes as soon as a task is posted from another thread, when a periodic timer is due, or (on Linux) when
+ * a watched file descriptor becomes readable. On Linux it waits in epoll with an eventfd for posted tasks, elsewhere
+ * on a condition variable.
+ * @author vika
+ */
+class CNetReactor {
+public:
+    typedef std::function<void()> task;
+
+    /**
+     * @brief Constructor for CNetReactor
+     */
+    CNetReactor();
+
+    /**
+     * @brief Destructor for CNetReactor. Stops the thread if still running.
+     */
+    ~CNetReactor();
+
+    /**
+     * @brief Start the reactor thread.
+     */
+    void start();
+
+    /**
+     * @brief Stop the reactor thread and wait for it to finish the callback it is running.
+     */
+    void stop();
+
+    /**
+     * @brief Run a task on the reactor thread as soon as possible. Safe to call from any thread.
+     * @param t The task.
+     */
+    void post(task t);
+
+    /**
+     * @brief Run a task on the reactor thread at a fixed rate. Call before start() or from the reactor thread.
+     * @param period Time between runs.
+     * @param t The task.
+     */
+    void add_timer(std::chrono::milliseconds period, task t);
+
+    /**
+     * @brief Run a task on the reactor thread whenever a file descriptor is readable. Linux only. Call before start()
+     * or from the reactor thread.
+     * @param fd The file descriptor, should be non-blocking.
+     * @param on_readable The task.
+     * @return True if the descriptor is being watched.
+     */
+    bool watch(int fd, task on_readable);
+
+    /**
+     * @brief Stop watching a file descriptor. Call from the reactor thread.
+     * @param fd The file descriptor.
+     */
+    void unwatch(int fd);
+
+private:
+    struct timer {
+        std::chrono::steady_clock::time_point next;
+        std::chrono::milliseconds period;
+        task t;
+    };
+
+    static void thread_loop(CNetReactor *who_called);
+    void loop();
+    void wait_until(std::chrono::steady_clock::time_point deadline, bool has_deadline);
+    void run_posted();
+    void run_timers();
+
+    std::thread _thread;
+    std::atomic<bool> _running;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<task> _posted, _running_tasks;
+    std::vector<timer> _timers;
+    std::map<int, task> _watched;
+#ifdef __linux__
+    int _epoll_fd;
+    int _event_fd;
+#endif
+};
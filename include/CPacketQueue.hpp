@@ -0,0 +1,141 @@
+/**
+ * CPacketQueue.hpp - bounded packet queues backed by a pool of reusable buffers
+ * 2024-06-19
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "CBoundedQueue.hpp"
+
+typedef std::vector<uint8_t> packet;
+
+/**
+ * @brief Fixed set of packet buffers that are handed out and returned instead of allocated per packet.
+ *
+ * Buffers keep their capacity between uses, so once each has grown to the largest packet seen nothing is allocated.
+ * acquire() and release() are lock-free and can be called from any thread.
+ * @author vika
+ */
+class CPacketPool {
+public:
+
+    /**
+     * @brief Constructor for CPacketPool
+     * @param count Number of buffers.
+     * @param capacity Bytes reserved up front in each buffer.
+     */
+    CPacketPool(size_t count, size_t capacity);
+
+    /**
+     * @brief Destructor for CPacketPool
+     */
+    ~CPacketPool();
+
+    /**
+     * @brief Take an empty buffer from the pool.
+     * @return The buffer, or nullptr if all buffers are in use.
+     */
+    packet *acquire();
+
+    /**
+     * @brief Return a buffer to the pool.
+     * @param p The buffer, must have come from acquire() on this pool.
+     */
+    void release(packet *p);
+
+    /**
+     * @brief Get how many times acquire() found the pool empty.
+     * @return The count.
+     */
+    uint64_t get_exhausted_count() const;
+
+    /**
+     * @brief Record when a buffer's data arrived. Travels with the buffer through queues until it is next stamped.
+     * @param p The buffer, must have come from acquire() on this pool.
+     * @param received The arrival time.
+     */
+    void stamp(packet *p, std::chrono::steady_clock::time_point received);
+
+    /**
+     * @brief Get when a buffer's data arrived.
+     * @param p The buffer, must have come from acquire() on this pool.
+     * @return The time given to stamp(), or the time the buffer was last acquired if never stamped.
+     */
+    std::chrono::steady_clock::time_point get_stamp(const packet *p) const;
+
+private:
+    std::vector<packet> _buffers;
+    std::vector<std::chrono::steady_clock::time_point> _stamps;     ///< Per buffer, handed over with it by the queues.
+    CBoundedQueue<packet *> _free;
+    std::atomic<uint64_t> _exhausted;
+};
+
+/**
+ * @brief Bounded lock-free queue of pooled packets with an explicit policy for when it is full.
+ *
+ * Queued packets are owned by the queue. Packets that are dropped go straight back to the pool and are counted.
+ * @author vika
+ */
+class CPacketQueue {
+public:
+    enum drop_policy {
+        DROP_OLDEST,    ///< Make room by discarding the oldest queued packet, for data where only the latest matters.
+        DROP_NEWEST,    ///< Discard the packet being pushed, for data that must stay in order.
+    };
+
+    /**
+     * @brief Constructor for CPacketQueue
+     * @param capacity Maximum number of queued packets, rounded up to a power of two.
+     * @param pool Pool that queued and dropped packets are returned to.
+     * @param policy What to drop when the queue is full.
+     */
+    CPacketQueue(size_t capacity, CPacketPool &pool, drop_policy policy);
+
+    /**
+     * @brief Destructor for CPacketQueue. Returns queued packets to the pool.
+     */
+    ~CPacketQueue();
+
+    /**
+     * @brief Queue a packet. Ownership passes to the queue even if a packet ends up dropped.
+     * @param p The packet.
+     * @return False if a packet was dropped.
+     */
+    bool push(packet *p);
+
+    /**
+     * @brief Take the oldest packet. Return it with release() once done with it.
+     * @return The packet, or nullptr if the queue is empty.
+     */
+    packet *pop();
+
+    /**
+     * @brief Return a popped packet to the pool.
+     * @param p The packet.
+     */
+    void release(packet *p);
+
+    /**
+     * @brief Get the number of dropped packets.
+     * @return The count.
+     */
+    uint64_t get_dropped_count() const;
+
+    /**
+     * @brief Get the number of queued packets. Only approximate while other threads use the queue.
+     * @return The count.
+     */
+    size_t size() const;
+
+private:
+    CBoundedQueue<packet *> _queue;
+    CPacketPool &_pool;
+    drop_policy _policy;
+    std::atomic<uint64_t> _dropped;
+};
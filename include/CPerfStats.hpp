@@ -0,0 +1,167 @@
+/**
+ * CPerfStats.hpp - per-stage latency histograms
+ * 2024-06-25
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+/**
+ * @brief Latency histograms for named stages, recorded from any thread without locks.
+ *
+ * Each thread records into its own set of histograms, so recording is a few relaxed stores with no contention, and
+ * snapshots merge every thread's histograms. Histograms are log-linear like HdrHistogram: durations up to 63 us get
+ * their own bucket, longer ones are bucketed with 32 buckets per power of two, which keeps every reported value
+ * within about 3% of the real one up to 71 minutes.
+ *
+ * Stages are registered by name, usually once at startup into a static:
+ *
+ *     static const int PERF_WARP = CPerfStats::add_stage("core.warp");
+ *     ...
+ *     {
+ *         CPerfTimer t(PERF_WARP);
+ *         warp();
+ *     }
+ * @author vika
+ */
+class CPerfStats {
+public:
+    static constexpr int MAX_STAGES = 64;
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int MAX_VALUE_BITS = 32;
+    static constexpr int BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    /**
+     * @brief A copy of one stage's histogram, merged across threads.
+     */
+    struct snapshot {
+        std::string name;
+        uint64_t count;
+        uint64_t total_us;
+        uint64_t max_us;
+        std::vector<uint64_t> buckets;
+
+        /**
+         * @brief Get a percentile.
+         * @param p The percentile, 0 to 100.
+         * @return The duration in microseconds that p percent of samples were at or under, 0 if there are none.
+         */
+        uint64_t percentile(double p) const;
+
+        /**
+         * @brief Get the average duration.
+         * @return The average in microseconds, 0 if there are no samples.
+         */
+        double mean() const;
+
+        /**
+         * @brief Get the samples recorded after an earlier snapshot of the same stage was taken.
+         * @param earlier The earlier snapshot.
+         * @return The difference. Its maximum is the largest bucket's value rather than the exact maximum.
+         */
+        snapshot since(const snapshot &earlier) const;
+    };
+
+    /**
+     * @brief Register a stage, or look up a stage that is already registered.
+     * @param name The stage's name, e.g. "core.warp".
+     * @return The stage id, -1 if there are already MAX_STAGES stages.
+     */
+    static int add_stage(const std::string &name);
+
+    /**
+     * @brief Get the number of registered stages. Ids run from 0 to this minus one.
+     * @return The count.
+     */
+    static int get_stage_count();
+
+    /**
+     * @brief Record a duration. Safe to call from any thread, does nothing for invalid ids.
+     * @param stage The stage id.
+     * @param us The duration in microseconds.
+     */
+    static void record(int stage, uint64_t us);
+
+    /**
+     * @brief Merge a stage's histograms from every thread.
+     * @param stage The stage id.
+     * @return The merged histogram.
+     */
+    static snapshot get_snapshot(int stage);
+
+    /**
+     * @brief Merge the histograms of every registered stage.
+     * @return One snapshot per stage, in id order.
+     */
+    static std::vector<snapshot> get_snapshots();
+
+    /**
+     * @brief Write every stage's summary and histogram to a json file.
+     * @param path The file to write.
+     * @return True if written.
+     */
+    static bool dump(const std::string &path);
+
+    /**
+     * @brief Get the bucket a duration is counted in.
+     * @param us The duration in microseconds.
+     * @return The bucket index.
+     */
+    static int get_bucket(uint64_t us);
+
+    /**
+     * @brief Get the largest duration counted in a bucket.
+     * @param bucket The bucket index.
+     * @return The duration in microseconds.
+     */
+    static uint64_t get_bucket_value(int bucket);
+};
+
+/**
+ * @brief Records the time from its construction to its destruction, or to stop(), into a CPerfStats stage.
+ * @author vika
+ */
+class CPerfTimer {
+public:
+
+    /**
+     * @brief Constructor for CPerfTimer. Starts timing.
+     * @param stage The stage id from CPerfStats::add_stage.
+     */
+    explicit CPerfTimer(int stage);
+
+    /**
+     * @brief Destructor for CPerfTimer. Records the duration if not already stopped.
+     */
+    ~CPerfTimer();
+
+    CPerfTimer(const CPerfTimer &) = delete;
+    CPerfTimer &operator=(const CPerfTimer &) = delete;
+
+    /**
+     * @brief Record the duration now instead of at destruction.
+     * @return The duration in microseconds.
+     */
+    uint64_t stop();
+
+private:
+    int _stage;
+    bool _running;
+    std::chrono::steady_clock::time_point _start;
+};
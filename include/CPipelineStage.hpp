@@ -0,0 +1,105 @@
+/**
+ * CPipelineStage.hpp - one stage of the vision pipeline on its own thread
+ * 2024-06-28
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "CWakeSignal.hpp"
+
+/**
+ * @brief Runs a pipeline step on its own thread whenever its input changes.
+ *
+ * Stages are connected by frame rings, which hold only the newest frame, so a slow stage skips frames instead of
+ * queueing them and the pipeline runs at the rate of its slowest stage rather than the sum of all of them. The step is
+ * run again straight away while it finds work, otherwise the thread sleeps until the input ring notifies signal() or
+ * the poll interval passes, so steps can also pick up changed settings.
+ *
+ * Occupancy is the fraction of time spent in steps that did work, over the last second. A stage near 1 is the one
+ * holding the pipeline back.
+ * @author vika
+ */
+class CPipelineStage {
+public:
+
+    /**
+     * @brief A pipeline step.
+     * @return True if it did work, false if there was nothing new.
+     */
+    typedef std::function<bool()> step;
+
+    /**
+     * @brief Constructor for CPipelineStage
+     * @param name Name for logs and stats.
+     */
+    explicit CPipelineStage(std::string name);
+
+    /**
+     * @brief Destructor for CPipelineStage. Stops the thread if still running.
+     */
+    ~CPipelineStage();
+
+    /**
+     * @brief Start running a step on the stage's thread.
+     * @param s The step. Only ever called from the stage's thread.
+     * @param poll Longest to sleep without being notified.
+     */
+    void start(step s, std::chrono::milliseconds poll);
+
+    /**
+     * @brief Stop the thread and wait for the step it is running to finish.
+     */
+    void stop();
+
+    /**
+     * @brief Get the signal that wakes the stage, for the input rings to notify.
+     * @return The signal.
+     */
+    CWakeSignal &signal();
+
+    /**
+     * @brief Get the stage's name.
+     * @return The name.
+     */
+    const std::string &get_name() const;
+
+    /**
+     * @brief Get the fraction of time spent doing work over the last second.
+     * @return From 0 to 1.
+     */
+    double get_occupancy() const;
+
+    /**
+     * @brief Get the number of steps that did work since start.
+     * @return The count.
+     */
+    uint64_t get_run_count() const;
+
+    /**
+     * @brief Get the time spent in steps that did work since start.
+     * @return Time in microseconds.
+     */
+    uint64_t get_busy_us() const;
+
+private:
+    static void thread_stage(CPipelineStage *who_called);
+
+    std::string _name;
+    step _step;
+    std::chrono::milliseconds _poll;
+    std::thread _thread;
+    std::atomic<bool> _running;
+    CWakeSignal _signal;
+
+    std::atomic<double> _occupancy;
+    std::atomic<uint64_t> _runs;
+    std::atomic<uint64_t> _busy_us;
+};
@@ -0,0 +1,72 @@
+/**
+ * CPyramidMask.hpp - coarse-to-fine arena mask, full resolution only around the car
+ * 2024-06-30
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <algorithm>
+
+#include <opencv2/opencv.hpp>
+
+#include "CHSVMask.hpp"
+#include "CCarLocalizer.hpp"
+
+/**
+ * @brief Masks an image at a lower pyramid level to find the car, then at full resolution only in a window around it.
+ *
+ * Level n works on an image 2^n times smaller on each side, so level 2 of the 1440x1440 arena is 360x360 and has 16x
+ * fewer pixels to threshold and label. The output mask is full size with the car's window masked at full resolution
+ * and zero everywhere else, so anything that localizes on it gets the same centroid as from a full mask.
+ * @author vika
+ */
+class CPyramidMask {
+public:
+
+    /**
+     * @brief Constructor for CPyramidMask
+     * @param level Pyramid level, 0 to mask the whole image at full resolution.
+     * @param margin Extra coarse pixels around the car's window, for edges the coarse level missed.
+     */
+    explicit CPyramidMask(int level = 0, int margin = 2);
+
+    /**
+     * @brief Destructor for CPyramidMask
+     */
+    ~CPyramidMask();
+
+    /**
+     * @brief Set the pyramid level.
+     * @param level 0 to 4, 0 to mask the whole image at full resolution.
+     */
+    void set_level(int level);
+
+    /**
+     * @brief Get the pyramid level.
+     * @return The level.
+     */
+    int get_level() const;
+
+    /**
+     * @brief Mask an image.
+     * @param hsv Thresholds to mask with.
+     * @param input CV_8UC3 BGR image.
+     * @param mask CV_8UC1 output, the size of the input.
+     * @param region Optional CV_8UC1 mask the size of the input, nothing outside it is masked or searched for the car.
+     */
+    void apply(const CHSVMask &hsv, const cv::Mat &input, cv::Mat &mask, const cv::Mat &region = cv::Mat());
+
+    /**
+     * @brief Get the window that was masked at full resolution by the last apply().
+     * @return The window in input pixels, empty if the car was not found or the level is 0.
+     */
+    cv::Rect get_window() const;
+
+private:
+    int _level;
+    int _margin;
+    cv::Mat _small, _coarse, _small_region;
+    CCarLocalizer _localizer;
+    cv::Rect _window;
+};
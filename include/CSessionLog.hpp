@@ -0,0 +1,217 @@
+/**
+ * CSessionLog.hpp - memory-mapped binary log of what was sent to the robot and why
+ * 2024-06-24
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Append-only session log of fixed-size records, written straight into a memory-mapped file.
+ *
+ * The file is a 64 byte header followed by 64 byte records, all little-endian:
+ *
+ *  header  offset  size  field
+ *          0       4     magic ("ZLOG")
+ *          4       2     version (1)
+ *          6       2     record size (64)
+ *          8       8     wall clock time when the log was opened, microseconds since the unix epoch
+ *          16      8     capacity in records
+ *          24      40    reserved (0)
+ *
+ *  record  offset  size  field
+ *          0       8     time since the log was opened, microseconds on the monotonic clock
+ *          8       2     type, 0 marks the end of the log
+ *          10      2     number of values used
+ *          12      4     aux, meaning depends on the type
+ *          16      48    12 x int32 values
+ *
+ * The file is sized for its capacity when opened, so logging is a slot reservation and a copy into mapped memory,
+ * with no locks or system calls, and any thread can log. A record's type is written last, so one cut short by a crash
+ * reads as unused. Threads can finish their records out of order, so a crashed log may have unused records between
+ * whole ones: readers skip them and the log ends at the last whole record. Once full, further records are dropped and
+ * counted. The file is trimmed to the records written when closed.
+ * @author vika
+ */
+class CSessionLog {
+public:
+    enum record_type {
+        REC_END,            ///< Unused space.
+        REC_CONTROL,        ///< Values sent to the robot. aux: 1 if sent as binary.
+        REC_AUTO_INPUT,     ///< Autonomous controller outputs: move x, move y, rotate.
+        REC_CAR,            ///< Car position and autonomous destination: x, y, destination x, destination y.
+        REC_WAYPOINT,       ///< Waypoint started: x, y, speed, rotation, turret. aux: step, 0 when autonomy ends.
+        REC_RTT,            ///< Robot round trip time in milliseconds.
+        REC_TYPE_COUNT,
+    };
+
+    static constexpr int MAX_VALUES = 12;
+    static constexpr uint16_t VERSION = 1;
+
+    struct header {
+        char magic[4];
+        uint16_t version;
+        uint16_t record_size;
+        uint64_t start_unix_us;
+        uint64_t capacity;
+        uint8_t reserved[40];
+    };
+
+    struct record {
+        uint64_t time_us;
+        uint16_t type;
+        uint16_t count;
+        uint32_t aux;
+        int32_t values[MAX_VALUES];
+    };
+
+    static_assert(sizeof(header) == 64, "session log header must be 64 bytes");
+    static_assert(sizeof(record) == 64, "session log record must be 64 bytes");
+
+    /**
+     * @brief Constructor for CSessionLog
+     */
+    CSessionLog();
+
+    /**
+     * @brief Destructor for CSessionLog. Closes the log if still open.
+     */
+    ~CSessionLog();
+
+    /**
+     * @brief Create the log file and map it.
+     * @param path File to create, replaced if it exists.
+     * @param capacity Maximum number of records.
+     * @return True if the log is ready for writing.
+     */
+    bool open(const std::string &path, uint64_t capacity);
+
+    /**
+     * @brief Unmap the log and trim the file to the records written. No thread may be logging.
+     */
+    void close();
+
+    /**
+     * @brief Check whether the log is open.
+     * @return True if records are being written.
+     */
+    bool is_open() const;
+
+    /**
+     * @brief Append a record. Safe to call from any thread, does nothing if the log is not open.
+     * @param type The record type.
+     * @param aux Type specific value.
+     * @param values The values.
+     * @param count Number of values, extra values are not logged.
+     */
+    void log(record_type type, uint32_t aux, const int32_t *values, int count);
+
+    /**
+     * @brief Log the values sent to the robot.
+     * @param values The values, in value_type order.
+     * @param binary True if sent as a binary packet.
+     */
+    void log_control(const std::vector<int> &values, bool binary);
+
+    /**
+     * @brief Log the autonomous controller's outputs.
+     * @param move_x Sideways movement.
+     * @param move_y Forward movement.
+     * @param rotate Rotation.
+     */
+    void log_auto_input(int move_x, int move_y, int rotate);
+
+    /**
+     * @brief Log where autonomous thinks the car is and where it is driving to.
+     * @param car_x Car position.
+     * @param car_y Car position.
+     * @param dest_x Destination.
+     * @param dest_y Destination.
+     */
+    void log_car(int car_x, int car_y, int dest_x, int dest_y);
+
+    /**
+     * @brief Log a waypoint being started.
+     * @param step Index of the waypoint, 0 when autonomy ends.
+     * @param x Waypoint position.
+     * @param y Waypoint position.
+     * @param speed Speed to drive at.
+     * @param rotation Rotation to turn to.
+     * @param turret True if the turret is enabled.
+     */
+    void log_waypoint(int step, int x, int y, int speed, int rotation, bool turret);
+
+    /**
+     * @brief Log a round trip time sample.
+     * @param ms Round trip time in milliseconds.
+     */
+    void log_rtt(long ms);
+
+    /**
+     * @brief Get the number of records written.
+     * @return The count.
+     */
+    uint64_t get_written_count() const;
+
+    /**
+     * @brief Get the number of records dropped because the log was full.
+     * @return The count.
+     */
+    uint64_t get_dropped_count() const;
+
+    /**
+     * @brief Get the path of the open log.
+     * @return The path, empty if not open.
+     */
+    const std::string &get_path() const;
+
+    /**
+     * @brief Get a record type's name, for printing.
+     * @param type The type.
+     * @return The name, "unknown" for types this version doesn't know.
+     */
+    static const char *get_type_name(uint16_t type);
+
+    /**
+     * @brief Get the names of a record type's values, for printing.
+     * @param type The type.
+     * @return Names, one per value.
+     */
+    static std::vector<std::string> get_value_names(uint16_t type);
+
+private:
+    void unmap();
+
+    std::string _path;
+    uint8_t *_map;
+    size_t _map_size;
+    uint64_t _capacity;
+    std::chrono::steady_clock::time_point _start;
+    std::atomic<bool> _open;
+    std::atomic<uint64_t> _next;        ///< Next free slot, may run past the capacity.
+    std::atomic<uint64_t> _dropped;
+#ifdef _WIN32
+    HANDLE _file;
+    HANDLE _mapping;
+#else
+    int _fd;
+#endif
+};
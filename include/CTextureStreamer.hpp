@@ -0,0 +1,74 @@
+/**
+ * CTextureStreamer.hpp - asynchronous texture uploads through pixel buffer objects
+ * 2024-06-12
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+#include <opencv2/opencv.hpp>
+#include <SDL.h>
+#include <SDL_opengl.h>
+
+/**
+ * @brief Streams OpenCV images into one OpenGL texture.
+ *
+ * Texture storage is allocated once per image size (immutable if glTexStorage2D is available) and updated with
+ * glTexSubImage2D from two alternating pixel buffer objects, so the driver can copy one frame while the next is being
+ * written. BGR images are uploaded as GL_BGR, skipping the swizzle copy, and nothing is uploaded if the frame did not
+ * change. All functions must be called from the thread that owns the GL context.
+ * @author vika
+ */
+class CTextureStreamer {
+public:
+
+    /**
+     * @brief Constructor for CTextureStreamer. No GL calls are made until the first update().
+     */
+    CTextureStreamer();
+
+    /**
+     * @brief Destructor for CTextureStreamer. Must run while the GL context still exists.
+     */
+    ~CTextureStreamer();
+
+    CTextureStreamer(const CTextureStreamer &) = delete;
+    CTextureStreamer &operator=(const CTextureStreamer &) = delete;
+
+    /**
+     * @brief Upload a frame unless it is the one already in the texture.
+     * @param input CV_8UC3 BGR or CV_8UC4 BGRA image. Other types are converted to BGR first.
+     * @param generation Frame counter of the source. Frames with the same data pointer and a non-zero generation
+     * equal to the last upload are skipped.
+     * @return True if the frame was uploaded, false if it was skipped or the upload failed and should be retried.
+     */
+    bool update(const cv::Mat &input, uint64_t generation = 0);
+
+    /**
+     * @brief Get the texture handle to draw with.
+     * @return The texture, or 0 if nothing was uploaded yet.
+     */
+    GLuint get_texture() const;
+
+    /**
+     * @brief Get the size of the texture.
+     * @return Size of the last uploaded frame.
+     */
+    cv::Size get_size() const;
+
+private:
+    void allocate(const cv::Size &size);
+    void release();
+
+    GLuint _texture;
+    GLuint _pbo[2];
+    int _pbo_index;
+    bool _use_pbo;
+    cv::Size _size;
+    const uchar *_last_data;
+    uint64_t _last_generation;
+    cv::Mat _converted;
+};
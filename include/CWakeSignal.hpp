@@ -0,0 +1,49 @@
+/**
+ * CWakeSignal.hpp - wakes a sleeping thread when there is new work
+ * 2024-06-27
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * @brief Lets producers wake a thread that sleeps until there is work or a deadline passes.
+ *
+ * Notifications are not counted: any number of them while the thread is busy wake it once, so it should take all the
+ * work there is each time it wakes. A notification before the thread starts waiting is not lost.
+ * @author vika
+ */
+class CWakeSignal {
+public:
+
+    /**
+     * @brief Constructor for CWakeSignal
+     */
+    CWakeSignal();
+
+    /**
+     * @brief Destructor for CWakeSignal
+     */
+    ~CWakeSignal();
+
+    /**
+     * @brief Wake the waiting thread, or make its next wait return immediately. Safe to call from any thread.
+     */
+    void notify();
+
+    /**
+     * @brief Sleep until notified or the deadline passes.
+     * @param deadline When to stop waiting.
+     * @return True if woken by notify().
+     */
+    bool wait_until(std::chrono::steady_clock::time_point deadline);
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _notified;
+};
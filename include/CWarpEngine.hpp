@@ -0,0 +1,95 @@
+/**
+ * CWarpEngine.hpp - cached homography warp using precomputed remap tables
+ * 2024-06-05
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief Warps images from a quad in the source image to a square output.
+ *
+ * The homography and the fixed-point remap tables are only rebuilt when the quad corners change, so steady state
+ * warping is a single table lookup per pixel. Tables can be saved to and loaded from disk to skip the rebuild at
+ * startup.
+ * @author vika
+ */
+class CWarpEngine {
+public:
+
+    /**
+     * @brief Constructor for CWarpEngine
+     * @param dim Width and height of the warped output in pixels.
+     */
+    explicit CWarpEngine(int dim);
+
+    /**
+     * @brief Destructor for CWarpEngine
+     */
+    ~CWarpEngine();
+
+    /**
+     * @brief Set the source quad. Rebuilds the homography and remap tables only if the corners changed.
+     * @param corners The four corners of the quad in the source image, clockwise from top left.
+     * @return True if the tables were rebuilt.
+     */
+    bool set_corners(const std::vector<cv::Point> &corners);
+
+    /**
+     * @brief Warp an image through the cached tables, in parallel horizontal stripes.
+     * @param input The source image.
+     * @param output The warped image. Storage is reused if already the right size and type.
+     */
+    void apply(const cv::Mat &input, cv::Mat &output) const;
+
+    /**
+     * @brief Get the homography from source image to warped image coordinates.
+     * @return The 3x3 homography, or an empty matrix if no corners have been set.
+     */
+    const cv::Mat &homography() const;
+
+    /**
+     * @brief Get the homography from a source quad to a square, without building any tables.
+     * @param corners The four corners of the quad in the source image, clockwise from top left.
+     * @param dim Width and height of the square.
+     * @return The 3x3 homography, or an empty matrix if the quad is degenerate.
+     */
+    static cv::Mat find_homography(const std::vector<cv::Point> &corners, int dim);
+
+    /**
+     * @brief Get a counter that increases every time the tables are rebuilt or loaded.
+     * @return The generation, or 0 if no tables exist yet.
+     */
+    uint64_t generation() const;
+
+    /**
+     * @brief Save the current corners and remap tables.
+     * @param path Path of the cache file.
+     * @return True if saved.
+     */
+    bool save(const std::string &path) const;
+
+    /**
+     * @brief Load corners and remap tables saved by save().
+     * @param path Path of the cache file.
+     * @return True if a valid cache for this output size was loaded.
+     */
+    bool load(const std::string &path);
+
+private:
+    void build_maps();
+
+    int _dim;
+    std::vector<cv::Point> _corners;
+    cv::Mat _homography;
+    cv::Mat _map_xy;        ///< CV_16SC2 integer source coordinates.
+    cv::Mat _map_frac;      ///< CV_16UC1 interpolation table indices.
+    uint64_t _generation;
+};
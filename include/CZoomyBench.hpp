@@ -0,0 +1,183 @@
+/**
+ * CZoomyBench.hpp - benchmarks for the vision and control hot paths
+ * 2024-06-23
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+#include <opencv2/opencv.hpp>
+
+#include "CZoomyCore.hpp"
+#include "CAutoController.hpp"
+#include "CWarpEngine.hpp"
+#include "CHSVMask.hpp"
+#include "CPyramidMask.hpp"
+#include "CCarLocalizer.hpp"
+#include "CMarkerTracker.hpp"
+#include "CControlPacket.hpp"
+#include "CFramePool.hpp"
+
+/**
+ * @brief Times each step of the arena pipeline on fixed inputs and reports ns and allocations per frame as JSON.
+ *
+ * Synthetic inputs are generated from a fixed seed so results are comparable between versions and machines. Recorded
+ * arena and dashcam footage can be given as well, as a video file or an image sequence pattern that cv::VideoCapture
+ * understands, and is benchmarked alongside the synthetic frames.
+ *
+ * Usage: zoomy-bench [--iterations <n>] [--warmup <n>] [--threads <n>] [--filter <text>] [--arena <path>]
+ *                    [--dashcam <path>] [--output <file.json>]
+ * @author vika
+ */
+class CZoomyBench {
+public:
+
+    /**
+     * @brief The timing of one benchmark on one input.
+     */
+    struct result {
+        std::string name;
+        std::string input;
+        uint64_t iterations;
+        double ns_median;           ///< Reported as ns/frame, less sensitive to scheduling noise than the mean.
+        double ns_mean;
+        double ns_min;
+        double ns_p99;
+        double allocs_per_frame;
+        double bytes_per_frame;     ///< Heap bytes from new and from the frame pool.
+        double pool_allocs_per_frame;   ///< Mat buffers the frame pool had to take from the heap.
+    };
+
+    /**
+     * @brief Constructor for CZoomyBench
+     * @param argc Argument count from main.
+     * @param argv Arguments from main.
+     */
+    CZoomyBench(int argc, char *argv[]);
+
+    /**
+     * @brief Destructor for CZoomyBench
+     */
+    ~CZoomyBench();
+
+    /**
+     * @brief Run every benchmark that matches the filter and write the results.
+     * @return 0 on success, 1 if the results could not be written.
+     */
+    int run();
+
+    /**
+     * @brief Get the number of heap allocations made by the program so far.
+     * @return The count.
+     */
+    static uint64_t get_alloc_count();
+
+    /**
+     * @brief Get the number of bytes allocated on the heap by the program so far.
+     * @return The count.
+     */
+    static uint64_t get_alloc_bytes();
+
+private:
+    /**
+     * @brief A set of frames a benchmark cycles through.
+     */
+    struct input_set {
+        std::string name;
+        std::vector<cv::Mat> frames;
+    };
+
+    void make_synthetic_arena();
+    void make_synthetic_dashcam();
+    bool load_recorded(const std::string &path, const std::string &name, std::vector<input_set> &out);
+    input_set warp_all(const input_set &in);
+    input_set mask_all(const input_set &in);
+
+    void bench_homography();
+    void bench_warp(const input_set &in);
+    void bench_hsv_mask(const input_set &in);
+    void bench_localize(const input_set &in);
+    void bench_pipeline(const input_set &in);
+    void bench_aruco(const input_set &in);
+    void bench_texture(const input_set &in);
+    void bench_control_packet();
+
+    bool enabled(const std::string &name) const;
+    bool write_results();
+
+    /**
+     * @brief Time one step, called once per frame, after a few untimed calls to warm up caches and buffers.
+     * @param name Benchmark name.
+     * @param input Input set name.
+     * @param step Called with the frame number.
+     * @param batch Frames per timed sample, for steps too short to time one at a time.
+     */
+    template<typename F>
+    void measure(const std::string &name, const std::string &input, F &&step, int batch = 1) {
+        if (!enabled(name)) return;
+
+        int frame = 0;
+        for (int i = 0; i < _warmup * batch; i++) step(frame++);
+
+        // allocated up front so only the step's own allocations are counted
+        _samples.assign(_iterations, 0.0);
+        uint64_t allocs = get_alloc_count();
+        uint64_t bytes = get_alloc_bytes();
+        CFramePool::stats pool = CFramePool::instance().get_stats();
+        for (int i = 0; i < _iterations; i++) {
+            auto start = std::chrono::steady_clock::now();
+            for (int b = 0; b < batch; b++) step(frame++);
+            _samples[i] = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count() / batch;
+        }
+        allocs = get_alloc_count() - allocs;
+        bytes = get_alloc_bytes() - bytes;
+        // mat buffers come from fastMalloc rather than new, the pool counts those
+        CFramePool::stats pool_after = CFramePool::instance().get_stats();
+        uint64_t pool_allocs = pool_after.heap_allocations - pool.heap_allocations;
+        bytes += pool_after.heap_bytes - pool.heap_bytes;
+
+        result r;
+        r.name = name;
+        r.input = input;
+        r.iterations = (uint64_t) _iterations * batch;
+        double total = 0;
+        for (double s: _samples) total += s;
+        r.ns_mean = total / _iterations;
+        std::sort(_samples.begin(), _samples.end());
+        r.ns_min = _samples.front();
+        r.ns_median = _samples.at(_iterations / 2);
+        r.ns_p99 = _samples.at(std::min(_iterations - 1, (int) (_iterations * 0.99)));
+        r.allocs_per_frame = (double) allocs / (double) r.iterations;
+        r.bytes_per_frame = (double) bytes / (double) r.iterations;
+        r.pool_allocs_per_frame = (double) pool_allocs / (double) r.iterations;
+        spdlog::info("{:<18} {:<20} {:>12.0f} ns/frame {:>8.1f} allocs/frame {:>8.2f} pool allocs/frame", name, input,
+                     r.ns_median, r.allocs_per_frame, r.pool_allocs_per_frame);
+        _results.push_back(r);
+    }
+
+    int _iterations;
+    int _warmup;
+    int _threads;
+    std::string _filter;
+    std::string _output_path;
+    std::string _arena_path;
+    std::string _dashcam_path;
+
+    std::vector<cv::Point> _corners;            ///< Arena quad in the raw frames.
+    std::vector<input_set> _arena_inputs;       ///< Raw arena frames, before the warp.
+    std::vector<input_set> _dashcam_inputs;
+    cv::Scalar_<int> _hsv_low, _hsv_high;
+
+    std::vector<double> _samples;
+    std::vector<result> _results;
+};
@@ -0,0 +1,544 @@
+/**
+ * CZoomyCore.hpp - vision, control and networking pipeline without any UI
+ * 2024-06-22
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+#include <opencv2/opencv.hpp>
+
+#include <CUDPClient.hpp>
+#include <CTCPClient.hpp>
+
+#include "CAutoController.hpp"
+#include "CFrameRing.hpp"
+#include "CWarpEngine.hpp"
+#include "CHSVMask.hpp"
+#include "CPyramidMask.hpp"
+#include "CControlPacket.hpp"
+#include "CNetReactor.hpp"
+#include "CPacketQueue.hpp"
+#include "CFrameStream.hpp"
+#include "CJpegDecoder.hpp"
+#include "CSessionLog.hpp"
+#include "CPerfStats.hpp"
+#include "CPipelineStage.hpp"
+#include "CFramePool.hpp"
+#include "CGstCapture.hpp"
+
+#define ARENA_DIM 1440
+
+enum value_type {
+    GC_LEFTX,
+    GC_LEFTY,
+    GC_RIGHTX,
+    GC_RIGHTY,
+    GC_LTRIG,
+    GC_RTRIG,
+    GC_A,
+    GC_B,
+    GC_X,
+    GC_Y,
+};
+
+enum frame_reader {
+    FR_UPDATE,
+    FR_DRAW,
+    FR_SEGMENT,     ///< Raw arena frames only, for masking without the warp.
+};
+
+/**
+ * @brief The arena pipeline: capture, warp, mask, autonomy and the networking to the robot.
+ *
+ * Needs no window, OpenGL context or ImGui, so it can be run by the UI client or headless. Settings and waypoints are
+ * loaded from settings.json and waypoints.json on construction and settings are saved on destruction. Networking and
+ * the vision pipeline (capture, rectify, segment) run on their own threads from construction on, each vision stage
+ * woken by new frames from the one before. update() runs one pass of autonomy on the newest mask.
+ *
+ * Derived images (warped frame, mask, masked preview) are only produced while something asks for them with request(),
+ * and each ring only moves on when its input does, so a frame is warped or masked at most once.
+ * @author vika
+ */
+class CZoomyCore {
+public:
+    enum stage {
+        STAGE_CAPTURE,      ///< New raw arena frames.
+        STAGE_WARP,
+        STAGE_MASK,
+        STAGE_AUTONOMY,     ///< Autonomous control iterations.
+        STAGE_UDP,          ///< Control packets sent.
+        STAGE_COUNT,
+    };
+
+    enum product {
+        PRODUCT_WARPED,         ///< arena_warped(), for display.
+        PRODUCT_MASK,           ///< The binary mask autonomy finds the car in.
+        PRODUCT_MASK_PREVIEW,   ///< arena_mask(), for display.
+        PRODUCT_COUNT,
+    };
+
+    /**
+     * @brief Totals for one pipeline stage since start.
+     */
+    struct stage_stats {
+        uint64_t count;
+        uint64_t total_us;      ///< Time spent in the stage, 0 for stages that are only counted.
+        double occupancy;       ///< Fraction of the last second the stage's thread was busy, -1 if it has none.
+    };
+
+    /**
+     * @brief Counters from the networking threads, for display.
+     */
+    struct net_stats {
+        size_t udp_tx_queued, udp_rx_queued, tcp_tx_queued, tcp_rx_queued;
+        uint64_t udp_tx_dropped, udp_rx_dropped, tcp_tx_dropped, tcp_rx_dropped;
+        uint64_t udp_pool_exhausted, tcp_pool_exhausted;
+        bool udp_binary;
+        bool tcp_streaming;
+        uint32_t arena_seq;
+        uint64_t arena_missed;
+        uint64_t arena_resyncs;
+        double decode_avg_ms, decode_last_ms;
+        uint64_t decoded, decode_skipped, decode_failed;
+        uint64_t log_written, log_dropped;
+    };
+
+    /**
+     * @brief Constructor for CZoomyCore. Loads settings and starts networking.
+     * @param car Dashcam image used for targeting, owned by the caller.
+     */
+    explicit CZoomyCore(cv::Mat *car);
+
+    /**
+     * @brief Destructor for CZoomyCore. Stops networking and saves settings.
+     */
+    ~CZoomyCore();
+
+    /**
+     * @brief Run one pass of autonomy on the newest mask.
+     */
+    void update();
+
+    /**
+     * @brief Choose where raw arena frames come from.
+     * @param location 0 for the local gstreamer camera, 1 for the remote tcp camera.
+     */
+    void set_camera(int location);
+
+    /**
+     * @brief Get where raw arena frames come from.
+     * @return 0 for local, 1 for remote.
+     */
+    int get_camera() const;
+
+    /**
+     * @brief Open the local arena camera on the capture thread.
+     * @param gst_string GStreamer pipeline ending in an appsink, which is replaced by one that keeps only the newest
+     * frame.
+     */
+    void open_local_camera(const std::string &gst_string);
+
+    /**
+     * @brief Check whether the local arena camera has been asked for.
+     * @return True once open_local_camera() was called.
+     */
+    bool is_local_camera_open() const;
+
+    /**
+     * @brief Raw arena frames from the current camera.
+     * @return The ring.
+     */
+    CFrameRing &arena_source();
+
+    /**
+     * @brief Arena frames after homography.
+     * @return The ring.
+     */
+    CFrameRing &arena_warped();
+
+    /**
+     * @brief Masked arena frames, only produced while the mask preview is on.
+     * @return The ring.
+     */
+    CFrameRing &arena_mask();
+
+    /**
+     * @brief Set the arena corners in raw image pixels. Safe to call from any thread.
+     * @param corners Four corners.
+     */
+    void set_corners(const std::vector<cv::Point> &corners);
+
+    /**
+     * @brief Get the arena corners. Safe to call from any thread.
+     * @return Four corners in raw image pixels.
+     */
+    std::vector<cv::Point> get_corners();
+
+    /**
+     * @brief Choose what the mask is computed on.
+     *
+     * When localizing in camera space autonomy always masks the raw frame, and this only chooses what the preview is
+     * made from.
+     * @param warped True to mask the warped frame, false for the raw frame.
+     */
+    void set_mask_options(bool warped);
+
+    /**
+     * @brief Ask for a derived image to be kept up to date, along with whatever it is made from. Requests expire after
+     * half a second, or two request intervals if that is longer, so call this every time the image is used, e.g. for
+     * every frame drawn. Safe to call from any thread.
+     * @param p The image.
+     */
+    void request(product p);
+
+    /**
+     * @brief Set the longest the caller may go between two requests for the same image, e.g. the frame time at the
+     * idle frame rate, so slow redraws don't let requests expire in between.
+     * @param ms Interval in milliseconds.
+     */
+    void set_request_interval(int ms);
+
+    /**
+     * @brief Check whether a derived image was asked for recently.
+     * @param p The image.
+     * @return True if it is being kept up to date.
+     */
+    bool is_requested(product p) const;
+
+    /**
+     * @brief Check whether autonomy localizes on the raw camera mask and warps only the car's position.
+     * @return True in camera space, false if the whole frame is warped for autonomy.
+     */
+    bool is_localizing_in_camera() const;
+
+    /**
+     * @brief Set the HSV thresholds the arena is masked with. Safe to call from any thread.
+     * @param low Lower bounds.
+     * @param high Upper bounds.
+     */
+    void set_hsv_thresholds(const cv::Scalar_<int> &low, const cv::Scalar_<int> &high);
+
+    /**
+     * @brief Get the HSV thresholds. Safe to call from any thread.
+     * @param low Receives the lower bounds.
+     * @param high Receives the upper bounds.
+     */
+    void get_hsv_thresholds(cv::Scalar_<int> &low, cv::Scalar_<int> &high);
+
+    /**
+     * @brief Values sent to the robot, in value_type order.
+     * @return The values.
+     */
+    std::vector<int> &values();
+
+    /**
+     * @brief Turn autonomous waypoint following on or off.
+     * @param enable True to follow waypoints.
+     */
+    void set_use_auto(bool enable);
+
+    /**
+     * @brief Check whether waypoints are being followed.
+     * @return True while autonomous.
+     */
+    bool is_auto() const;
+
+    /**
+     * @brief Get one of the autonomous controller's outputs, for mixing with a gamepad.
+     * @param type A CAutoController::controlType.
+     * @return The output, in gamepad axis units.
+     */
+    int get_auto_input(int type);
+
+    /**
+     * @brief Copy the autonomous controller's outputs into the values, for when no gamepad is mixed in.
+     */
+    void drive_from_autonomy();
+
+    /**
+     * @brief Get the waypoints loaded from waypoints.json.
+     * @return The waypoints.
+     */
+    const std::vector<CAutoController::waypoint> &waypoints() const;
+
+    /**
+     * @brief Get where the car was last seen by autonomous.
+     * @return Position in warped arena pixels.
+     */
+    cv::Point get_car() const;
+
+    /**
+     * @brief Get the waypoint autonomous is driving to.
+     * @return Position in warped arena pixels.
+     */
+    cv::Point get_destination();
+
+    /**
+     * @brief Remember the robot's udp address for next time without connecting.
+     * @param host Host name or address.
+     * @param port Port.
+     */
+    void set_udp_address(const std::string &host, const std::string &port);
+
+    /**
+     * @brief Remember the camera's tcp address for next time without connecting.
+     * @param host Host name or address.
+     * @param port Port.
+     */
+    void set_tcp_address(const std::string &host, const std::string &port);
+
+    /**
+     * @brief Get the robot's udp address.
+     * @return Host.
+     */
+    const std::string &get_udp_host() const;
+
+    /**
+     * @brief Get the robot's udp address.
+     * @return Port.
+     */
+    const std::string &get_udp_port() const;
+
+    /**
+     * @brief Get the camera's tcp address.
+     * @return Host.
+     */
+    const std::string &get_tcp_host() const;
+
+    /**
+     * @brief Get the camera's tcp address.
+     * @return Port.
+     */
+    const std::string &get_tcp_port() const;
+
+    /**
+     * @brief Connect to the robot at the address set with set_udp_address().
+     */
+    void connect_udp();
+
+    /**
+     * @brief Connect to the camera at the address set with set_tcp_address().
+     */
+    void connect_tcp();
+
+    /**
+     * @brief Check whether connect_udp() was called.
+     * @return True if connecting or connected.
+     */
+    bool is_udp_requested() const;
+
+    /**
+     * @brief Check whether connect_tcp() was called.
+     * @return True if connecting or connected.
+     */
+    bool is_tcp_requested() const;
+
+    /**
+     * @brief Decode remote frames at reduced resolution. Corners are moved so they stay on the arena.
+     * @param reduction 1, 2, 4 or 8.
+     */
+    void set_decode_reduction(int reduction);
+
+    /**
+     * @brief Get the remote frame resolution reduction.
+     * @return 1, 2, 4 or 8.
+     */
+    int get_decode_reduction() const;
+
+    /**
+     * @brief Get the UI's section of settings.json. The core only loads and saves it, the UI owns its contents.
+     * @return The settings, an empty object if there are none yet.
+     */
+    nlohmann::json &ui_settings();
+
+    /**
+     * @brief Notify a signal whenever a new raw arena frame arrives from either camera, or the pipeline has a new mask.
+     * @param signal The signal, or nullptr to stop notifying. Must outlive the core or be removed first.
+     */
+    void set_frame_signal(CWakeSignal *signal);
+
+    /**
+     * @brief Get how often update() should run when no new frames arrive, from settings.json.
+     * @return Updates per second, 0 to run back to back.
+     */
+    int get_update_rate() const;
+
+    /**
+     * @brief Get the totals for a pipeline stage.
+     * @param s The stage.
+     * @return The totals.
+     */
+    stage_stats get_stage_stats(stage s) const;
+
+    /**
+     * @brief Get a stage's name for printing.
+     * @param s The stage.
+     * @return The name.
+     */
+    static const char *get_stage_name(stage s);
+
+    /**
+     * @brief Get the networking counters.
+     * @return The counters.
+     */
+    net_stats get_net_stats() const;
+
+private:
+    void load_waypoints();
+    void load_settings();
+    void save_settings();
+    bool capture_local();
+    bool step_capture();
+    bool step_rectify();
+    bool step_segment();
+    struct segment_input;
+    bool segment(CFrameRing &input, int reader, bool for_autonomy, bool preview, bool rebuilt, segment_input &last);
+    void update_auto();
+    void open_session_log();
+    void count_stage(stage s, uint64_t us);
+    static void record_latency(int perf_stage, std::chrono::steady_clock::time_point captured);
+
+    // opencv
+    cv::Mat _arena_img;
+    CFrameRing _arena_local_ring{3}, _arena_remote_ring{3};     ///< Raw arena frames from gstreamer or tcp.
+    CFrameRing _arena_warped_ring;                      ///< Arena frames after homography.
+    CFrameRing _arena_mask_ring;                        ///< Masked arena frames shown in the UI.
+    CFrameRing _raw_mask_ring{1};                       ///< Binary mask read by autonomous.
+    CGstCapture _arena_capture;         ///< Only touched by the capture stage.
+    std::mutex _mutex_capture;          ///< Guards the gstreamer string, set by the UI and read on the capture thread.
+    std::string _arena_gst_string;
+    std::atomic<int> _cam_location;
+    std::atomic<bool> _use_local;
+    std::atomic<bool> _mask_warped;
+    std::atomic<int64_t> _requested[PRODUCT_COUNT];     ///< When each product was last asked for, clock ticks.
+    std::atomic<int> _request_timeout;  ///< ms a request lasts.
+    std::mutex _mutex_hsv;              ///< Guards the thresholds, set by the UI and read on the segment thread.
+    cv::Scalar_<int> _hsv_threshold_low, _hsv_threshold_high;
+    CHSVMask _hsv_mask;
+    CPyramidMask _pyramid_mask;         ///< Masks for autonomy at a lower level while there is no preview.
+
+    // opencv homography
+    std::mutex _mutex_corners;
+    std::vector<cv::Point> _homography_corners;
+    CWarpEngine _warp;
+
+    // vision pipeline, each stage only touches its own state
+    CPipelineStage _capture_stage{"capture"};
+    CPipelineStage _rectify_stage{"rectify"};
+    CPipelineStage _segment_stage{"segment"};
+    struct segment_input {
+        const CFrameRing *source = nullptr;     ///< Ring the last mask was made from.
+        bool preview = false;
+        std::chrono::steady_clock::time_point captured;
+    };
+    const CFrameRing *_rectify_source;      ///< Ring the last warp was made from.
+    segment_input _segment_mask_input;      ///< Autonomy's mask, with the preview when both are of the same frame.
+    segment_input _segment_preview_input;   ///< The preview alone, when it is warped and autonomy's mask is not.
+    cv::Mat _segment_preview_mask;
+    std::vector<cv::Point> _segment_corners;
+    cv::Mat _arena_region;              ///< Inside of the corners in camera pixels, autonomy only looks for the car there.
+    bool _localize_camera;
+    CWakeSignal *_frame_signal;
+
+    // control
+    nlohmann::json _json_data;
+    nlohmann::json _ui_settings;
+    int _update_rate;
+    CAutoController _autonomous;
+    unsigned int _step;
+    std::vector<int> _values;
+    std::atomic<bool> _auto;            ///< Written by the update thread, read by the reactor and the UI.
+    std::atomic<bool> _use_auto;        ///< Set by the UI, acted on by the update thread.
+    std::vector<CAutoController::waypoint> _waypoints;
+    cv::Point _last_car_pos;
+
+    // session log
+    CSessionLog _session_log;
+    bool _log_enabled;
+    std::string _log_path;
+    int _log_max_mb;
+    int _logged_auto_input[3];          ///< Last values logged, autonomy is only logged when it changes.
+    cv::Point _logged_car, _logged_destination;
+    long _logged_rtt;
+
+    // stats
+    std::atomic<uint64_t> _stage_count[STAGE_COUNT];
+    std::atomic<uint64_t> _stage_us[STAGE_COUNT];
+
+    // net (udp)
+    bool _udp_req_ready;
+    std::string _udp_host;
+    std::string _udp_port;
+    CUDPClient _udp_client;
+    std::thread _thread_udp_rx;
+    std::thread _thread_udp_connect;    ///< Connects off the reactor thread, so a slow connect never holds up sends.
+    std::atomic<bool> _udp_connecting;
+    std::chrono::steady_clock::time_point _udp_timeout_count;
+    CPacketPool _udp_packet_pool{32, 1024};
+    CPacketQueue _udp_tx_queue{8, _udp_packet_pool, CPacketQueue::DROP_OLDEST};     ///< Only the latest controls matter.
+    CPacketQueue _udp_rx_queue{16, _udp_packet_pool, CPacketQueue::DROP_OLDEST};
+    std::vector<uint8_t> _udp_rx_buf;
+    long _udp_rx_bytes;
+    bool _udp_send_data;
+    CControlPacket _udp_packet;
+
+    // net (tcp)
+    bool _tcp_req_ready;
+    std::string _tcp_host;
+    std::string _tcp_port;
+    CTCPClient _tcp_client;
+    std::thread _thread_tcp_rx;
+    std::thread _thread_tcp_connect;    ///< Connects off the reactor thread, so a slow connect never holds up sends.
+    std::atomic<bool> _tcp_connecting;
+    CPacketPool _tcp_packet_pool{8, 512 * 1024};
+    CPacketQueue _tcp_tx_queue{4, _tcp_packet_pool, CPacketQueue::DROP_NEWEST};     ///< Requests are all the same.
+    CPacketQueue _tcp_rx_queue{4, _tcp_packet_pool, CPacketQueue::DROP_OLDEST};     ///< Only the latest frame matters.
+    std::vector<uint8_t> _tcp_rx_buf;
+    long _tcp_rx_bytes;
+    bool _tcp_send_data;
+    CJpegDecoder _arena_decoder{_arena_remote_ring, _tcp_packet_pool};
+    CFrameStream _tcp_stream;
+    bool _tcp_subscribed;
+    uint64_t _tcp_frames_done;          ///< Pushed frames handed to the decoder, polled ones are not counted.
+    uint64_t _tcp_credits_returned;     ///< Frames finished with that the server has been told about.
+    bool _arena_remote_seq_valid;
+    uint32_t _arena_remote_seq;
+    uint64_t _arena_remote_capture_us;
+    uint64_t _arena_remote_missed;      ///< Frames the server sent that never reached the screen.
+
+    // net (both)
+    CNetReactor _net_reactor;
+
+    void udp_rx();
+    void udp_tx();
+    void udp_process_rx();
+    void update_udp();
+    void udp_connected();
+
+    void tcp_rx();
+    void tcp_tx();
+    void tcp_process_rx();
+    bool tcp_queue_command(char command, int arg);
+    void tcp_return_credits();
+    void update_tcp();
+    void tcp_connected();
+
+    static void thread_udp_rx(CZoomyCore *who_called);
+    static void thread_tcp_rx(CZoomyCore *who_called);
+    static void thread_udp_connect(CZoomyCore *who_called, std::string host, std::string port);
+    static void thread_tcp_connect(CZoomyCore *who_called, std::string host, std::string port);
+};
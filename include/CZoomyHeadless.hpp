@@ -0,0 +1,64 @@
+/**
+ * CZoomyHeadless.hpp - runs the arena pipeline without a window
+ * 2024-06-22
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+#include "CCommonBase.hpp"
+#include "CZoomyCore.hpp"
+
+/**
+ * @brief Runs CZoomyCore with no window, OpenGL or ImGui and prints per-stage throughput once a second.
+ *
+ * Usage: zoomy-headless [--remote] [--local <gstreamer pipeline>] [--udp] [--tcp] [--auto] [--seconds <n>]
+ *                       [--perf <file.json>]
+ *  - --remote takes arena frames from the tcp camera instead of the local one,
+ *  - --local opens a local gstreamer pipeline ending in an appsink, e.g. "videotestsrc ! appsink" to test without
+ *    a camera,
+ *  - --udp and --tcp connect to the addresses in settings.json,
+ *  - --auto follows the waypoints and drives from the autonomous controller,
+ *  - --seconds stops after n seconds, otherwise runs until interrupted,
+ *  - --perf writes every stage's latency histogram to a json file on exit.
+ * @author vika
+ */
+class CZoomyHeadless : public CCommonBase {
+public:
+
+    /**
+     * @brief Constructor for CZoomyHeadless
+     * @param argc Argument count from main.
+     * @param argv Arguments from main.
+     */
+    CZoomyHeadless(int argc, char *argv[]);
+
+    /**
+     * @brief Destructor for CZoomyHeadless
+     */
+    ~CZoomyHeadless();
+
+    void update() override;
+    void draw() override;
+
+private:
+    static void handle_signal(int sig);
+    static std::atomic<bool> _interrupted;
+
+    cv::Mat _dashcam_img;   ///< Never filled, there is no dashcam without the UI.
+    CZoomyCore _core{&_dashcam_img};
+    bool _drive_auto;
+    int _run_seconds;
+    std::string _perf_path;
+    std::chrono::steady_clock::time_point _start;
+    std::chrono::steady_clock::time_point _last_report;
+    CZoomyCore::stage_stats _last_stats[CZoomyCore::STAGE_COUNT];
+    CPerfStats::snapshot _last_latency;
+    uint64_t _last_pool_allocs;
+};
@@ -0,0 +1,55 @@
+/**
+ * CZoomyLogReader.hpp - converts session logs to csv
+ * 2024-06-24
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+#include "CSessionLog.hpp"
+
+/**
+ * @brief Reads a session log written by CSessionLog and writes it out as csv.
+ *
+ * Usage: zoomy-log-csv <session log> [--type <name>] [--output <file.csv>]
+ *
+ * Every record becomes a row with its time in seconds since the log was opened, its wall clock time, its type, aux
+ * and values. With --type only records of that type are written and the value columns are named, e.g. --type car
+ * gives car_x, car_y, dest_x and dest_y. Without --output the csv is written to stdout.
+ * @author vika
+ */
+class CZoomyLogReader {
+public:
+
+    /**
+     * @brief Constructor for CZoomyLogReader
+     * @param argc Argument count from main.
+     * @param argv Arguments from main.
+     */
+    CZoomyLogReader(int argc, char *argv[]);
+
+    /**
+     * @brief Destructor for CZoomyLogReader
+     */
+    ~CZoomyLogReader();
+
+    /**
+     * @brief Convert the log.
+     * @return 0 on success, 1 if the log could not be read or the csv could not be written.
+     */
+    int run();
+
+private:
+    void write_header(std::ostream &out) const;
+    void write_record(std::ostream &out, const CSessionLog::header &h, const CSessionLog::record &r) const;
+
+    std::string _input_path;
+    std::string _output_path;
+    int _type;      ///< Only write records of this type, -1 for all.
+};
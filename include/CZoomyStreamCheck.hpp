@@ -0,0 +1,70 @@
+/**
+ * CZoomyStreamCheck.hpp - feeds synthetic arena streams through CFrameStream in random-sized chunks
+ * 2024-07-02
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "CFrameStream.hpp"
+
+/**
+ * @brief Checks that CFrameStream gets whole frames back out of a byte stream however the reads split it.
+ *
+ * Usage: zoomy-stream-check [--seed <n>] [--rounds <n>]
+ *
+ * Each round builds a stream like a server would send one: framed frames with sequence numbers and timestamps, bare
+ * JPEGs from the legacy request, ping responses and runs of garbage between frames. Some JPEGs carry an end of image
+ * marker inside a marker segment, like an exif thumbnail, and their entropy coded data has stuffed bytes and restart
+ * markers. One framed header has the wrong version and must be skipped. The stream is fed in random-sized chunks,
+ * from one byte up to a few kilobytes, and every frame has to come out byte for byte with nothing lost or extra.
+ *
+ * Run by ctest as the frame-stream test. Returns 0 if every round passed.
+ * @author vika
+ */
+class CZoomyStreamCheck {
+public:
+
+    /**
+     * @brief Constructor for CZoomyStreamCheck
+     * @param argc Argument count from main.
+     * @param argv Arguments from main.
+     */
+    CZoomyStreamCheck(int argc, char *argv[]);
+
+    /**
+     * @brief Destructor for CZoomyStreamCheck
+     */
+    ~CZoomyStreamCheck();
+
+    /**
+     * @brief Run every round.
+     * @return 0 if all passed, 1 otherwise.
+     */
+    int run();
+
+private:
+    // one frame the parser should return, in order
+    struct expected {
+        std::vector<uint8_t> bytes;
+        bool framed;
+    };
+
+    bool run_round(int round);
+    std::vector<uint8_t> make_jpeg(bool thumbnail);
+    void add_framed(std::vector<uint8_t> &stream, std::vector<expected> &frames, uint32_t sequence);
+    void add_garbage(std::vector<uint8_t> &stream);
+
+    uint32_t _seed;
+    int _rounds;
+    std::mt19937 _rng;
+};
@@ -4,48 +4,154 @@
 #include "../include/CAutoController.hpp"
 
 #define MOVE_SPEED 1.0
+#define ARENA_MARGIN 0.05
 
-CAutoController::CAutoController() = default;
+static const int PERF_RUN_TO_POINT = CPerfStats::add_stage("auto.run_to_point");
+static const int PERF_FIND_CAR = CPerfStats::add_stage("auto.find_car");
+static const int PERF_AUTO_TARGET = CPerfStats::add_stage("auto.target");
+static const int PERF_CONTROL_TICK = CPerfStats::add_stage("auto.tick");
+static const int PERF_LATENCY_AUTONOMY = CPerfStats::add_stage("latency.autonomy");
+
+CAutoController::CAutoController() {
+    _carImg = nullptr;
+    _overheadRing = nullptr;
+    _target = 0;
+    _speed = 0;
+    _runningToPoint = false;
+    _autoTargeting = false;
+    _run = 0;
+    _state = output{};
+}
 
 CAutoController::~CAutoController() {
-    _threadExit = std::vector<bool>(2,true);
+    _workerExit = true;
+    if (_worker.joinable()) _worker.join();
 }
 
-bool CAutoController::init(cv::Mat *car, cv::Mat *above) {
-    _threadExit = std::vector<bool>(2,true);
-    _autoInput = std::vector<int>(4,0);
+bool CAutoController::init(cv::Mat *car, CFrameRing *above) {
     _carImg = car;
-    _overheadImg = above;
+    _overheadRing = above;
+    if (!_worker.joinable()) _worker = std::thread(&CAutoController::controlThread, this);
     return true;
 }
 
-void CAutoController::autoTargetThread(CAutoController* ptr) {
-    while (!ptr->_threadExit[0]) {
-        ptr -> autoTarget();
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+void CAutoController::setControlRate(int hz) {
+    _rateHz = std::max(1, hz);
+}
+
+int CAutoController::getControlRate() const {
+    return _rateHz;
+}
+
+void CAutoController::setOverheadTransform(const cv::Mat &homography, int arenaSize) {
+    std::lock_guard<std::mutex> lock(_transformLock);
+    homography.copyTo(_homography);
+    _arenaSize = arenaSize;
+}
+
+cv::Point2f CAutoController::toArena(const cv::Point2f &point) {
+    std::lock_guard<std::mutex> lock(_transformLock);
+    if (_homography.empty()) return point;
+    _transformIn.assign(1, point);
+    cv::perspectiveTransform(_transformIn, _transformOut, _homography);
+    return _transformOut.front();
+}
+
+void CAutoController::controlThread(CAutoController* ptr) {
+    auto next = std::chrono::steady_clock::now();
+    while (!ptr->_workerExit) {
+        CPerfTimer t(PERF_CONTROL_TICK);
+        ptr->controlTick();
+        t.stop();
+
+        // fixed rate, but after falling behind start again from now instead of running a burst of late ticks
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(1.0 / ptr->_rateHz));
+        auto now = std::chrono::steady_clock::now();
+        if (next < now) next = now;
+        std::this_thread::sleep_until(next);
+    }
+}
+
+void CAutoController::controlTick() {
+    command c;
+    while (_commands.try_pop(c)) handleCommand(c);
+
+    if (_autoTargeting) {
+        CPerfTimer t(PERF_AUTO_TARGET);
+        autoTarget();
+    }
+    if (_runningToPoint) {
+        CPerfTimer t(PERF_RUN_TO_POINT);
+        runToPoint();
+        _iteration_us += t.stop();
+        _iterations++;
     }
+    publish();
 }
 
-void CAutoController::runToPointThread(CAutoController* ptr) {
-    while (!ptr->_threadExit[1]) {
-        ptr -> runToPoint();
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+void CAutoController::handleCommand(const command &c) {
+    switch (c.type) {
+        case RUN_TO_POINT:
+            spdlog::info("P2P ON");
+            _destination = c.point;
+            _speed = c.speed;
+            _run = c.run;
+            _runningToPoint = true;
+            _state.destinationX = _destination.x;
+            _state.destinationY = _destination.y;
+            break;
+        case END_RUN_TO_POINT:
+            // also covers runs that were queued but never started
+            finishRun();
+            if (c.run > _runsDone) _runsDone = c.run;
+            break;
+        case AUTO_TARGET:
+            _target = c.target;
+            _marker_tracker.reset();
+            _autoTargeting = true;
+            break;
+        case END_AUTO_TARGET:
+            _autoTargeting = false;
+            break;
     }
 }
 
+bool CAutoController::queueCommand(const command &c) {
+    if (_commands.try_push(c)) return true;
+    spdlog::warn("Autonomous command queue full, command dropped");
+    return false;
+}
+
+void CAutoController::publish() {
+    uint32_t seq = _outputSeq.load(std::memory_order_relaxed);
+    _outputSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&_output, &_state, sizeof(output));
+    _outputSeq.store(seq + 2, std::memory_order_release);
+}
+
+CAutoController::output CAutoController::readOutput() const {
+    output o;
+    uint32_t before, after;
+    do {
+        before = _outputSeq.load(std::memory_order_acquire);
+        std::memcpy(&o, &_output, sizeof(output));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = _outputSeq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return o;
+}
+
 void CAutoController::autoTarget() {
     if (!_carImg->empty()) {
-        _detector_params = cv::aruco::DetectorParameters();
-        _dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
-        _detector.setDetectorParameters(_detector_params);
-        _detector.setDictionary(_dictionary);
-        _detector.detectMarkers(*_carImg, _marker_corners, _marker_ids, _rejected_candidates);
+        _marker_tracker.detect(*_carImg, _marker_corners, _marker_ids);
     }
     if (!_carImg->empty()) {
         cv::aruco::drawDetectedMarkers(*_carImg, _marker_corners, _marker_ids);
         for (int i = 0; i < _marker_ids.size(); i++) {
             if (_marker_ids.at(i) == _target) {
-                _autoInput[ROTATE] =
+                _state.autoInput[ROTATE] =
                         -((_carImg->size().width / 2) - ((_marker_corners[i][0].x - _marker_corners[i][1].x) / 2)) * 32768.0 / _carImg->size().width;
             }
         }
@@ -53,78 +159,123 @@ void CAutoController::autoTarget() {
 }
 
 void CAutoController::runToPoint() {
-    if (!_overheadImg->empty()) {
-        cv::Mat working_copy = _overheadImg->clone();
-        std::vector<cv::Vec4i> hierarchy;
-        std::vector<std::vector<cv::Point>> contours;
-
-        cv::findContours(working_copy, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-
-        int biggest = 0;
-        cv::Rect car;
-        for (const auto & contour : contours) {
-            cv::Rect r = boundingRect(contour);
-            if ((r.width * r.height) > biggest) {
-                biggest = r.width * r.height;
-                car = r;
-            }
+    // control runs faster than masks arrive, the car is only looked for again in a new one
+    // mask stays pinned until the next acquire, labelling does not modify its input so no copy is needed
+    if (_overheadRing->acquire(0)) {
+        CPerfTimer find_timer(PERF_FIND_CAR);
+        _car = _localizer.locate(_overheadRing->view(0));
+        find_timer.stop();
+        if (_localizer.was_full_scan()) _fullScans++;
+
+        // each mask is only localized once, so this is the age of every new input
+        std::chrono::steady_clock::time_point captured = _overheadRing->captured(0);
+        _state.inputCaptured = captured.time_since_epoch().count();
+        if (captured != std::chrono::steady_clock::time_point()) {
+            CPerfStats::record(PERF_LATENCY_AUTONOMY, std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - captured).count());
         }
+        if (_car.found) spdlog::info("Car location: {:.1f} {:.1f}", _car.centroid.x, _car.centroid.y);
+    }
 
-        spdlog::info("P2P ON");
+    const cv::Mat &overhead = _overheadRing->view(0);
+    if (overhead.empty()) return;
 
-        _autoInput[MOVE_X] = _speed * MOVE_SPEED * (_destination.x - (car.x + car.width / 2))/
-                hypot(_destination.x - (car.x + car.width / 2), _destination.y - (car.y + car.height / 2));
-        _autoInput[MOVE_Y] = _speed * MOVE_SPEED * (_destination.y - (car.y + car.height / 2))/
-                hypot(_destination.x - (car.x + car.width / 2), _destination.y - (car.y + car.height / 2));
-        _location = cv::Point(car.x + car.width / 2, car.y + car.height / 2);
+    // car lost, stop rather than drive towards wherever it was
+    if (!_car.found) {
+        _state.autoInput[MOVE_X] = 0;
+        _state.autoInput[MOVE_Y] = 0;
+        return;
+    }
 
-        spdlog::info("Car location: {:d} {:d}", _location.x, _location.y);
+    // waypoints are in arena pixels, the car is found in whatever the mask is in
+    // the car is small enough that warping its centroid is as good as the centroid of the warped blob
+    cv::Point2f car = toArena(_car.centroid);
+    int arenaSize;
+    {
+        std::lock_guard<std::mutex> lock(_transformLock);
+        arenaSize = _homography.empty() ? overhead.cols : _arenaSize;
+    }
 
-        if (hypot(_destination.x - (car.x + car.width / 2), _destination.y - (car.y + car.height / 2)) <
-                ((_speed / 32768.0) * _overheadImg->cols / 3)) {
-            _threadExit[1] = true;
-            _autoInput[MOVE_X] = 0;
-            _autoInput[MOVE_Y] = 0;
-        }
-//        _threadExit[1] = true;
+    // a blob that warps to somewhere off the table isn't the car, treat it like a lost one
+    double margin = ARENA_MARGIN * arenaSize;
+    if (car.x < -margin || car.y < -margin || car.x > arenaSize + margin || car.y > arenaSize + margin) {
+        _state.autoInput[MOVE_X] = 0;
+        _state.autoInput[MOVE_Y] = 0;
+        return;
     }
+
+    double dx = _destination.x - car.x;
+    double dy = _destination.y - car.y;
+    double distance = hypot(dx, dy);
+    _state.autoInput[MOVE_X] = distance > 0 ? _speed * MOVE_SPEED * dx / distance : 0;
+    _state.autoInput[MOVE_Y] = distance > 0 ? _speed * MOVE_SPEED * dy / distance : 0;
+    _state.locationX = (int) std::lround(car.x);
+    _state.locationY = (int) std::lround(car.y);
+
+    if (distance < ((_speed / 32768.0) * arenaSize / 3)) {
+        finishRun();
+    }
+}
+
+void CAutoController::finishRun() {
+    _runningToPoint = false;
+    _state.autoInput[MOVE_X] = 0;
+    _state.autoInput[MOVE_Y] = 0;
+    if (_run > _runsDone) _runsDone = _run;
 }
 
 void CAutoController::startAutoTarget(int id) {
-    _target = id;
-    _threadExit[0] = false;
-    std::thread t1(&CAutoController::autoTargetThread, this);
-    t1.detach();
+    queueCommand(command{AUTO_TARGET, cv::Point(), 0, id, 0});
 }
 
-void CAutoController::startRunToPoint(cv::Point point, int speed) {
-    _threadExit[1] = false;
-    _speed = speed;
-    _destination = point;
-    std::thread t2(&CAutoController::runToPointThread, this);
-    t2.detach();
+bool CAutoController::startRunToPoint(cv::Point point, int speed) {
+    // counted here so isRunning() is true straight away, not only once the worker picks the run up
+    // but only once queued, a dropped run would never be finished and isRunning() would stay true
+    // runs are only started from one thread, so nothing else moves the count in between
+    uint64_t run = _runsStarted + 1;
+    if (!queueCommand(command{RUN_TO_POINT, point, speed, 0, run})) return false;
+    _runsStarted = run;
+    return true;
 }
 
 void CAutoController::endAutoTarget() {
-    _threadExit[0] = true;
+    queueCommand(command{END_AUTO_TARGET, cv::Point(), 0, 0, 0});
 }
 
 void CAutoController::endRunToPoint() {
-    _threadExit[1] = true;
+    queueCommand(command{END_RUN_TO_POINT, cv::Point(), 0, 0, _runsStarted.load()});
 }
 
 int CAutoController::getAutoInput(int type) {
-    return _autoInput[type];
+    return readOutput().autoInput[type];
+}
+
+std::chrono::steady_clock::time_point CAutoController::getInputCaptured() const {
+    return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(readOutput().inputCaptured));
 }
 
 bool CAutoController::isRunning() {
-    return !_threadExit[1];
+    return _runsDone < _runsStarted;
 }
 
 cv::Point CAutoController::get_car() {
-    return _location;
+    output o = readOutput();
+    return cv::Point(o.locationX, o.locationY);
 }
 
 cv::Point CAutoController::get_destination() {
-    return _destination;
-}
\ No newline at end of file
+    output o = readOutput();
+    return cv::Point(o.destinationX, o.destinationY);
+}
+
+uint64_t CAutoController::get_iteration_count() const {
+    return _iterations;
+}
+
+uint64_t CAutoController::get_iteration_us() const {
+    return _iteration_us;
+}
+
+uint64_t CAutoController::getFullScanCount() const {
+    return _fullScans;
+}
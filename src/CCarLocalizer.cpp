@@ -0,0 +1,92 @@
+/**
+ * CCarLocalizer.cpp - finds the car in the arena mask, searching around where it was last seen
+ * 2024-06-29
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CCarLocalizer.hpp"
+
+CCarLocalizer::CCarLocalizer(int window, int min_area) {
+    _window = std::max(8, window);
+    _min_area = std::max(1, min_area);
+    _tracking = false;
+    _misses = 0;
+    _last_full_scan = false;
+}
+
+CCarLocalizer::~CCarLocalizer() = default;
+
+CCarLocalizer::result CCarLocalizer::locate(const cv::Mat &mask) {
+    result r{false, cv::Point2f(), 0, cv::Rect()};
+    _last_full_scan = true;
+    if (mask.empty()) return r;
+
+    cv::Rect frame(0, 0, mask.cols, mask.rows);
+    if (_tracking) {
+        // widen the window for every frame the car has been missing, capped so the shift can't overflow
+        int side = _window << std::min(_misses, 16);
+        while (true) {
+            cv::Rect window = cv::Rect((int) std::lround(_last.x) - side / 2, (int) std::lround(_last.y) - side / 2,
+                                       side, side) & frame;
+            _last_full_scan = window == frame;
+            if (_last_full_scan) break;
+
+            // a blob cut off by the window edge has the wrong centroid, look again with more room around it
+            if (search(mask, window, r)) {
+                bool clipped = (r.bounds.x == window.x && window.x > 0) ||
+                               (r.bounds.y == window.y && window.y > 0) ||
+                               (r.bounds.br().x == window.br().x && window.br().x < frame.width) ||
+                               (r.bounds.br().y == window.br().y && window.br().y < frame.height);
+                if (!clipped) break;
+                side *= 2;
+                continue;
+            }
+            break;
+        }
+        if (!_last_full_scan && !r.found) {
+            _misses++;
+            return r;
+        }
+    }
+
+    if (_last_full_scan) search(mask, frame, r);
+    _tracking = r.found;
+    _misses = 0;
+    if (r.found) _last = r.centroid;
+    return r;
+}
+
+void CCarLocalizer::reset() {
+    _tracking = false;
+    _misses = 0;
+}
+
+bool CCarLocalizer::was_full_scan() const {
+    return _last_full_scan;
+}
+
+bool CCarLocalizer::search(const cv::Mat &mask, const cv::Rect &window, result &found) {
+    found.found = false;
+    int labels = cv::connectedComponentsWithStats(mask(window), _labels, _stats, _centroids, 8, CV_32S);
+
+    // label 0 is the background, the car is the blob with the most pixels
+    int best = 0;
+    int best_area = _min_area - 1;
+    for (int i = 1; i < labels; i++) {
+        int area = _stats.at<int>(i, cv::CC_STAT_AREA);
+        if (area > best_area) {
+            best = i;
+            best_area = area;
+        }
+    }
+    if (!best) return false;
+
+    found.found = true;
+    found.area = best_area;
+    found.centroid = cv::Point2f((float) (_centroids.at<double>(best, 0) + window.x),
+                                 (float) (_centroids.at<double>(best, 1) + window.y));
+    found.bounds = cv::Rect(_stats.at<int>(best, cv::CC_STAT_LEFT) + window.x,
+                            _stats.at<int>(best, cv::CC_STAT_TOP) + window.y,
+                            _stats.at<int>(best, cv::CC_STAT_WIDTH), _stats.at<int>(best, cv::CC_STAT_HEIGHT));
+    return true;
+}
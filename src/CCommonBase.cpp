@@ -6,34 +6,79 @@
 
 #include "../include/CCommonBase.hpp"
 
+#define DUTY_WINDOW 1000    // ms over which the update duty cycle is measured
+
+static const int PERF_UPDATE = CPerfStats::add_stage("update");
+static const int PERF_DRAW = CPerfStats::add_stage("draw");
+
 CCommonBase::~CCommonBase() = default;
 
 void CCommonBase::run() {
     // start update thread
     std::thread thread_for_updating(update_thread, this);
-    thread_for_updating.detach();
     do {
-        // do draw
+        // do draw, not timed here since draw() may spend most of its time waiting, it times its own work
         draw();
     } while (!_do_exit);
-    // handle exit
+    // handle exit, the update thread may be asleep until its next scheduled update
+    wake_update();
     if (thread_for_updating.joinable()) thread_for_updating.join();
 }
 
 void CCommonBase::update_thread(CCommonBase *who_called_me) {
+    auto window_start = std::chrono::steady_clock::now();
+    uint64_t window_busy_us = 0;
+    int window_updates = 0;
+
     while (!(who_called_me->_do_exit)) {
         who_called_me->_perf_update_start = std::chrono::steady_clock::now();
+        CPerfTimer t(PERF_UPDATE);
         who_called_me->update();
-        who_called_me->_perf_update = (int) std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::steady_clock::now() - who_called_me->_perf_update_start).count();
+        uint64_t busy_us = t.stop();
+        who_called_me->_perf_update = (int) (busy_us / 1000);
+        window_busy_us += busy_us;
+        window_updates++;
+
+        auto now = std::chrono::steady_clock::now();
+        auto window = std::chrono::duration_cast<std::chrono::microseconds>(now - window_start).count();
+        if (window >= DUTY_WINDOW * 1000) {
+            who_called_me->_update_duty = (double) window_busy_us / (double) window;
+            who_called_me->_update_rate = (double) window_updates * 1e6 / (double) window;
+            window_start = now;
+            window_busy_us = 0;
+            window_updates = 0;
+        }
+
+        // sleep until there is something new or the next scheduled update, whichever comes first
+        int64_t interval_us = who_called_me->_update_interval_us;
+        if (interval_us > 0) {
+            who_called_me->_update_signal.wait_until(who_called_me->_perf_update_start +
+                                                     std::chrono::microseconds(interval_us));
+        }
     }
 }
 
 void CCommonBase::draw_thread(CCommonBase *who_called_me) {
     while (!(who_called_me->_do_exit)) {
         who_called_me->_perf_draw_start = std::chrono::steady_clock::now();
+        CPerfTimer t(PERF_DRAW);
         who_called_me->draw();
-        who_called_me->_perf_draw = (int) std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::steady_clock::now() - who_called_me->_perf_draw_start).count();
+        who_called_me->_perf_draw = (int) (t.stop() / 1000);
     }
-}
\ No newline at end of file
+}
+
+void CCommonBase::wake_update() {
+    _update_signal.notify();
+}
+
+double CCommonBase::get_update_duty_cycle() const {
+    return _update_duty;
+}
+
+double CCommonBase::get_update_rate() const {
+    return _update_rate;
+}
+
+void CCommonBase::set_update_rate(int hz) {
+    _update_interval_us = hz > 0 ? 1000000 / hz : 0;
+}
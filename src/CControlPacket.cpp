@@ -0,0 +1,162 @@
+/**
+ * CControlPacket.cpp - control packet encoding for the udp channel
+ * 2024-06-14
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CControlPacket.hpp"
+
+// room for ten "-2147483648 " values
+#define TEXT_CAPACITY 128
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+CControlPacket::CControlPacket() {
+    _buf.reserve(TEXT_CAPACITY);
+    _format = FORMAT_AUTO;
+    _binary = false;
+    _rejected_version = 0;
+    _sequence = 0;
+    _start = std::chrono::steady_clock::now();
+}
+
+CControlPacket::~CControlPacket() = default;
+
+const std::vector<uint8_t> &CControlPacket::encode(const std::vector<int> &values) {
+    if (_binary) {
+        encode_binary(values);
+    } else {
+        encode_text(values);
+    }
+    _sequence++;
+    return _buf;
+}
+
+void CControlPacket::encode_text(const std::vector<int> &values) {
+    // same as the old to_string payload ("v0 v1 ... v9 ") without building strings
+    _buf.resize(TEXT_CAPACITY);
+    char *out = (char *) _buf.data();
+    char *end = out + TEXT_CAPACITY;
+    for (auto &v: values) {
+        auto res = std::to_chars(out, end - 1, v);
+        if (res.ec != std::errc()) break;
+        out = res.ptr;
+        *out++ = ' ';
+    }
+    _buf.resize(out - (char *) _buf.data());
+}
+
+void CControlPacket::encode_binary(const std::vector<int> &values) {
+    _buf.resize(BINARY_SIZE);
+    uint8_t *p = _buf.data();
+
+    uint16_t buttons = 0;
+    for (int i = 0; i < BUTTONS && AXES + i < values.size(); i++) {
+        if (values.at(AXES + i)) buttons |= 1 << i;
+    }
+    auto now_us = (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - _start).count();
+
+    p[0] = MAGIC;
+    p[1] = VERSION;
+    put_u16(p + 2, buttons);
+    put_u32(p + 4, _sequence);
+    put_u32(p + 8, now_us);
+    for (int i = 0; i < AXES; i++) {
+        int v = i < values.size() ? values.at(i) : 0;
+        v = v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : v;
+        put_u16(p + 12 + i * 2, (uint16_t) (int16_t) v);
+    }
+    put_u16(p + 24, crc16(p, 24));
+}
+
+bool CControlPacket::accept_response(const uint8_t *data, size_t len) {
+    if (_format != FORMAT_AUTO || _binary) return false;
+    if (len < 2 || data[0] != MAGIC) return false;
+    // only the version this client encodes, a robot on any other would misread it
+    if (data[1] != VERSION) {
+        if (data[1] == _rejected_version) return false;
+        _rejected_version = data[1];
+        spdlog::warn("Robot advertises binary control packets v{:d}, only v{:d} is supported, staying on text",
+                     (int) data[1], VERSION);
+        return false;
+    }
+    _binary = true;
+    spdlog::info("Robot supports binary control packets (v{:d}), switching from text", (int) data[1]);
+    return true;
+}
+
+void CControlPacket::fall_back() {
+    if (_format != FORMAT_AUTO || !_binary) return;
+    _binary = false;
+    spdlog::warn("No response to binary control packets, falling back to text");
+}
+
+void CControlPacket::set_format(format f) {
+    _format = f;
+    _binary = f == FORMAT_BINARY;
+}
+
+CControlPacket::format CControlPacket::get_format() const {
+    return _format;
+}
+
+bool CControlPacket::is_binary() const {
+    return _binary;
+}
+
+bool CControlPacket::decode(const uint8_t *data, size_t len, decoded &out) {
+    if (len < BINARY_SIZE || data[0] != MAGIC || data[1] != VERSION) return false;
+    if (get_u16(data + 24) != crc16(data, 24)) return false;
+
+    uint16_t buttons = get_u16(data + 2);
+    out.sequence = get_u32(data + 4);
+    out.timestamp_us = get_u32(data + 8);
+    for (int i = 0; i < AXES; i++) out.axes[i] = (int16_t) get_u16(data + 12 + i * 2);
+    for (int i = 0; i < BUTTONS; i++) out.buttons[i] = (buttons >> i) & 1;
+    return true;
+}
+
+uint16_t CControlPacket::crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t) (data[i] << 8);
+        for (int b = 0; b < 8; b++) crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+    }
+    return crc;
+}
+
+CControlPacket::format CControlPacket::format_from_string(const std::string &name) {
+    if (name == "text") return FORMAT_TEXT;
+    if (name == "binary") return FORMAT_BINARY;
+    return FORMAT_AUTO;
+}
+
+std::string CControlPacket::format_to_string(format f) {
+    switch (f) {
+        case FORMAT_TEXT:
+            return "text";
+        case FORMAT_BINARY:
+            return "binary";
+        default:
+            return "auto";
+    }
+}
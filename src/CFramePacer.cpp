@@ -0,0 +1,79 @@
+/**
+ * CFramePacer.cpp - decides when the UI needs to be drawn again
+ * 2024-06-26
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CFramePacer.hpp"
+
+#define FPS_SMOOTHING 0.1       // weight of the newest frame in the reported rate
+
+CFramePacer::CFramePacer(int max_fps, int idle_fps) {
+    set_max_fps(max_fps);
+    set_idle_fps(idle_fps);
+    _idle = false;
+    _pending_frames = 1;
+    _last_drawn = std::chrono::steady_clock::time_point();
+    _fps = 0;
+}
+
+CFramePacer::~CFramePacer() = default;
+
+void CFramePacer::set_max_fps(int fps) {
+    _min_interval = fps > 0 ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / fps)) : std::chrono::steady_clock::duration::zero();
+}
+
+void CFramePacer::set_idle_fps(int fps) {
+    _idle_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / std::max(1, fps)));
+}
+
+void CFramePacer::set_idle(bool idle) {
+    // draw once more so the change shows
+    if (idle != _idle) request_frames();
+    _idle = idle;
+}
+
+bool CFramePacer::is_idle() const {
+    return _idle;
+}
+
+void CFramePacer::request_frames(int frames) {
+    _pending_frames = std::max(_pending_frames, frames);
+}
+
+bool CFramePacer::should_draw(std::chrono::steady_clock::time_point now) const {
+    return now >= next_due();
+}
+
+void CFramePacer::drawn(std::chrono::steady_clock::time_point now) {
+    if (_last_drawn != std::chrono::steady_clock::time_point()) {
+        double interval = std::chrono::duration<double>(now - _last_drawn).count();
+        if (interval > 0) _fps += FPS_SMOOTHING * (1.0 / interval - _fps);
+    }
+    _last_drawn = now;
+    _pending_frames = std::max(0, _pending_frames - 1);
+}
+
+void CFramePacer::skipped(std::chrono::steady_clock::time_point now) {
+    // pending frames stay pending, they are drawn once frames can be shown again
+    _last_drawn = now;
+}
+
+int CFramePacer::get_wait_ms(std::chrono::steady_clock::time_point now) const {
+    auto wait = next_due() - now;
+    if (wait <= std::chrono::steady_clock::duration::zero()) return 0;
+    // round up, waking before the deadline would only mean waiting again
+    return (int) std::ceil(std::chrono::duration<double, std::milli>(wait).count());
+}
+
+double CFramePacer::get_fps() const {
+    return _fps;
+}
+
+std::chrono::steady_clock::time_point CFramePacer::next_due() const {
+    // changes are drawn as soon as the frame rate allows, otherwise only the periodic refresh
+    if (_pending_frames > 0) return _last_drawn + (_idle ? _idle_interval : _min_interval);
+    return _last_drawn + _idle_interval;
+}
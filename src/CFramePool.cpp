@@ -0,0 +1,126 @@
+/**
+ * CFramePool.cpp - pooled cv::Mat storage, frames reuse buffers instead of going back to the heap
+ * 2024-06-30
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CFramePool.hpp"
+
+#define MIN_SIZE 64
+#define SMALL_SIZE (64 * 1024)
+#define PAGE_SIZE 4096
+#define MAX_PER_SIZE 8
+#define MAX_POOLED_BYTES ((size_t) 256 * 1024 * 1024)
+
+CFramePool::CFramePool() {
+    _pooled_bytes = 0;
+}
+
+CFramePool::~CFramePool() {
+    for (auto &bucket: _free) {
+        for (cv::UMatData *u: bucket.second) {
+            cv::fastFree(u->origdata);
+            delete u;
+        }
+    }
+}
+
+CFramePool &CFramePool::instance() {
+    static CFramePool *pool = new CFramePool;
+    return *pool;
+}
+
+void CFramePool::install() {
+    cv::Mat::setDefaultAllocator(&instance());
+}
+
+CFramePool::stats CFramePool::get_stats() const {
+    stats s{};
+    s.heap_allocations = _heap_allocations.load(std::memory_order_relaxed);
+    s.heap_bytes = _heap_bytes.load(std::memory_order_relaxed);
+    s.reused = _reused.load(std::memory_order_relaxed);
+    s.freed = _freed.load(std::memory_order_relaxed);
+    s.live_bytes = _live_bytes.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(_mutex);
+    s.pooled_bytes = _pooled_bytes;
+    return s;
+}
+
+size_t CFramePool::round_size(size_t size) {
+    if (size <= SMALL_SIZE) {
+        size_t rounded = MIN_SIZE;
+        while (rounded < size) rounded <<= 1;
+        return rounded;
+    }
+    return (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+cv::UMatData *CFramePool::allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                                   cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const {
+    // memory the caller owns is only wrapped, nothing to pool
+    if (data) return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage_flags);
+
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) step[i] = total;
+        total *= sizes[i];
+    }
+    size_t capacity = round_size(total);
+
+    cv::UMatData *u = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto bucket = _free.find(capacity);
+        if (bucket != _free.end() && !bucket->second.empty()) {
+            u = bucket->second.back();
+            bucket->second.pop_back();
+            _pooled_bytes -= capacity;
+        }
+    }
+
+    if (u) {
+        // same header and buffer as last time, reset to how a fresh one would start
+        uchar *buffer = u->origdata;
+        u->~UMatData();
+        new(u) cv::UMatData(this);
+        u->data = u->origdata = buffer;
+        _reused.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        u = new cv::UMatData(this);
+        u->data = u->origdata = (uchar *) cv::fastMalloc(capacity);
+        _heap_allocations.fetch_add(1, std::memory_order_relaxed);
+        _heap_bytes.fetch_add(capacity, std::memory_order_relaxed);
+    }
+    u->size = total;
+    _live_bytes.fetch_add(capacity, std::memory_order_relaxed);
+    return u;
+}
+
+bool CFramePool::allocate(cv::UMatData *data, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const {
+    // host memory only, already there
+    return data != nullptr;
+}
+
+void CFramePool::deallocate(cv::UMatData *data) const {
+    if (!data) return;
+
+    size_t capacity = round_size(data->size);
+    _live_bytes.fetch_sub(capacity, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_pooled_bytes + capacity <= MAX_POOLED_BYTES) {
+            // a bucket is made once per size, with room for all it will ever hold so returning never allocates
+            std::vector<cv::UMatData *> &bucket = _free[capacity];
+            if (!bucket.capacity()) bucket.reserve(MAX_PER_SIZE);
+            if (bucket.size() < MAX_PER_SIZE) {
+                bucket.push_back(data);
+                _pooled_bytes += capacity;
+                return;
+            }
+        }
+    }
+
+    cv::fastFree(data->origdata);
+    delete data;
+    _freed.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,122 @@
+/**
+ * CFrameRing.cpp - lock-free latest-frame handoff between threads
+ * 2024-06-03
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CFrameRing.hpp"
+
+CFrameRing::CFrameRing(int readers) {
+    _slot_count = readers + 2;
+    _slots = std::make_unique<slot[]>(_slot_count);
+    _pins = std::vector<pin>(readers);
+    _latest = -1;
+    _latest_generation = 0;
+    _writing = -1;
+    _next_generation = 1;
+    for (auto &s: _signals) s = nullptr;
+    _notifying = 0;
+}
+
+CFrameRing::~CFrameRing() = default;
+
+cv::Mat &CFrameRing::begin_write() {
+    if (_writing >= 0) return _slots[_writing].img;
+
+    // with readers + 2 slots there is always one that is neither the latest nor pinned
+    int latest = _latest.load(std::memory_order_relaxed);
+    while (true) {
+        for (int i = 0; i < _slot_count; i++) {
+            if (i == latest) continue;
+            // claim the slot first, then check for readers. acquire() does the opposite, so one side always backs off
+            _slots[i].generation.store(0, std::memory_order_seq_cst);
+            if (_slots[i].readers.load(std::memory_order_seq_cst) == 0) {
+                _writing = i;
+                return _slots[i].img;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void CFrameRing::publish() {
+    publish(std::chrono::steady_clock::now());
+}
+
+void CFrameRing::publish(std::chrono::steady_clock::time_point captured) {
+    if (_writing < 0) return;
+    _slots[_writing].captured = captured;
+    uint64_t gen = _next_generation++;
+    _slots[_writing].generation.store(gen, std::memory_order_release);
+    _latest.store(_writing, std::memory_order_release);
+    _latest_generation.store(gen, std::memory_order_release);
+    _writing = -1;
+
+    _notifying.fetch_add(1, std::memory_order_seq_cst);
+    for (auto &s: _signals) {
+        CWakeSignal *signal = s.load(std::memory_order_seq_cst);
+        if (signal) signal->notify();
+    }
+    _notifying.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+bool CFrameRing::acquire(int reader) {
+    pin &p = _pins.at(reader);
+    int latest;
+    uint64_t gen;
+    while (true) {
+        latest = _latest.load(std::memory_order_acquire);
+        if (latest < 0) return false;
+
+        gen = _slots[latest].generation.load(std::memory_order_acquire);
+        if (gen == p.generation) return false;
+
+        // pin, then make sure the producer did not reclaim the slot in the meantime
+        // a failed check means the producer has moved on, so retry with the newer frame
+        if (gen != 0) {
+            _slots[latest].readers.fetch_add(1, std::memory_order_seq_cst);
+            if (_slots[latest].generation.load(std::memory_order_seq_cst) == gen) break;
+            _slots[latest].readers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    if (p.slot >= 0) _slots[p.slot].readers.fetch_sub(1, std::memory_order_release);
+    p.slot = latest;
+    p.generation = gen;
+    return true;
+}
+
+const cv::Mat &CFrameRing::view(int reader) const {
+    const pin &p = _pins.at(reader);
+    return p.slot < 0 ? _empty : _slots[p.slot].img;
+}
+
+uint64_t CFrameRing::generation(int reader) const {
+    return _pins.at(reader).generation;
+}
+
+std::chrono::steady_clock::time_point CFrameRing::captured(int reader) const {
+    const pin &p = _pins.at(reader);
+    return p.slot < 0 ? std::chrono::steady_clock::time_point() : _slots[p.slot].captured;
+}
+
+bool CFrameRing::add_signal(CWakeSignal *signal) {
+    for (auto &s: _signals) {
+        CWakeSignal *expected = nullptr;
+        if (s.compare_exchange_strong(expected, signal)) return true;
+    }
+    return false;
+}
+
+void CFrameRing::remove_signal(CWakeSignal *signal) {
+    for (auto &s: _signals) {
+        CWakeSignal *expected = signal;
+        s.compare_exchange_strong(expected, nullptr);
+    }
+    // the producer may have loaded the signal just before it was removed
+    while (_notifying.load(std::memory_order_seq_cst) > 0) std::this_thread::yield();
+}
+
+uint64_t CFrameRing::latest_generation() const {
+    return _latest_generation.load(std::memory_order_acquire);
+}
@@ -0,0 +1,209 @@
+/**
+ * CFrameStream.cpp - reassembly of arena frames from the tcp byte stream
+ * 2024-06-20
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CFrameStream.hpp"
+
+// jpeg markers
+#define JPEG_SOI 0xD8
+#define JPEG_EOI 0xD9
+#define JPEG_SOS 0xDA
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+CFrameStream::CFrameStream(size_t max_frame) {
+    _max_frame = max_frame;
+    _buf.reserve(max_frame);
+    _mode = MODE_AUTO;
+    _resyncs = 0;
+    _discarded = 0;
+    reset();
+}
+
+CFrameStream::~CFrameStream() = default;
+
+void CFrameStream::feed(const uint8_t *data, size_t len) {
+    if (len == 0) return;
+    // move the unconsumed tail to the front only when it would otherwise have to grow
+    if (_head == _buf.size()) {
+        _buf.clear();
+        _head = 0;
+    } else if (_head > 0 && _buf.size() + len > _buf.capacity()) {
+        _buf.erase(_buf.begin(), _buf.begin() + (long) _head);
+        _head = 0;
+    }
+    _buf.insert(_buf.end(), data, data + len);
+}
+
+bool CFrameStream::has_frame() {
+    if (_ready) return true;
+
+    while (true) {
+        const uint8_t *d = _buf.data() + _head;
+        size_t avail = _buf.size() - _head;
+        if (avail < 2) return false;
+
+        if (d[0] == MAGIC_0 && d[1] == MAGIC_1) {
+            if (avail < HEADER_SIZE) return false;
+            uint32_t length = get_u32(d + 4);
+            if (d[2] != VERSION || length > _max_frame) {
+                _resyncs.fetch_add(1, std::memory_order_relaxed);
+                skip(1);
+                continue;
+            }
+            if (avail < HEADER_SIZE + length) return false;
+            _ready = HEADER_SIZE + length;
+            _streaming.store(true, std::memory_order_relaxed);
+            return true;
+        }
+
+        if (d[0] == 0xFF && d[1] == JPEG_SOI) {
+            int found = scan_jpeg(d, avail);
+            if (found > 0) return true;
+            // a jpeg that is malformed or never ends is corrupt, find the next frame instead of buffering forever
+            if (found == 0 && avail <= _max_frame) return false;
+            _resyncs.fetch_add(1, std::memory_order_relaxed);
+            skip(1);
+            continue;
+        }
+
+        // ping responses end up between frames and are expected, anything else means bytes were lost
+        if (d[0] != '\6') _resyncs.fetch_add(1, std::memory_order_relaxed);
+        size_t i = 1;
+        while (i < avail && d[i] != MAGIC_0 && d[i] != 0xFF) i++;
+        skip(i);
+    }
+}
+
+int CFrameStream::scan_jpeg(const uint8_t *data, size_t avail) {
+    // walk the marker segments first so the end marker of an embedded exif thumbnail isn't taken for ours
+    size_t pos = _scan ? _scan : 2;
+    while (!_entropy) {
+        if (pos + 4 > avail) {
+            _scan = pos;
+            return 0;
+        }
+        if (data[pos] != 0xFF) return -1;
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            // fill byte
+            pos++;
+            continue;
+        }
+        pos += 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+        if (marker == JPEG_SOS) _entropy = true;
+    }
+
+    // 0xFF in entropy coded data is always followed by 0x00 or a restart marker, so this is the real end
+    for (; pos + 1 < avail; pos++) {
+        if (data[pos] == 0xFF && data[pos + 1] == JPEG_EOI) {
+            _ready = pos + 2;
+            return 1;
+        }
+    }
+    _scan = pos;
+    return 0;
+}
+
+void CFrameStream::take_frame(packet *out) {
+    if (!_ready && !has_frame()) return;
+    if (out) {
+        out->assign(_buf.begin() + (long) _head, _buf.begin() + (long) (_head + _ready));
+    } else {
+        _discarded.fetch_add(1, std::memory_order_relaxed);
+    }
+    skip(_ready);
+}
+
+void CFrameStream::skip(size_t n) {
+    _head += n;
+    _scan = 0;
+    _entropy = false;
+    _ready = 0;
+}
+
+void CFrameStream::reset() {
+    _buf.clear();
+    _head = 0;
+    _scan = 0;
+    _entropy = false;
+    _ready = 0;
+    _streaming = false;
+}
+
+bool CFrameStream::is_streaming() const {
+    return _streaming.load(std::memory_order_relaxed);
+}
+
+uint64_t CFrameStream::get_resync_count() const {
+    return _resyncs.load(std::memory_order_relaxed);
+}
+
+uint64_t CFrameStream::get_discarded_count() const {
+    return _discarded.load(std::memory_order_relaxed);
+}
+
+void CFrameStream::set_mode(mode m) {
+    _mode = m;
+}
+
+CFrameStream::mode CFrameStream::get_mode() const {
+    return _mode;
+}
+
+bool CFrameStream::wants_polling() const {
+    return _mode == MODE_POLL || (_mode == MODE_AUTO && !is_streaming());
+}
+
+bool CFrameStream::parse_header(const uint8_t *data, size_t len, header &out) {
+    if (len < HEADER_SIZE || data[0] != MAGIC_0 || data[1] != MAGIC_1 || data[2] != VERSION) return false;
+    out.length = get_u32(data + 4);
+    out.sequence = get_u32(data + 8);
+    out.capture_us = (uint64_t) get_u32(data + 12) | ((uint64_t) get_u32(data + 16) << 32);
+    return len - HEADER_SIZE >= out.length;
+}
+
+void CFrameStream::encode_header(const header &h, uint8_t *out) {
+    out[0] = MAGIC_0;
+    out[1] = MAGIC_1;
+    out[2] = VERSION;
+    out[3] = 0;
+    put_u32(out + 4, h.length);
+    put_u32(out + 8, h.sequence);
+    put_u32(out + 12, (uint32_t) h.capture_us);
+    put_u32(out + 16, (uint32_t) (h.capture_us >> 32));
+}
+
+void CFrameStream::encode_command(packet &out, char command, int arg) {
+    char text[16] = {command, ' '};
+    auto res = std::to_chars(text + 2, text + sizeof(text), arg);
+    out.assign(text, res.ptr);
+}
+
+CFrameStream::mode CFrameStream::mode_from_string(const std::string &name) {
+    if (name == "poll") return MODE_POLL;
+    if (name == "stream") return MODE_STREAM;
+    return MODE_AUTO;
+}
+
+std::string CFrameStream::mode_to_string(mode m) {
+    switch (m) {
+        case MODE_POLL:
+            return "poll";
+        case MODE_STREAM:
+            return "stream";
+        default:
+            return "auto";
+    }
+}
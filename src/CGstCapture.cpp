@@ -0,0 +1,243 @@
+/**
+ * CGstCapture.cpp - gstreamer capture straight from an appsink, frames wrap the mapped buffers
+ * 2024-07-01
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CGstCapture.hpp"
+
+#define SINK_NAME "zoomy_sink"
+#define SINK_TAIL "videoconvert ! video/x-raw, format=BGR ! appsink name=" SINK_NAME " drop=true max-buffers=1"
+#define READ_TIMEOUT 100
+#define SAMPLE_REFS 8
+
+namespace {
+
+    // a sample mapped for a Mat, the Mat's reference count is the UMatData's
+    struct mapped_sample {
+        cv::UMatData u;
+        GstSample *sample;
+        GstVideoFrame video;
+
+        explicit mapped_sample(const cv::MatAllocator *allocator) : u(allocator), sample(nullptr), video() {}
+    };
+
+    // never allocates buffers, only takes back the ones it wrapped when the last Mat over them lets go
+    class sample_allocator : public cv::MatAllocator {
+    public:
+        sample_allocator() {
+            _free.reserve(SAMPLE_REFS);
+        }
+
+        cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, cv::AccessFlag flags,
+                               cv::UMatUsageFlags usage_flags) const override {
+            return cv::Mat::getDefaultAllocator()->allocate(dims, sizes, type, data, step, flags, usage_flags);
+        }
+
+        bool allocate(cv::UMatData *data, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const override {
+            return data != nullptr;
+        }
+
+        void deallocate(cv::UMatData *data) const override {
+            if (!data) return;
+            auto *m = (mapped_sample *) data->userdata;
+            gst_video_frame_unmap(&m->video);
+            gst_sample_unref(m->sample);
+            m->sample = nullptr;
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            _free.push_back(m);
+        }
+
+        // the headers are kept and reused, a reader holds at most a few frames at once
+        bool wrap(GstSample *sample, cv::Mat &frame) const {
+            GstVideoInfo info;
+            if (!gst_video_info_from_caps(&info, gst_sample_get_caps(sample))) return false;
+
+            mapped_sample *m = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!_free.empty()) {
+                    m = _free.back();
+                    _free.pop_back();
+                }
+            }
+            if (!m) m = new mapped_sample(this);
+
+            if (!gst_video_frame_map(&m->video, &info, gst_sample_get_buffer(sample), GST_MAP_READ)) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _free.push_back(m);
+                return false;
+            }
+            m->sample = sample;
+
+            auto *data = (uchar *) GST_VIDEO_FRAME_PLANE_DATA(&m->video, 0);
+            size_t stride = GST_VIDEO_FRAME_PLANE_STRIDE(&m->video, 0);
+            int rows = GST_VIDEO_FRAME_HEIGHT(&m->video);
+            cv::Mat wrapped(rows, GST_VIDEO_FRAME_WIDTH(&m->video), CV_8UC3, data, stride);
+
+            // a Mat over user data has no UMatData, giving it one makes the Mat's refcount release the sample
+            m->u.data = m->u.origdata = data;
+            m->u.size = stride * rows;
+            m->u.flags = cv::UMatData::USER_ALLOCATED;
+            m->u.userdata = m;
+            m->u.refcount = 1;
+            m->u.urefcount = 0;
+            wrapped.u = &m->u;
+            frame = wrapped;
+            return true;
+        }
+
+    private:
+        mutable std::mutex _mutex;
+        mutable std::vector<mapped_sample *> _free;
+    };
+
+    // never destroyed, frames can outlive every capture
+    sample_allocator &get_allocator() {
+        static sample_allocator *a = new sample_allocator;
+        return *a;
+    }
+}
+
+CGstCapture::CGstCapture() {
+    _pipeline = nullptr;
+    _sink = nullptr;
+    _pending = nullptr;
+    _frames = 0;
+}
+
+CGstCapture::~CGstCapture() {
+    release();
+}
+
+bool CGstCapture::open(const std::string &description, int timeout_ms) {
+    release();
+    if (!gst_is_initialized()) gst_init(nullptr, nullptr);
+
+    // the sink is always ours, whatever the caller ended the pipeline with
+    std::string source = description;
+    auto trim = [&source] {
+        while (!source.empty() && std::isspace((unsigned char) source.back())) source.pop_back();
+    };
+    trim();
+    if (source.size() >= 7 && source.compare(source.size() - 7, 7, "appsink") == 0) {
+        source.resize(source.size() - 7);
+        trim();
+        if (!source.empty() && source.back() == '!') source.pop_back();
+        trim();
+    }
+    if (source.empty()) {
+        spdlog::error("Empty gstreamer pipeline");
+        return false;
+    }
+    std::string pipeline = source + " ! " SINK_TAIL;
+
+    GError *error = nullptr;
+    _pipeline = gst_parse_launch(pipeline.c_str(), &error);
+    if (error) {
+        spdlog::error("Could not parse gstreamer pipeline \"{}\": {}", pipeline, error->message);
+        g_clear_error(&error);
+    }
+    if (!_pipeline) return false;
+    _sink = gst_bin_get_by_name(GST_BIN(_pipeline), SINK_NAME);
+
+    if (!_sink || gst_element_set_state(_pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        spdlog::error("Could not start gstreamer pipeline \"{}\"", pipeline);
+        check_bus();
+        release();
+        return false;
+    }
+
+    // live sources report success straight away, only a frame shows the pipeline really works
+    _pending = gst_app_sink_try_pull_sample(GST_APP_SINK(_sink), (GstClockTime) timeout_ms * GST_MSECOND);
+    if (!_pending) {
+        if (!check_bus()) spdlog::error("No frame from gstreamer pipeline \"{}\" in {} ms", pipeline, timeout_ms);
+        release();
+        return false;
+    }
+    spdlog::info("Opened gstreamer pipeline \"{}\"", pipeline);
+    return true;
+}
+
+void CGstCapture::release() {
+    if (_pending) {
+        gst_sample_unref(_pending);
+        _pending = nullptr;
+    }
+    if (_pipeline) {
+        gst_element_set_state(_pipeline, GST_STATE_NULL);
+        if (_sink) gst_object_unref(_sink);
+        gst_object_unref(_pipeline);
+        _sink = nullptr;
+        _pipeline = nullptr;
+    }
+    _frames = 0;
+}
+
+bool CGstCapture::is_opened() const {
+    return _pipeline != nullptr;
+}
+
+bool CGstCapture::read(cv::Mat &frame, std::chrono::steady_clock::time_point *captured) {
+    if (!_pipeline) return false;
+
+    GstSample *sample = _pending;
+    _pending = nullptr;
+    if (!sample) sample = gst_app_sink_try_pull_sample(GST_APP_SINK(_sink), READ_TIMEOUT * GST_MSECOND);
+    if (!sample) {
+        if (check_bus() || gst_app_sink_is_eos(GST_APP_SINK(_sink))) release();
+        return false;
+    }
+
+    if (captured) *captured = capture_time(sample);
+    // on success the sample belongs to the frame
+    if (!get_allocator().wrap(sample, frame)) {
+        spdlog::warn("Could not map gstreamer buffer");
+        gst_sample_unref(sample);
+        return false;
+    }
+    _frames++;
+    return true;
+}
+
+uint64_t CGstCapture::get_frame_count() const {
+    return _frames;
+}
+
+bool CGstCapture::check_bus() {
+    if (!_pipeline) return false;
+    GstBus *bus = gst_element_get_bus(_pipeline);
+    GstMessage *message = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+    gst_object_unref(bus);
+    if (!message) return false;
+
+    GError *error = nullptr;
+    gchar *debug = nullptr;
+    gst_message_parse_error(message, &error, &debug);
+    spdlog::error("Gstreamer error: {}", error ? error->message : "unknown");
+    if (error) g_error_free(error);
+    g_free(debug);
+    gst_message_unref(message);
+    return true;
+}
+
+std::chrono::steady_clock::time_point CGstCapture::capture_time(GstSample *sample) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    GstClockTime pts = GST_BUFFER_PTS(gst_sample_get_buffer(sample));
+    GstSegment *segment = gst_sample_get_segment(sample);
+    if (!GST_CLOCK_TIME_IS_VALID(pts) || !segment) return now;
+
+    // pts is in stream time, the pipeline clock says how long ago that was
+    GstClock *clock = gst_element_get_clock(_pipeline);
+    if (!clock) return now;
+    GstClockTime running = gst_segment_to_running_time(segment, GST_FORMAT_TIME, pts);
+    GstClockTime clock_now = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+    if (!GST_CLOCK_TIME_IS_VALID(running)) return now;
+
+    GstClockTime at = running + gst_element_get_base_time(_pipeline);
+    if (clock_now <= at) return now;
+    return now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::nanoseconds(clock_now - at));
+}
@@ -0,0 +1,238 @@
+/**
+ * CHSVMask.cpp - fused single-pass HSV threshold and mask kernel
+ * 2024-06-07
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CHSVMask.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HSV_MASK_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define HSV_TABLE_WORDS ((1 << 24) / 32)
+
+static inline bool lookup(const uint32_t *bits, uint32_t idx) {
+    return (bits[idx >> 5] >> (idx & 31)) & 1;
+}
+
+static void mask_row_scalar(const uint32_t *bits, const uint8_t *src, uint8_t *mask, uint8_t *preview, int width) {
+    for (int x = 0; x < width; x++, src += 3) {
+        bool hit = lookup(bits, src[0] | (src[1] << 8) | (src[2] << 16));
+        mask[x] = hit ? 255 : 0;
+        if (preview) {
+            preview[0] = hit ? src[0] : 0;
+            preview[1] = hit ? src[1] : 0;
+            preview[2] = hit ? src[2] : 0;
+            preview += 3;
+        }
+    }
+}
+
+#ifdef HSV_MASK_X86
+// the last pixels of every row are left to the scalar kernel so 16 byte loads and stores never leave the row
+
+__attribute__((target("avx2")))
+static void mask_row_avx2(const uint32_t *bits, const uint8_t *src, uint8_t *mask, uint8_t *preview, int width) {
+    // spread 4 packed bgr pixels per 128 bit lane into 32 bit lanes, and back
+    const __m256i to_lanes = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                              0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i to_pixels = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                               0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i to_bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                              0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i low_bits = _mm256_set1_epi32(31);
+    const __m256i one = _mm256_set1_epi32(1);
+
+    int x = 0;
+    for (; x + 10 <= width; x += 8) {
+        const uint8_t *p = src + x * 3;
+        __m256i raw = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) p)),
+                                              _mm_loadu_si128((const __m128i *) (p + 12)), 1);
+        __m256i idx = _mm256_shuffle_epi8(raw, to_lanes);
+
+        // gather the table words and test each pixel's bit
+        __m256i words = _mm256_i32gather_epi32((const int *) bits, _mm256_srli_epi32(idx, 5), 4);
+        __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(words, _mm256_and_si256(idx, low_bits)), one);
+        __m256i hit = _mm256_cmpeq_epi32(bit, one);
+
+        __m256i packed = _mm256_shuffle_epi8(hit, to_bytes);
+        uint32_t lo = (uint32_t) _mm256_extract_epi32(packed, 0);
+        uint32_t hi = (uint32_t) _mm256_extract_epi32(packed, 4);
+        std::memcpy(mask + x, &lo, 4);
+        std::memcpy(mask + x + 4, &hi, 4);
+
+        if (preview) {
+            // second store overwrites the 4 padding bytes of the first
+            __m256i px = _mm256_shuffle_epi8(_mm256_and_si256(idx, hit), to_pixels);
+            uint8_t *q = preview + x * 3;
+            _mm_storeu_si128((__m128i *) q, _mm256_castsi256_si128(px));
+            _mm_storeu_si128((__m128i *) (q + 12), _mm256_extracti128_si256(px, 1));
+        }
+    }
+    mask_row_scalar(bits, src + x * 3, mask + x, preview ? preview + x * 3 : nullptr, width - x);
+}
+
+__attribute__((target("sse4.1")))
+static void mask_row_sse41(const uint32_t *bits, const uint8_t *src, uint8_t *mask, uint8_t *preview, int width) {
+    const __m128i to_lanes = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i to_pixels = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m128i to_bytes = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    int x = 0;
+    for (; x + 6 <= width; x += 4) {
+        const uint8_t *p = src + x * 3;
+        __m128i idx = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) p), to_lanes);
+
+        // no gather before avx2, look up each lane
+        __m128i hit = _mm_setr_epi32(-(int) lookup(bits, (uint32_t) _mm_extract_epi32(idx, 0)),
+                                     -(int) lookup(bits, (uint32_t) _mm_extract_epi32(idx, 1)),
+                                     -(int) lookup(bits, (uint32_t) _mm_extract_epi32(idx, 2)),
+                                     -(int) lookup(bits, (uint32_t) _mm_extract_epi32(idx, 3)));
+
+        uint32_t packed = (uint32_t) _mm_cvtsi128_si32(_mm_shuffle_epi8(hit, to_bytes));
+        std::memcpy(mask + x, &packed, 4);
+
+        if (preview) {
+            __m128i px = _mm_shuffle_epi8(_mm_and_si128(idx, hit), to_pixels);
+            _mm_storeu_si128((__m128i *) (preview + x * 3), px);
+        }
+    }
+    mask_row_scalar(bits, src + x * 3, mask + x, preview ? preview + x * 3 : nullptr, width - x);
+}
+#endif
+
+#if defined(__ARM_NEON)
+static void mask_row_neon(const uint32_t *bits, const uint8_t *src, uint8_t *mask, uint8_t *preview, int width) {
+    int x = 0;
+    uint8_t hits[16];
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t *p = src + x * 3;
+        for (int i = 0; i < 16; i++) {
+            hits[i] = lookup(bits, p[i * 3] | (p[i * 3 + 1] << 8) | (p[i * 3 + 2] << 16)) ? 255 : 0;
+        }
+        uint8x16_t hit = vld1q_u8(hits);
+        vst1q_u8(mask + x, hit);
+
+        if (preview) {
+            uint8x16x3_t px = vld3q_u8(p);
+            px.val[0] = vandq_u8(px.val[0], hit);
+            px.val[1] = vandq_u8(px.val[1], hit);
+            px.val[2] = vandq_u8(px.val[2], hit);
+            vst3q_u8(preview + x * 3, px);
+        }
+    }
+    mask_row_scalar(bits, src + x * 3, mask + x, preview ? preview + x * 3 : nullptr, width - x);
+}
+#endif
+
+CHSVMask::CHSVMask() {
+    _low = cv::Scalar_<int>(-1, -1, -1);
+    _high = cv::Scalar_<int>(-1, -1, -1);
+    _bits = std::vector<uint32_t>(HSV_TABLE_WORDS, 0);
+    _kernel = mask_row_scalar;
+    _kernel_name = "scalar";
+
+#if defined(HSV_MASK_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        _kernel = mask_row_avx2;
+        _kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        _kernel = mask_row_sse41;
+        _kernel_name = "sse4.1";
+    }
+#elif defined(__ARM_NEON)
+    _kernel = mask_row_neon;
+    _kernel_name = "neon";
+#endif
+}
+
+CHSVMask::~CHSVMask() = default;
+
+bool CHSVMask::set_thresholds(const cv::Scalar_<int> &low, const cv::Scalar_<int> &high) {
+    if (low == _low && high == _high) return false;
+    _low = low;
+    _high = high;
+    build_table();
+    return true;
+}
+
+void CHSVMask::build_table() {
+    // classify every colour with opencv itself, one 256x256 (b, g) plane per red value
+    // each plane fills its own 2048 words of the table, so planes can be built in parallel
+    cv::parallel_for_(cv::Range(0, 256), [&](const cv::Range &reds) {
+        cv::Mat bgr(256, 256, CV_8UC3), hsv, in_range;
+        for (int r = reds.start; r < reds.end; r++) {
+            for (int g = 0; g < 256; g++) {
+                auto *row = bgr.ptr<cv::Vec3b>(g);
+                for (int b = 0; b < 256; b++) row[b] = cv::Vec3b((uchar) b, (uchar) g, (uchar) r);
+            }
+            cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+            cv::inRange(hsv, (cv::Scalar) _low, (cv::Scalar) _high, in_range);
+
+            uint32_t *words = _bits.data() + ((size_t) r << 11);
+            std::memset(words, 0, 2048 * sizeof(uint32_t));
+            for (int g = 0; g < 256; g++) {
+                const uint8_t *m = in_range.ptr<uint8_t>(g);
+                for (int b = 0; b < 256; b++) {
+                    if (m[b]) words[((g << 8) | b) >> 5] |= 1u << (b & 31);
+                }
+            }
+        }
+    });
+}
+
+void CHSVMask::apply(const cv::Mat &input, cv::Mat &mask, cv::Mat *preview) const {
+    if (input.empty()) return;
+    mask.create(input.size(), CV_8UC1);
+    if (preview) preview->create(input.size(), CV_8UC3);
+
+    // anything that isn't 8-bit bgr goes through the regular opencv chain
+    if (input.type() != CV_8UC3) {
+        cv::Mat hsv;
+        cv::cvtColor(input, hsv, cv::COLOR_BGR2HSV);
+        cv::inRange(hsv, (cv::Scalar) _low, (cv::Scalar) _high, mask);
+        if (preview) {
+            preview->setTo(cv::Scalar::all(0));
+            input.copyTo(*preview, mask);
+        }
+        return;
+    }
+
+    cv::parallel_for_(cv::Range(0, input.rows), [&](const cv::Range &rows) {
+        for (int y = rows.start; y < rows.end; y++) {
+            _kernel(_bits.data(), input.ptr<uint8_t>(y), mask.ptr<uint8_t>(y),
+                    preview ? preview->ptr<uint8_t>(y) : nullptr, input.cols);
+        }
+    });
+}
+
+bool CHSVMask::verify(const cv::Mat &input) const {
+    if (input.empty() || input.type() != CV_8UC3) return true;
+
+    cv::Mat hsv, expected_mask, expected_preview, mask, preview, diff;
+    cv::cvtColor(input, hsv, cv::COLOR_BGR2HSV);
+    cv::inRange(hsv, (cv::Scalar) _low, (cv::Scalar) _high, expected_mask);
+    cv::bitwise_and(input, input, expected_preview, expected_mask);
+    apply(input, mask, &preview);
+
+    int bad_mask = cv::countNonZero(mask != expected_mask);
+    cv::absdiff(preview, expected_preview, diff);
+    int bad_preview = cv::countNonZero(diff.reshape(1));
+    if (bad_mask || bad_preview) {
+        spdlog::error("HSV mask kernel ({}) differs from OpenCV: {:d} mask, {:d} preview mismatches",
+                      _kernel_name, bad_mask, bad_preview);
+        return false;
+    }
+    return true;
+}
+
+std::string CHSVMask::get_kernel_name() const {
+    return _kernel_name;
+}
@@ -0,0 +1,170 @@
+/**
+ * CJpegDecoder.cpp - jpeg decoding off the network thread, newest frame first
+ * 2024-06-21
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CJpegDecoder.hpp"
+
+static const int PERF_DECODE = CPerfStats::add_stage("net.decode");
+
+CJpegDecoder::CJpegDecoder(CFrameRing &output, CPacketPool &pool, int workers) : _output(output), _pool(pool) {
+    _worker_count = std::max(1, workers);
+    _running = false;
+    _pending = nullptr;
+    _pending_offset = 0;
+    _pending_order = 0;
+    _submitted = 0;
+    _published_order = 0;
+    _reduction = 1;
+    _decoded = 0;
+    _skipped = 0;
+    _failed = 0;
+    _last_decode_us = 0;
+    _total_decode_us = 0;
+}
+
+CJpegDecoder::~CJpegDecoder() {
+    stop();
+}
+
+void CJpegDecoder::start() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_running) return;
+    _running = true;
+    for (int i = 0; i < _worker_count; i++) _workers.emplace_back(thread_decode, this);
+}
+
+void CJpegDecoder::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _cv.notify_all();
+    for (auto &t: _workers) {
+        if (t.joinable()) t.join();
+    }
+    _workers.clear();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pool.release(_pending);
+    _pending = nullptr;
+}
+
+void CJpegDecoder::submit(packet *p, size_t offset) {
+    if (!p) return;
+    packet *stale;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        stale = _pending;
+        _pending = p;
+        _pending_offset = offset;
+        _pending_order = ++_submitted;
+    }
+    if (stale) {
+        _pool.release(stale);
+        _skipped.fetch_add(1, std::memory_order_relaxed);
+    }
+    _cv.notify_one();
+}
+
+void CJpegDecoder::set_reduction(int reduction) {
+    _reduction = reduction >= 8 ? 8 : reduction >= 4 ? 4 : reduction >= 2 ? 2 : 1;
+}
+
+int CJpegDecoder::get_reduction() const {
+    return _reduction;
+}
+
+uint64_t CJpegDecoder::get_decoded_count() const {
+    return _decoded.load(std::memory_order_relaxed);
+}
+
+uint64_t CJpegDecoder::get_skipped_count() const {
+    return _skipped.load(std::memory_order_relaxed);
+}
+
+uint64_t CJpegDecoder::get_failed_count() const {
+    return _failed.load(std::memory_order_relaxed);
+}
+
+double CJpegDecoder::get_last_decode_ms() const {
+    return (double) _last_decode_us.load(std::memory_order_relaxed) / 1000.0;
+}
+
+double CJpegDecoder::get_average_decode_ms() const {
+    uint64_t count = get_decoded_count() + get_failed_count();
+    return count ? (double) _total_decode_us.load(std::memory_order_relaxed) / 1000.0 / (double) count : 0.0;
+}
+
+void CJpegDecoder::thread_decode(CJpegDecoder *who_called) {
+    who_called->decode_loop();
+}
+
+void CJpegDecoder::decode_loop() {
+    // kept between frames so imdecode can reuse its storage
+    cv::Mat image;
+
+    while (true) {
+        packet *p;
+        size_t offset;
+        uint64_t order;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this] { return _pending || !_running; });
+            if (!_running) break;
+            p = _pending;
+            offset = _pending_offset;
+            order = _pending_order;
+            _pending = nullptr;
+        }
+
+        int flags;
+        switch (_reduction.load(std::memory_order_relaxed)) {
+            case 8:
+                flags = cv::IMREAD_REDUCED_COLOR_8;
+                break;
+            case 4:
+                flags = cv::IMREAD_REDUCED_COLOR_4;
+                break;
+            case 2:
+                flags = cv::IMREAD_REDUCED_COLOR_2;
+                break;
+            default:
+                flags = cv::IMREAD_UNCHANGED;
+                break;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        cv::Mat encoded(1, (int) (p->size() - std::min(offset, p->size())), CV_8UC1, p->data() + offset);
+        if (encoded.cols > 0) {
+            cv::imdecode(encoded, flags, &image);
+        } else {
+            image.release();
+        }
+        auto us = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        std::chrono::steady_clock::time_point received = _pool.get_stamp(p);
+        _pool.release(p);
+        _last_decode_us.store(us, std::memory_order_relaxed);
+        CPerfStats::record(PERF_DECODE, us);
+        _total_decode_us.fetch_add(us, std::memory_order_relaxed);
+
+        if (image.empty()) {
+            _failed.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex_publish);
+        // another worker already published a newer frame
+        if (order < _published_order) {
+            _skipped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        _published_order = order;
+        // the free slot's old image comes back to this worker to decode the next frame into
+        std::swap(_output.begin_write(), image);
+        _output.publish(received);
+        _decoded.fetch_add(1, std::memory_order_relaxed);
+    }
+}
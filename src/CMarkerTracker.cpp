@@ -0,0 +1,93 @@
+/**
+ * CMarkerTracker.cpp - persistent ArUco detector with ROI tracking between frames
+ * 2024-06-10
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CMarkerTracker.hpp"
+
+#define MIN_ROI_PADDING 16
+
+CMarkerTracker::CMarkerTracker(int full_scan_interval, float roi_padding) :
+        _detector(cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250), cv::aruco::DetectorParameters()) {
+    _full_scan_interval = full_scan_interval;
+    _roi_padding = roi_padding;
+    _frames_since_full_scan = 0;
+    _last_full_scan = false;
+}
+
+CMarkerTracker::~CMarkerTracker() = default;
+
+void CMarkerTracker::detect(const cv::Mat &image, std::vector<std::vector<cv::Point2f>> &corners,
+                            std::vector<int> &ids) {
+    corners.clear();
+    ids.clear();
+    if (image.empty()) return;
+
+    bool full_scan = _tracked_ids.empty() || image.size() != _last_frame_size ||
+                     ++_frames_since_full_scan >= _full_scan_interval;
+
+    if (!full_scan) {
+        for (const auto &roi: tracked_regions(image.size())) {
+            _detector.detectMarkers(image(roi), _roi_corners, _roi_ids);
+            for (int i = 0; i < _roi_ids.size(); i++) {
+                for (auto &pt: _roi_corners.at(i)) {
+                    pt.x += (float) roi.x;
+                    pt.y += (float) roi.y;
+                }
+                corners.push_back(_roi_corners.at(i));
+                ids.push_back(_roi_ids.at(i));
+            }
+        }
+        // a marker went missing, it may have moved out of its region so look everywhere
+        if (ids.size() < _tracked_ids.size()) full_scan = true;
+    }
+
+    if (full_scan) {
+        _detector.detectMarkers(image, corners, ids);
+        _frames_since_full_scan = 0;
+    }
+
+    _tracked_corners = corners;
+    _tracked_ids = ids;
+    _last_frame_size = image.size();
+    _last_full_scan = full_scan;
+}
+
+void CMarkerTracker::reset() {
+    _tracked_corners.clear();
+    _tracked_ids.clear();
+}
+
+bool CMarkerTracker::was_full_scan() const {
+    return _last_full_scan;
+}
+
+std::vector<cv::Rect> CMarkerTracker::tracked_regions(const cv::Size &frame_size) const {
+    cv::Rect frame(cv::Point(0, 0), frame_size);
+    std::vector<cv::Rect> regions;
+
+    for (const auto &marker: _tracked_corners) {
+        cv::Rect box = cv::boundingRect(marker);
+        int pad = std::max(MIN_ROI_PADDING, (int) (std::max(box.width, box.height) * _roi_padding));
+        box = cv::Rect(box.x - pad, box.y - pad, box.width + 2 * pad, box.height + 2 * pad) & frame;
+        if (box.area() > 0) regions.push_back(box);
+    }
+
+    // merge overlapping regions so markers close together are not detected twice
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (int i = 0; i < regions.size() && !merged; i++) {
+            for (int j = i + 1; j < regions.size(); j++) {
+                if ((regions.at(i) & regions.at(j)).area() > 0) {
+                    regions.at(i) |= regions.at(j);
+                    regions.erase(regions.begin() + j);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+    }
+    return regions;
+}
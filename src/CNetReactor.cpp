@@ -0,0 +1,153 @@
+/**
+ * CNetReactor.cpp - event driven loop for networking
+ * 2024-06-17
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CNetReactor.hpp"
+
+#define MAX_EVENTS 16
+
+CNetReactor::CNetReactor() {
+    _running = false;
+#ifdef __linux__
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = _event_fd;
+    if (_epoll_fd < 0 || _event_fd < 0 || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _event_fd, &ev) != 0) {
+        spdlog::error("Could not set up epoll for network reactor");
+    }
+#endif
+}
+
+CNetReactor::~CNetReactor() {
+    stop();
+#ifdef __linux__
+    if (_event_fd >= 0) close(_event_fd);
+    if (_epoll_fd >= 0) close(_epoll_fd);
+#endif
+}
+
+void CNetReactor::start() {
+    if (_running) return;
+    _running = true;
+    _thread = std::thread(thread_loop, this);
+}
+
+void CNetReactor::stop() {
+    if (!_running) return;
+    _running = false;
+    post([] {});    // wake the loop so it sees the flag
+    if (_thread.joinable()) _thread.join();
+}
+
+void CNetReactor::post(task t) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _posted.push_back(std::move(t));
+    }
+#ifdef __linux__
+    uint64_t one = 1;
+    if (write(_event_fd, &one, sizeof(one)) < 0) {
+        // counter is already non-zero, the loop will wake anyway
+    }
+#else
+    _cv.notify_one();
+#endif
+}
+
+void CNetReactor::add_timer(std::chrono::milliseconds period, task t) {
+    _timers.push_back(timer{std::chrono::steady_clock::now() + period, period, std::move(t)});
+}
+
+bool CNetReactor::watch(int fd, task on_readable) {
+#ifdef __linux__
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) return false;
+    _watched[fd] = std::move(on_readable);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void CNetReactor::unwatch(int fd) {
+#ifdef __linux__
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+    _watched.erase(fd);
+}
+
+void CNetReactor::thread_loop(CNetReactor *who_called) {
+    who_called->loop();
+}
+
+void CNetReactor::loop() {
+    while (_running) {
+        // sleep until the next timer is due unless woken up earlier
+        auto deadline = std::chrono::steady_clock::time_point::max();
+        for (auto &t: _timers) deadline = std::min(deadline, t.next);
+        wait_until(deadline, !_timers.empty());
+
+        run_posted();
+        run_timers();
+    }
+}
+
+void CNetReactor::wait_until(std::chrono::steady_clock::time_point deadline, bool has_deadline) {
+#ifdef __linux__
+    int timeout = -1;
+    if (has_deadline) {
+        // round up so a timer is never run early and the loop does not spin for the last millisecond
+        auto remaining = deadline - std::chrono::steady_clock::now();
+        timeout = (int) std::max<long long>(0, std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+    }
+
+    epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(_epoll_fd, events, MAX_EVENTS, timeout);
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == _event_fd) {
+            uint64_t count;
+            while (read(_event_fd, &count, sizeof(count)) > 0);
+        } else {
+            auto it = _watched.find(fd);
+            if (it != _watched.end()) it->second();
+        }
+    }
+#else
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto ready = [this] { return !_posted.empty() || !_running; };
+    if (has_deadline) {
+        _cv.wait_until(lock, deadline, ready);
+    } else {
+        _cv.wait(lock, ready);
+    }
+#endif
+}
+
+void CNetReactor::run_posted() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running_tasks.swap(_posted);
+    }
+    for (auto &t: _running_tasks) t();
+    _running_tasks.clear();
+}
+
+void CNetReactor::run_timers() {
+    auto now = std::chrono::steady_clock::now();
+    for (int i = 0; i < _timers.size(); i++) {
+        if (_timers.at(i).next > now) continue;
+        // skip missed periods instead of running the timer several times in a row
+        _timers.at(i).next += _timers.at(i).period;
+        if (_timers.at(i).next <= now) _timers.at(i).next = now + _timers.at(i).period;
+        // copy the task, it may add timers and invalidate the reference
+        task t = _timers.at(i).t;
+        t();
+    }
+}
@@ -0,0 +1,93 @@
+/**
+ * CPacketQueue.cpp - bounded packet queues backed by a pool of reusable buffers
+ * 2024-06-19
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CPacketQueue.hpp"
+
+// free list has spare room so a push never sees a cell that a concurrent pop has claimed but not yet freed
+CPacketPool::CPacketPool(size_t count, size_t capacity) : _buffers(count), _stamps(count), _free(count * 2) {
+    _exhausted = 0;
+    for (auto &b: _buffers) {
+        b.reserve(capacity);
+        _free.try_push(&b);
+    }
+}
+
+CPacketPool::~CPacketPool() = default;
+
+packet *CPacketPool::acquire() {
+    packet *p = nullptr;
+    if (!_free.try_pop(p)) {
+        _exhausted.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    p->clear();
+    _stamps.at(p - _buffers.data()) = std::chrono::steady_clock::now();
+    return p;
+}
+
+void CPacketPool::release(packet *p) {
+    if (!p) return;
+    // the free list can hold every buffer, so a failed push is only ever transient
+    while (!_free.try_push(p)) std::this_thread::yield();
+}
+
+uint64_t CPacketPool::get_exhausted_count() const {
+    return _exhausted.load(std::memory_order_relaxed);
+}
+
+void CPacketPool::stamp(packet *p, std::chrono::steady_clock::time_point received) {
+    _stamps.at(p - _buffers.data()) = received;
+}
+
+std::chrono::steady_clock::time_point CPacketPool::get_stamp(const packet *p) const {
+    return _stamps.at(p - _buffers.data());
+}
+
+CPacketQueue::CPacketQueue(size_t capacity, CPacketPool &pool, drop_policy policy) : _queue(capacity), _pool(pool) {
+    _policy = policy;
+    _dropped = 0;
+}
+
+CPacketQueue::~CPacketQueue() {
+    packet *p;
+    while ((p = pop())) release(p);
+}
+
+bool CPacketQueue::push(packet *p) {
+    if (!p) return false;
+    if (_queue.try_push(p)) return true;
+
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+    if (_policy == DROP_NEWEST) {
+        _pool.release(p);
+        return false;
+    }
+
+    // the queue is multi-consumer safe, so the producer can discard the oldest itself
+    // if the consumer emptied the queue in between, the retry just succeeds
+    packet *oldest;
+    while (!_queue.try_push(p)) {
+        if (_queue.try_pop(oldest)) _pool.release(oldest);
+    }
+    return false;
+}
+
+packet *CPacketQueue::pop() {
+    packet *p = nullptr;
+    return _queue.try_pop(p) ? p : nullptr;
+}
+
+void CPacketQueue::release(packet *p) {
+    _pool.release(p);
+}
+
+uint64_t CPacketQueue::get_dropped_count() const {
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+size_t CPacketQueue::size() const {
+    return _queue.size_approx();
+}
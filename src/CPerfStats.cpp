@@ -0,0 +1,243 @@
+/**
+ * CPerfStats.cpp - per-stage latency histograms
+ * 2024-06-25
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CPerfStats.hpp"
+
+namespace {
+
+    // one stage's histogram on one thread, only ever written by that thread
+    struct histogram {
+        std::atomic<uint64_t> buckets[CPerfStats::BUCKETS];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> total_us;
+        std::atomic<uint64_t> max_us;
+
+        histogram() {
+            for (auto &b: buckets) b.store(0, std::memory_order_relaxed);
+            count.store(0, std::memory_order_relaxed);
+            total_us.store(0, std::memory_order_relaxed);
+            max_us.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    // a thread's histograms, allocated the first time the thread records into each stage
+    struct thread_block {
+        std::atomic<histogram *> stages[CPerfStats::MAX_STAGES];
+        bool in_use;
+
+        thread_block() : in_use(true) {
+            for (auto &s: stages) s.store(nullptr, std::memory_order_relaxed);
+        }
+    };
+
+    struct registry {
+        std::mutex mutex;
+        std::vector<std::string> names;
+        std::vector<thread_block *> blocks;     ///< Never freed, a finished thread's block is reused by the next.
+    };
+
+    // never destroyed, detached threads may still be recording while the program exits
+    registry &get_registry() {
+        static registry *r = new registry;
+        return *r;
+    }
+
+    // hands the block back when the thread ends, its samples stay in the totals and a new thread carries on from them
+    struct thread_handle {
+        thread_block *block = nullptr;
+
+        thread_block *get() {
+            if (block) return block;
+            registry &r = get_registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            for (thread_block *b: r.blocks) {
+                if (!b->in_use) {
+                    b->in_use = true;
+                    block = b;
+                    return block;
+                }
+            }
+            block = new thread_block;
+            r.blocks.push_back(block);
+            return block;
+        }
+
+        ~thread_handle() {
+            if (!block) return;
+            std::lock_guard<std::mutex> lock(get_registry().mutex);
+            block->in_use = false;
+        }
+    };
+
+    thread_local thread_handle local_block;
+
+    // single writer, so a plain load and store is enough and cheaper than an atomic add
+    inline void bump(std::atomic<uint64_t> &a, uint64_t by) {
+        a.store(a.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    inline int highest_bit(uint64_t v) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, v);
+        return (int) index;
+#else
+        return 63 - __builtin_clzll(v);
+#endif
+    }
+}
+
+int CPerfStats::add_stage(const std::string &name) {
+    registry &r = get_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (int i = 0; i < (int) r.names.size(); i++) {
+        if (r.names.at(i) == name) return i;
+    }
+    if ((int) r.names.size() >= MAX_STAGES) {
+        spdlog::warn("Too many perf stages, not timing {}", name);
+        return -1;
+    }
+    r.names.push_back(name);
+    return (int) r.names.size() - 1;
+}
+
+int CPerfStats::get_stage_count() {
+    registry &r = get_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return (int) r.names.size();
+}
+
+void CPerfStats::record(int stage, uint64_t us) {
+    if (stage < 0 || stage >= MAX_STAGES) return;
+    thread_block *b = local_block.get();
+    histogram *h = b->stages[stage].load(std::memory_order_relaxed);
+    if (!h) {
+        h = new histogram;
+        b->stages[stage].store(h, std::memory_order_release);
+    }
+    bump(h->buckets[get_bucket(us)], 1);
+    bump(h->count, 1);
+    bump(h->total_us, us);
+    if (us > h->max_us.load(std::memory_order_relaxed)) h->max_us.store(us, std::memory_order_relaxed);
+}
+
+CPerfStats::snapshot CPerfStats::get_snapshot(int stage) {
+    snapshot s{"", 0, 0, 0, std::vector<uint64_t>(BUCKETS, 0)};
+    registry &r = get_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (stage < 0 || stage >= (int) r.names.size()) return s;
+    s.name = r.names.at(stage);
+
+    // a thread may be part way through a record, which at worst puts one sample in the buckets but not the count
+    for (thread_block *b: r.blocks) {
+        histogram *h = b->stages[stage].load(std::memory_order_acquire);
+        if (!h) continue;
+        for (int i = 0; i < BUCKETS; i++) s.buckets.at(i) += h->buckets[i].load(std::memory_order_relaxed);
+        s.count += h->count.load(std::memory_order_relaxed);
+        s.total_us += h->total_us.load(std::memory_order_relaxed);
+        s.max_us = std::max(s.max_us, h->max_us.load(std::memory_order_relaxed));
+    }
+    return s;
+}
+
+std::vector<CPerfStats::snapshot> CPerfStats::get_snapshots() {
+    std::vector<snapshot> all;
+    int stages = get_stage_count();
+    for (int i = 0; i < stages; i++) all.push_back(get_snapshot(i));
+    return all;
+}
+
+bool CPerfStats::dump(const std::string &path) {
+    nlohmann::json j;
+    j["time_unix"] = (int64_t) std::time(nullptr);
+    j["stages"] = nlohmann::json::array();
+    for (const snapshot &s: get_snapshots()) {
+        nlohmann::json buckets = nlohmann::json::array();
+        for (int i = 0; i < BUCKETS; i++) {
+            if (s.buckets.at(i)) buckets.push_back({get_bucket_value(i), s.buckets.at(i)});
+        }
+        j["stages"].push_back({
+                {"name", s.name},
+                {"count", s.count},
+                {"mean_us", s.mean()},
+                {"p50_us", s.percentile(50)},
+                {"p90_us", s.percentile(90)},
+                {"p99_us", s.percentile(99)},
+                {"p999_us", s.percentile(99.9)},
+                {"max_us", s.max_us},
+                {"buckets", buckets}    // [largest duration in bucket, count], empty buckets left out
+        });
+    }
+
+    std::ofstream o(path);
+    if (!o.good()) {
+        spdlog::error("Could not write perf snapshot to {}", path);
+        return false;
+    }
+    o << std::setw(4) << j << std::endl;
+    spdlog::info("Perf snapshot written to {}", path);
+    return true;
+}
+
+int CPerfStats::get_bucket(uint64_t us) {
+    if (us < 2 * SUB_BUCKETS) return (int) us;
+    if (us >> MAX_VALUE_BITS) us = (1ULL << MAX_VALUE_BITS) - 1;
+
+    // keep the top SUB_BUCKET_BITS + 1 bits, the shift picks the power of two and the rest the sub-bucket
+    int shift = highest_bit(us) - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + (int) (us >> shift) - SUB_BUCKETS;
+}
+
+uint64_t CPerfStats::get_bucket_value(int bucket) {
+    if (bucket < 2 * SUB_BUCKETS) return (uint64_t) bucket;
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t) (bucket % SUB_BUCKETS + SUB_BUCKETS);
+    return ((sub + 1) << shift) - 1;
+}
+
+uint64_t CPerfStats::snapshot::percentile(double p) const {
+    if (!count) return 0;
+    auto target = (uint64_t) std::ceil(p / 100.0 * (double) count);
+    target = std::max<uint64_t>(1, std::min(target, count));
+    uint64_t seen = 0;
+    for (int i = 0; i < (int) buckets.size(); i++) {
+        seen += buckets.at(i);
+        if (seen >= target) return std::min(get_bucket_value(i), max_us);
+    }
+    return max_us;
+}
+
+double CPerfStats::snapshot::mean() const {
+    return count ? (double) total_us / (double) count : 0.0;
+}
+
+CPerfStats::snapshot CPerfStats::snapshot::since(const snapshot &earlier) const {
+    snapshot s{name, count - std::min(count, earlier.count), total_us - std::min(total_us, earlier.total_us), 0,
+               buckets};
+    for (int i = 0; i < (int) s.buckets.size() && i < (int) earlier.buckets.size(); i++) {
+        s.buckets.at(i) -= std::min(s.buckets.at(i), earlier.buckets.at(i));
+        if (s.buckets.at(i)) s.max_us = std::min(get_bucket_value(i), max_us);
+    }
+    return s;
+}
+
+CPerfTimer::CPerfTimer(int stage) {
+    _stage = stage;
+    _running = true;
+    _start = std::chrono::steady_clock::now();
+}
+
+CPerfTimer::~CPerfTimer() {
+    if (_running) stop();
+}
+
+uint64_t CPerfTimer::stop() {
+    auto us = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - _start).count();
+    if (_running) CPerfStats::record(_stage, us);
+    _running = false;
+    return us;
+}
@@ -0,0 +1,85 @@
+/**
+ * CPipelineStage.cpp - one stage of the vision pipeline on its own thread
+ * 2024-06-28
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CPipelineStage.hpp"
+
+#define OCCUPANCY_WINDOW 1000   // ms over which occupancy is measured
+
+CPipelineStage::CPipelineStage(std::string name) : _name(std::move(name)) {
+    _poll = std::chrono::milliseconds(1);
+    _running = false;
+    _occupancy = 0;
+    _runs = 0;
+    _busy_us = 0;
+}
+
+CPipelineStage::~CPipelineStage() {
+    stop();
+}
+
+void CPipelineStage::start(step s, std::chrono::milliseconds poll) {
+    if (_running) return;
+    _step = std::move(s);
+    _poll = std::max(poll, std::chrono::milliseconds(1));
+    _running = true;
+    _thread = std::thread(thread_stage, this);
+}
+
+void CPipelineStage::stop() {
+    _running = false;
+    _signal.notify();
+    if (_thread.joinable()) _thread.join();
+}
+
+CWakeSignal &CPipelineStage::signal() {
+    return _signal;
+}
+
+const std::string &CPipelineStage::get_name() const {
+    return _name;
+}
+
+double CPipelineStage::get_occupancy() const {
+    return _occupancy.load(std::memory_order_relaxed);
+}
+
+uint64_t CPipelineStage::get_run_count() const {
+    return _runs.load(std::memory_order_relaxed);
+}
+
+uint64_t CPipelineStage::get_busy_us() const {
+    return _busy_us.load(std::memory_order_relaxed);
+}
+
+void CPipelineStage::thread_stage(CPipelineStage *who_called) {
+    auto window_start = std::chrono::steady_clock::now();
+    uint64_t window_busy_us = 0;
+
+    while (who_called->_running) {
+        auto start = std::chrono::steady_clock::now();
+        bool worked = who_called->_step();
+        auto now = std::chrono::steady_clock::now();
+
+        // steps that found nothing new are only polling, they don't count as busy
+        if (worked) {
+            auto us = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+            window_busy_us += us;
+            who_called->_busy_us.fetch_add(us, std::memory_order_relaxed);
+            who_called->_runs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        auto window = std::chrono::duration_cast<std::chrono::microseconds>(now - window_start).count();
+        if (window >= OCCUPANCY_WINDOW * 1000) {
+            who_called->_occupancy.store(std::min(1.0, (double) window_busy_us / (double) window),
+                                         std::memory_order_relaxed);
+            window_start = now;
+            window_busy_us = 0;
+        }
+
+        // more may have arrived while working, only sleep once the input has been caught up with
+        if (!worked) who_called->_signal.wait_until(now + who_called->_poll);
+    }
+}
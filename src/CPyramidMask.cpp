@@ -0,0 +1,64 @@
+/**
+ * CPyramidMask.cpp - coarse-to-fine arena mask, full resolution only around the car
+ * 2024-06-30
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CPyramidMask.hpp"
+
+#define MAX_LEVEL 4
+
+CPyramidMask::CPyramidMask(int level, int margin) : _localizer(32, 1) {
+    set_level(level);
+    _margin = std::max(0, margin);
+}
+
+CPyramidMask::~CPyramidMask() = default;
+
+void CPyramidMask::set_level(int level) {
+    _level = std::clamp(level, 0, MAX_LEVEL);
+    _localizer.reset();
+}
+
+int CPyramidMask::get_level() const {
+    return _level;
+}
+
+void CPyramidMask::apply(const CHSVMask &hsv, const cv::Mat &input, cv::Mat &mask, const cv::Mat &region) {
+    _window = cv::Rect();
+    if (input.empty()) return;
+    if (!_level) {
+        hsv.apply(input, mask);
+        if (!region.empty()) cv::bitwise_and(mask, region, mask);
+        return;
+    }
+
+    // nearest neighbour only reads the pixels it keeps, averaging would touch every pixel of the full image
+    int scale = 1 << _level;
+    cv::resize(input, _small, cv::Size(std::max(1, input.cols / scale), std::max(1, input.rows / scale)), 0, 0,
+               cv::INTER_NEAREST);
+    hsv.apply(_small, _coarse);
+    if (!region.empty()) {
+        // so the coarse search can't settle on something outside the region either
+        cv::resize(region, _small_region, _small.size(), 0, 0, cv::INTER_NEAREST);
+        cv::bitwise_and(_coarse, _small_region, _coarse);
+    }
+
+    mask.create(input.size(), CV_8UC1);
+    mask.setTo(cv::Scalar(0));
+    CCarLocalizer::result car = _localizer.locate(_coarse);
+    if (!car.found) return;
+
+    // refine at full resolution around the car only
+    cv::Rect coarse_window(car.bounds.x - _margin, car.bounds.y - _margin, car.bounds.width + 2 * _margin,
+                           car.bounds.height + 2 * _margin);
+    _window = cv::Rect(coarse_window.x * scale, coarse_window.y * scale, coarse_window.width * scale,
+                       coarse_window.height * scale) & cv::Rect(0, 0, input.cols, input.rows);
+    cv::Mat window = mask(_window);
+    hsv.apply(input(_window), window);
+    if (!region.empty()) cv::bitwise_and(window, region(_window), window);
+}
+
+cv::Rect CPyramidMask::get_window() const {
+    return _window;
+}
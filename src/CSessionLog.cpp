@@ -0,0 +1,216 @@
+/**
+ * CSessionLog.cpp - memory-mapped binary log of what was sent to the robot and why
+ * 2024-06-24
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CSessionLog.hpp"
+
+CSessionLog::CSessionLog() {
+    _map = nullptr;
+    _map_size = 0;
+    _capacity = 0;
+    _open = false;
+    _next = 0;
+    _dropped = 0;
+#ifdef _WIN32
+    _file = INVALID_HANDLE_VALUE;
+    _mapping = nullptr;
+#else
+    _fd = -1;
+#endif
+}
+
+CSessionLog::~CSessionLog() {
+    close();
+}
+
+bool CSessionLog::open(const std::string &path, uint64_t capacity) {
+    close();
+    _map_size = sizeof(header) + capacity * sizeof(record);
+
+    // the whole file is reserved up front, unwritten records read back as zero which marks the end of the log
+#ifdef _WIN32
+    _file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (_file == INVALID_HANDLE_VALUE) {
+        spdlog::error("Could not create session log {}", path);
+        return false;
+    }
+    _mapping = CreateFileMappingA(_file, nullptr, PAGE_READWRITE, (DWORD) ((uint64_t) _map_size >> 32),
+                                  (DWORD) _map_size, nullptr);
+    if (_mapping) _map = (uint8_t *) MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, _map_size);
+#else
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0) {
+        spdlog::error("Could not create session log {}", path);
+        return false;
+    }
+    if (ftruncate(_fd, (off_t) _map_size) == 0) {
+        void *m = mmap(nullptr, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        _map = m == MAP_FAILED ? nullptr : (uint8_t *) m;
+    }
+#endif
+    if (!_map) {
+        spdlog::error("Could not map session log {}", path);
+        unmap();
+        return false;
+    }
+
+    _start = std::chrono::steady_clock::now();
+    auto *h = (header *) _map;
+    std::memcpy(h->magic, "ZLOG", 4);
+    h->version = VERSION;
+    h->record_size = sizeof(record);
+    h->start_unix_us = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    h->capacity = capacity;
+
+    _path = path;
+    _capacity = capacity;
+    _next = 0;
+    _dropped = 0;
+    _open = true;
+    spdlog::info("Logging session to {}", path);
+    return true;
+}
+
+void CSessionLog::close() {
+    if (!_open) {
+        unmap();
+        return;
+    }
+    _open = false;
+    uint64_t written = get_written_count();
+    unmap();
+
+    // drop the unused space so the file is only as long as the session
+    size_t used = sizeof(header) + written * sizeof(record);
+#ifdef _WIN32
+    HANDLE f = CreateFileA(_path.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        size.QuadPart = (LONGLONG) used;
+        SetFilePointerEx(f, size, nullptr, FILE_BEGIN);
+        SetEndOfFile(f);
+        CloseHandle(f);
+    }
+#else
+    if (truncate(_path.c_str(), (off_t) used) != 0) spdlog::warn("Could not trim session log {}", _path);
+#endif
+    spdlog::info("Session log closed, {} records, {} dropped", written, get_dropped_count());
+    _path.clear();
+}
+
+void CSessionLog::unmap() {
+#ifdef _WIN32
+    if (_map) UnmapViewOfFile(_map);
+    if (_mapping) CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+    _mapping = nullptr;
+    _file = INVALID_HANDLE_VALUE;
+#else
+    if (_map) munmap(_map, _map_size);
+    if (_fd >= 0) ::close(_fd);
+    _fd = -1;
+#endif
+    _map = nullptr;
+}
+
+bool CSessionLog::is_open() const {
+    return _open;
+}
+
+void CSessionLog::log(record_type type, uint32_t aux, const int32_t *values, int count) {
+    if (!_open) return;
+    uint64_t slot = _next.fetch_add(1, std::memory_order_relaxed);
+    if (slot >= _capacity) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    auto *r = (record *) (_map + sizeof(header) + slot * sizeof(record));
+    count = std::max(0, std::min(count, MAX_VALUES));
+    r->time_us = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - _start).count();
+    r->count = (uint16_t) count;
+    r->aux = aux;
+    std::memcpy(r->values, values, count * sizeof(int32_t));
+
+    // the type marks the record as complete, so it has to land after everything else
+    std::atomic_thread_fence(std::memory_order_release);
+    r->type = (uint16_t) type;
+}
+
+void CSessionLog::log_control(const std::vector<int> &values, bool binary) {
+    int32_t v[MAX_VALUES];
+    int count = std::min((int) values.size(), MAX_VALUES);
+    for (int i = 0; i < count; i++) v[i] = values.at(i);
+    log(REC_CONTROL, binary ? 1 : 0, v, count);
+}
+
+void CSessionLog::log_auto_input(int move_x, int move_y, int rotate) {
+    int32_t v[] = {move_x, move_y, rotate};
+    log(REC_AUTO_INPUT, 0, v, 3);
+}
+
+void CSessionLog::log_car(int car_x, int car_y, int dest_x, int dest_y) {
+    int32_t v[] = {car_x, car_y, dest_x, dest_y};
+    log(REC_CAR, 0, v, 4);
+}
+
+void CSessionLog::log_waypoint(int step, int x, int y, int speed, int rotation, bool turret) {
+    int32_t v[] = {x, y, speed, rotation, turret ? 1 : 0};
+    log(REC_WAYPOINT, (uint32_t) step, v, 5);
+}
+
+void CSessionLog::log_rtt(long ms) {
+    int32_t v[] = {(int32_t) ms};
+    log(REC_RTT, 0, v, 1);
+}
+
+uint64_t CSessionLog::get_written_count() const {
+    return std::min(_next.load(std::memory_order_relaxed), _capacity);
+}
+
+uint64_t CSessionLog::get_dropped_count() const {
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+const std::string &CSessionLog::get_path() const {
+    return _path;
+}
+
+const char *CSessionLog::get_type_name(uint16_t type) {
+    switch (type) {
+        case REC_CONTROL:
+            return "control";
+        case REC_AUTO_INPUT:
+            return "auto_input";
+        case REC_CAR:
+            return "car";
+        case REC_WAYPOINT:
+            return "waypoint";
+        case REC_RTT:
+            return "rtt";
+        default:
+            return "unknown";
+    }
+}
+
+std::vector<std::string> CSessionLog::get_value_names(uint16_t type) {
+    switch (type) {
+        case REC_CONTROL:
+            return {"left_x", "left_y", "right_x", "right_y", "left_trigger", "right_trigger", "a", "b", "x", "y"};
+        case REC_AUTO_INPUT:
+            return {"move_x", "move_y", "rotate"};
+        case REC_CAR:
+            return {"car_x", "car_y", "dest_x", "dest_y"};
+        case REC_WAYPOINT:
+            return {"x", "y", "speed", "rotation", "turret"};
+        case REC_RTT:
+            return {"rtt_ms"};
+        default:
+            return {};
+    }
+}
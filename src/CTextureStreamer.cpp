@@ -0,0 +1,158 @@
+/**
+ * CTextureStreamer.cpp - asynchronous texture uploads through pixel buffer objects
+ * 2024-06-12
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CTextureStreamer.hpp"
+
+// buffer object functions are not exported by every platform's GL library, load them through SDL
+static PFNGLGENBUFFERSPROC gl_gen_buffers;
+static PFNGLDELETEBUFFERSPROC gl_delete_buffers;
+static PFNGLBINDBUFFERPROC gl_bind_buffer;
+static PFNGLBUFFERDATAPROC gl_buffer_data;
+static PFNGLMAPBUFFERRANGEPROC gl_map_buffer_range;
+static PFNGLUNMAPBUFFERPROC gl_unmap_buffer;
+static PFNGLTEXSTORAGE2DPROC gl_tex_storage_2d;
+
+static bool load_gl_functions() {
+    static bool loaded = [] {
+        gl_gen_buffers = (PFNGLGENBUFFERSPROC) SDL_GL_GetProcAddress("glGenBuffers");
+        gl_delete_buffers = (PFNGLDELETEBUFFERSPROC) SDL_GL_GetProcAddress("glDeleteBuffers");
+        gl_bind_buffer = (PFNGLBINDBUFFERPROC) SDL_GL_GetProcAddress("glBindBuffer");
+        gl_buffer_data = (PFNGLBUFFERDATAPROC) SDL_GL_GetProcAddress("glBufferData");
+        gl_map_buffer_range = (PFNGLMAPBUFFERRANGEPROC) SDL_GL_GetProcAddress("glMapBufferRange");
+        gl_unmap_buffer = (PFNGLUNMAPBUFFERPROC) SDL_GL_GetProcAddress("glUnmapBuffer");
+        // immutable storage needs GL 4.2 or the extension, not available on macOS
+        // GLX hands out a pointer for any gl name, so only the context can say whether it works
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        bool have_storage = major > 4 || (major == 4 && minor >= 2) ||
+                            SDL_GL_ExtensionSupported("GL_ARB_texture_storage");
+        gl_tex_storage_2d = have_storage ? (PFNGLTEXSTORAGE2DPROC) SDL_GL_GetProcAddress("glTexStorage2D") : nullptr;
+
+        bool have_pbo = gl_gen_buffers && gl_delete_buffers && gl_bind_buffer && gl_buffer_data &&
+                        gl_map_buffer_range && gl_unmap_buffer;
+        if (!have_pbo) spdlog::warn("Pixel buffer objects unavailable, uploading textures synchronously");
+        return have_pbo;
+    }();
+    return loaded;
+}
+
+CTextureStreamer::CTextureStreamer() {
+    _texture = 0;
+    _pbo[0] = 0;
+    _pbo[1] = 0;
+    _pbo_index = 0;
+    _use_pbo = false;
+    _last_data = nullptr;
+    _last_generation = 0;
+}
+
+CTextureStreamer::~CTextureStreamer() {
+    release();
+}
+
+void CTextureStreamer::release() {
+    if (_texture) glDeleteTextures(1, &_texture);
+    if (_pbo[0]) gl_delete_buffers(2, _pbo);
+    _texture = 0;
+    _pbo[0] = 0;
+    _pbo[1] = 0;
+    _size = cv::Size();
+}
+
+void CTextureStreamer::allocate(const cv::Size &size) {
+    release();
+    _use_pbo = load_gl_functions();
+    _size = size;
+
+    glGenTextures(1, &_texture);
+    glBindTexture(GL_TEXTURE_2D, _texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                    GL_CLAMP_TO_EDGE); // This is required on WebGL for non power-of-two textures
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); // Same
+
+    // storage is allocated once here, frames only ever replace its contents
+    if (gl_tex_storage_2d) {
+        gl_tex_storage_2d(GL_TEXTURE_2D, 1, GL_RGB8, size.width, size.height);
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, size.width, size.height, 0, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    if (_use_pbo) {
+        gl_gen_buffers(2, _pbo);
+        for (auto &pbo: _pbo) {
+            gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            gl_buffer_data(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) size.area() * 4, nullptr, GL_STREAM_DRAW);
+        }
+        gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+}
+
+bool CTextureStreamer::update(const cv::Mat &input, uint64_t generation) {
+    if (input.empty()) return false;
+    if (generation && generation == _last_generation && input.data == _last_data && input.size() == _size) {
+        return false;
+    }
+
+    // gl can take bgr(a) directly, anything else is converted once here
+    const cv::Mat *src = &input;
+    if (input.type() != CV_8UC3 && input.type() != CV_8UC4) {
+        cv::cvtColor(input, _converted, input.channels() == 1 ? cv::COLOR_GRAY2BGR : cv::COLOR_BGRA2BGR);
+        src = &_converted;
+    }
+    GLenum format = src->channels() == 4 ? GL_BGRA : GL_BGR;
+    size_t row_bytes = src->cols * src->elemSize();
+
+    if (src->size() != _size || !_texture) allocate(src->size());
+
+    glBindTexture(GL_TEXTURE_2D, _texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if (_use_pbo) {
+        // alternate buffers so the cpu never writes into one the driver is still reading from
+        _pbo_index = 1 - _pbo_index;
+        auto size = (GLsizeiptr) (row_bytes * src->rows);
+        gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, _pbo[_pbo_index]);
+        auto *dst = (uchar *) gl_map_buffer_range(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        // nothing is recorded on failure, so the same frame is tried again next time
+        if (!dst) {
+            gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return false;
+        }
+        if (src->isContinuous()) {
+            std::memcpy(dst, src->data, size);
+        } else {
+            for (int y = 0; y < src->rows; y++) std::memcpy(dst + y * row_bytes, src->ptr(y), row_bytes);
+        }
+        // false if the buffer's contents were lost while it was mapped, e.g. on a mode switch
+        if (gl_unmap_buffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE) {
+            gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return false;
+        }
+        // returns immediately, the copy from the buffer to the texture happens asynchronously
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, src->cols, src->rows, format, GL_UNSIGNED_BYTE, nullptr);
+        gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    } else {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint) (src->step / src->elemSize()));
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, src->cols, src->rows, format, GL_UNSIGNED_BYTE, src->data);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+
+    _last_data = input.data;
+    _last_generation = generation;
+    return true;
+}
+
+GLuint CTextureStreamer::get_texture() const {
+    return _texture;
+}
+
+cv::Size CTextureStreamer::get_size() const {
+    return _size;
+}
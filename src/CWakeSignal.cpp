@@ -0,0 +1,29 @@
+/**
+ * CWakeSignal.cpp - wakes a sleeping thread when there is new work
+ * 2024-06-27
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CWakeSignal.hpp"
+
+CWakeSignal::CWakeSignal() {
+    _notified = false;
+}
+
+CWakeSignal::~CWakeSignal() = default;
+
+void CWakeSignal::notify() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _notified = true;
+    }
+    _cv.notify_one();
+}
+
+bool CWakeSignal::wait_until(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait_until(lock, deadline, [this] { return _notified; });
+    bool notified = _notified;
+    _notified = false;
+    return notified;
+}
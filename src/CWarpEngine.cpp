@@ -0,0 +1,140 @@
+/**
+ * CWarpEngine.cpp - cached homography warp using precomputed remap tables
+ * 2024-06-05
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CWarpEngine.hpp"
+
+#define WARP_CACHE_MAGIC 0x5A4D5750 // "PWMZ"
+#define WARP_STRIPE_ROWS 64
+
+CWarpEngine::CWarpEngine(int dim) {
+    _dim = dim;
+    _generation = 0;
+}
+
+CWarpEngine::~CWarpEngine() = default;
+
+bool CWarpEngine::set_corners(const std::vector<cv::Point> &corners) {
+    if (corners.size() != 4) return false;
+    if (!_map_xy.empty() && corners == _corners) return false;
+
+    cv::Mat h = find_homography(corners, _dim);
+
+    // degenerate quads (e.g. two corners dragged on top of each other) have no homography, keep the old tables
+    if (h.empty()) return false;
+
+    _corners = corners;
+    _homography = h;
+    build_maps();
+    return true;
+}
+
+cv::Mat CWarpEngine::find_homography(const std::vector<cv::Point> &corners, int dim) {
+    if (corners.size() != 4) return cv::Mat();
+    std::vector<cv::Point2f> end = {cv::Point2f(0, 0), cv::Point2f((float) dim, 0),
+                                    cv::Point2f((float) dim, (float) dim), cv::Point2f(0, (float) dim)};
+    return cv::findHomography(corners, end);
+}
+
+void CWarpEngine::build_maps() {
+    // each output pixel samples the source at inverse(H) * (x, y, 1)
+    cv::Matx33d inv = cv::Matx33d(_homography).inv();
+    cv::Mat map_x(_dim, _dim, CV_32FC1), map_y(_dim, _dim, CV_32FC1);
+
+    cv::parallel_for_(cv::Range(0, _dim), [&](const cv::Range &rows) {
+        for (int y = rows.start; y < rows.end; y++) {
+            auto *mx = map_x.ptr<float>(y);
+            auto *my = map_y.ptr<float>(y);
+            for (int x = 0; x < _dim; x++) {
+                double w = inv(2, 0) * x + inv(2, 1) * y + inv(2, 2);
+                w = w ? 1.0 / w : 0.0;
+                mx[x] = (float) ((inv(0, 0) * x + inv(0, 1) * y + inv(0, 2)) * w);
+                my[x] = (float) ((inv(1, 0) * x + inv(1, 1) * y + inv(1, 2)) * w);
+            }
+        }
+    });
+
+    // fixed-point tables are about twice as fast to remap with as float tables
+    cv::convertMaps(map_x, map_y, _map_xy, _map_frac, CV_16SC2);
+    _generation++;
+    spdlog::info("Rebuilt warp tables ({:d}x{:d})", _dim, _dim);
+}
+
+void CWarpEngine::apply(const cv::Mat &input, cv::Mat &output) const {
+    if (input.empty() || _map_xy.empty()) return;
+    output.create(_dim, _dim, input.type());
+
+    cv::parallel_for_(cv::Range(0, (_dim + WARP_STRIPE_ROWS - 1) / WARP_STRIPE_ROWS), [&](const cv::Range &stripes) {
+        for (int i = stripes.start; i < stripes.end; i++) {
+            cv::Range rows(i * WARP_STRIPE_ROWS, std::min((i + 1) * WARP_STRIPE_ROWS, _dim));
+            cv::Mat out_stripe = output.rowRange(rows);
+            cv::remap(input, out_stripe, _map_xy.rowRange(rows), _map_frac.rowRange(rows), cv::INTER_LINEAR,
+                      cv::BORDER_CONSTANT);
+        }
+    });
+}
+
+const cv::Mat &CWarpEngine::homography() const {
+    return _homography;
+}
+
+uint64_t CWarpEngine::generation() const {
+    return _generation;
+}
+
+bool CWarpEngine::save(const std::string &path) const {
+    if (_map_xy.empty()) return false;
+    std::ofstream o(path, std::ios::binary);
+    if (!o.good()) return false;
+
+    uint32_t header[2] = {WARP_CACHE_MAGIC, (uint32_t) _dim};
+    o.write((const char *) header, sizeof(header));
+    for (const auto &c: _corners) {
+        int32_t xy[2] = {c.x, c.y};
+        o.write((const char *) xy, sizeof(xy));
+    }
+    o.write((const char *) _map_xy.data, (std::streamsize) (_map_xy.total() * _map_xy.elemSize()));
+    o.write((const char *) _map_frac.data, (std::streamsize) (_map_frac.total() * _map_frac.elemSize()));
+    return o.good();
+}
+
+bool CWarpEngine::load(const std::string &path) {
+    std::ifstream i(path, std::ios::binary);
+    if (!i.good()) return false;
+
+    uint32_t header[2] = {0, 0};
+    i.read((char *) header, sizeof(header));
+    if (!i.good() || header[0] != WARP_CACHE_MAGIC || header[1] != (uint32_t) _dim) {
+        spdlog::warn("Ignoring warp cache {}", path);
+        return false;
+    }
+
+    std::vector<cv::Point> corners;
+    for (int c = 0; c < 4; c++) {
+        int32_t xy[2];
+        i.read((char *) xy, sizeof(xy));
+        corners.emplace_back(xy[0], xy[1]);
+    }
+
+    cv::Mat map_xy(_dim, _dim, CV_16SC2), map_frac(_dim, _dim, CV_16UC1);
+    i.read((char *) map_xy.data, (std::streamsize) (map_xy.total() * map_xy.elemSize()));
+    i.read((char *) map_frac.data, (std::streamsize) (map_frac.total() * map_frac.elemSize()));
+    if (!i.good()) {
+        spdlog::warn("Warp cache {} is truncated", path);
+        return false;
+    }
+
+    std::vector<cv::Point2f> end = {cv::Point2f(0, 0), cv::Point2f((float) _dim, 0),
+                                    cv::Point2f((float) _dim, (float) _dim), cv::Point2f(0, (float) _dim)};
+    cv::Mat h = cv::findHomography(corners, end);
+    if (h.empty()) return false;
+
+    _corners = corners;
+    _homography = h;
+    _map_xy = map_xy;
+    _map_frac = map_frac;
+    _generation++;
+    return true;
+}
@@ -0,0 +1,462 @@
+/**
+ * CZoomyBench.cpp - benchmarks for the vision and control hot paths
+ * 2024-06-23
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include "../include/CZoomyBench.hpp"
+
+#define SEED 0x2F00D
+#define SYNTHETIC_FRAMES 16
+#define RECORDED_MAX_FRAMES 64
+#define DASHCAM_WIDTH 1280
+#define DASHCAM_HEIGHT 720
+#define MARKER_SIZE 160
+#define CONTROL_BATCH 1000      // packets per timed sample, one is too short to time on its own
+
+static std::atomic<uint64_t> alloc_count{0};
+static std::atomic<uint64_t> alloc_bytes{0};
+
+// every heap allocation goes through here except Mat buffers, which come from fastMalloc and are counted by the pool
+void *operator new(size_t size) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+    return operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    std::free(p);
+}
+
+CZoomyBench::CZoomyBench(int argc, char *argv[]) {
+    _iterations = 200;
+    _warmup = 10;
+    _threads = -1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--iterations" && has_value) {
+            _iterations = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--warmup" && has_value) {
+            _warmup = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--threads" && has_value) {
+            _threads = atoi(argv[++i]);
+        } else if (arg == "--filter" && has_value) {
+            _filter = argv[++i];
+        } else if (arg == "--arena" && has_value) {
+            _arena_path = argv[++i];
+        } else if (arg == "--dashcam" && has_value) {
+            _dashcam_path = argv[++i];
+        } else if (arg == "--output" && has_value) {
+            _output_path = argv[++i];
+        } else {
+            spdlog::warn("Unknown argument: {}", arg);
+        }
+    }
+
+    // same thresholds and a similar quad to the defaults in settings.json, scaled up to a full frame
+    _hsv_low = {8, 122, 141};
+    _hsv_high = {18, 255, 255};
+    _corners = {
+            cv::Point(120, 80),
+            cv::Point(1330, 140),
+            cv::Point(1390, 1370),
+            cv::Point(60, 1310)
+    };
+
+    // opencv picks its thread count from the machine, pin it to compare results from different machines
+    if (_threads >= 0) cv::setNumThreads(_threads);
+    cv::setRNGSeed(SEED);
+
+    // same allocator as the client, so allocs/frame is what the pipeline really does
+    CFramePool::install();
+}
+
+CZoomyBench::~CZoomyBench() = default;
+
+uint64_t CZoomyBench::get_alloc_count() {
+    return alloc_count.load(std::memory_order_relaxed);
+}
+
+uint64_t CZoomyBench::get_alloc_bytes() {
+    return alloc_bytes.load(std::memory_order_relaxed);
+}
+
+int CZoomyBench::run() {
+    make_synthetic_arena();
+    make_synthetic_dashcam();
+    if (!_arena_path.empty()) load_recorded(_arena_path, "recorded", _arena_inputs);
+    if (!_dashcam_path.empty()) load_recorded(_dashcam_path, "recorded", _dashcam_inputs);
+
+    spdlog::info("ARENA_DIM {}, OpenCV {}, {} threads, {} iterations", ARENA_DIM, CV_VERSION, cv::getNumThreads(),
+                 _iterations);
+
+    bench_homography();
+    for (const auto &in: _arena_inputs) {
+        bench_warp(in);
+        bench_hsv_mask(in);
+        bench_localize(in);
+        bench_texture(in);
+        bench_pipeline(in);
+    }
+    for (const auto &in: _dashcam_inputs) bench_aruco(in);
+    bench_control_packet();
+
+    return write_results() ? 0 : 1;
+}
+
+void CZoomyBench::make_synthetic_arena() {
+    cv::RNG rng(SEED);
+    input_set in;
+    in.name = "synthetic";
+
+    // grey floor with sensor noise, a white outline at the quad and an orange car driving around inside it
+    cv::Mat floor(ARENA_DIM, ARENA_DIM, CV_8UC3, cv::Scalar(74, 79, 84));
+    cv::Mat noise(floor.size(), CV_8UC3);
+    rng.fill(noise, cv::RNG::UNIFORM, 0, 12);
+    floor += noise;
+    cv::polylines(floor, _corners, true, cv::Scalar(240, 240, 240), 12);
+
+    for (int i = 0; i < SYNTHETIC_FRAMES; i++) {
+        cv::Mat frame = floor.clone();
+        double angle = 2.0 * CV_PI * i / SYNTHETIC_FRAMES;
+        cv::Point2f centre((float) (ARENA_DIM / 2 + ARENA_DIM / 3 * cos(angle)),
+                           (float) (ARENA_DIM / 2 + ARENA_DIM / 3 * sin(angle)));
+        cv::RotatedRect car(centre, cv::Size2f(90, 60), (float) (angle * 180.0 / CV_PI));
+        cv::Point2f pts[4];
+        car.points(pts);
+        std::vector<cv::Point> poly(pts, pts + 4);
+        cv::fillConvexPoly(frame, poly, cv::Scalar(0, 128, 255));
+
+        // a few small orange specks so the contour search has more than one blob to pick from
+        for (int s = 0; s < 8; s++) {
+            cv::circle(frame, cv::Point(rng.uniform(0, ARENA_DIM), rng.uniform(0, ARENA_DIM)), rng.uniform(2, 6),
+                       cv::Scalar(0, 128, 255), cv::FILLED);
+        }
+        in.frames.push_back(frame);
+    }
+    _arena_inputs.push_back(in);
+}
+
+void CZoomyBench::make_synthetic_dashcam() {
+    cv::RNG rng(SEED + 1);
+    input_set in;
+    in.name = "synthetic";
+
+    cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
+    std::vector<cv::Mat> markers(3);
+    for (int m = 0; m < markers.size(); m++) {
+        cv::aruco::generateImageMarker(dictionary, m, MARKER_SIZE, markers.at(m), 1);
+        cv::cvtColor(markers.at(m), markers.at(m), cv::COLOR_GRAY2BGR);
+    }
+
+    // markers drift a little between frames like they would from a moving car, so tracking has to follow them
+    for (int i = 0; i < SYNTHETIC_FRAMES; i++) {
+        cv::Mat frame(DASHCAM_HEIGHT, DASHCAM_WIDTH, CV_8UC3, cv::Scalar(106, 106, 106));
+        cv::Mat noise(frame.size(), CV_8UC3);
+        rng.fill(noise, cv::RNG::UNIFORM, 0, 8);
+        frame += noise;
+        for (int m = 0; m < markers.size(); m++) {
+            int x = 150 + m * 380 + i * 4;
+            int y = 200 + (m % 2) * 180 + i * 2;
+            markers.at(m).copyTo(frame(cv::Rect(x, y, MARKER_SIZE, MARKER_SIZE)));
+        }
+        in.frames.push_back(frame);
+    }
+    _dashcam_inputs.push_back(in);
+}
+
+bool CZoomyBench::load_recorded(const std::string &path, const std::string &name, std::vector<input_set> &out) {
+    cv::VideoCapture capture(path);
+    if (!capture.isOpened()) {
+        spdlog::error("Could not open recording: {}", path);
+        return false;
+    }
+
+    // decoded up front so file reads and decoding are not part of any timing
+    input_set in;
+    in.name = name;
+    cv::Mat frame;
+    while (in.frames.size() < RECORDED_MAX_FRAMES && capture.read(frame) && !frame.empty()) {
+        in.frames.push_back(frame.clone());
+    }
+    if (in.frames.empty()) {
+        spdlog::error("No frames in recording: {}", path);
+        return false;
+    }
+    spdlog::info("Loaded {} frames ({}x{}) from {}", in.frames.size(), in.frames.at(0).cols, in.frames.at(0).rows,
+                 path);
+    out.push_back(in);
+    return true;
+}
+
+CZoomyBench::input_set CZoomyBench::warp_all(const input_set &in) {
+    CWarpEngine warp(ARENA_DIM);
+    warp.set_corners(_corners);
+    input_set out;
+    out.name = in.name;
+    for (const auto &f: in.frames) {
+        cv::Mat warped;
+        warp.apply(f, warped);
+        out.frames.push_back(warped);
+    }
+    return out;
+}
+
+CZoomyBench::input_set CZoomyBench::mask_all(const input_set &in) {
+    CHSVMask hsv_mask;
+    hsv_mask.set_thresholds(_hsv_low, _hsv_high);
+    input_set out;
+    out.name = in.name;
+    for (const auto &f: in.frames) {
+        cv::Mat mask;
+        hsv_mask.apply(f, mask);
+        out.frames.push_back(mask);
+    }
+    return out;
+}
+
+void CZoomyBench::bench_homography() {
+    // corners move a pixel every frame, as while dragging them in the UI, so the tables are rebuilt every time
+    CWarpEngine warp(ARENA_DIM);
+    std::vector<cv::Point> corners = _corners;
+    measure("homography", "synthetic", [&](int i) {
+        corners.at(i % 4).x += (i / 4) % 2 ? -1 : 1;
+        warp.set_corners(corners);
+    });
+}
+
+void CZoomyBench::bench_warp(const input_set &in) {
+    CWarpEngine warp(ARENA_DIM);
+    warp.set_corners(_corners);
+    cv::Mat output;
+    measure("warp", in.name, [&](int i) {
+        warp.apply(in.frames.at(i % in.frames.size()), output);
+    });
+}
+
+void CZoomyBench::bench_hsv_mask(const input_set &in) {
+    if (!enabled("hsv_mask") && !enabled("hsv_mask_preview") && !enabled("hsv_mask_pyramid")) return;
+    input_set warped = warp_all(in);
+    CHSVMask hsv_mask;
+    hsv_mask.set_thresholds(_hsv_low, _hsv_high);
+    cv::Mat mask, preview;
+    measure("hsv_mask", in.name, [&](int i) {
+        hsv_mask.apply(warped.frames.at(i % warped.frames.size()), mask);
+    });
+    measure("hsv_mask_preview", in.name, [&](int i) {
+        hsv_mask.apply(warped.frames.at(i % warped.frames.size()), mask, &preview);
+    });
+
+    // quarter size to find the car, full size only around it, as autonomy masks without a preview
+    CPyramidMask pyramid(2);
+    measure("hsv_mask_pyramid", in.name, [&](int i) {
+        pyramid.apply(hsv_mask, warped.frames.at(i % warped.frames.size()), mask);
+    });
+}
+
+void CZoomyBench::bench_localize(const input_set &in) {
+    if (!enabled("contours") && !enabled("localize_full") && !enabled("localize_tracked")) return;
+    input_set masks = mask_all(warp_all(in));
+
+    // the contour search autonomous used before, biggest bounding box over the whole mask
+    std::vector<std::vector<cv::Point>> contours;
+    std::vector<cv::Vec4i> hierarchy;
+    measure("contours", in.name, [&](int i) {
+        cv::findContours(masks.frames.at(i % masks.frames.size()), contours, hierarchy, cv::RETR_EXTERNAL,
+                         cv::CHAIN_APPROX_SIMPLE);
+        int biggest = 0;
+        for (const auto &contour: contours) biggest = std::max(biggest, cv::boundingRect(contour).area());
+    });
+
+    // labelling the whole mask every frame, and the localizer as autonomous uses it
+    CCarLocalizer full;
+    measure("localize_full", in.name, [&](int i) {
+        full.reset();
+        full.locate(masks.frames.at(i % masks.frames.size()));
+    });
+    CCarLocalizer tracked;
+    measure("localize_tracked", in.name, [&](int i) {
+        tracked.locate(masks.frames.at(i % masks.frames.size()));
+    });
+}
+
+void CZoomyBench::bench_texture(const input_set &in) {
+    if (!enabled("texture_bgr") && !enabled("texture_gray")) return;
+    input_set warped = warp_all(in);
+    input_set masks = mask_all(warped);
+
+    // the cpu side of CTextureStreamer::update(), the upload itself needs a gl context
+    std::vector<uint8_t> staging((size_t) ARENA_DIM * ARENA_DIM * 4);
+    cv::Mat converted;
+    measure("texture_bgr", in.name, [&](int i) {
+        const cv::Mat &src = warped.frames.at(i % warped.frames.size());
+        std::memcpy(staging.data(), src.data, std::min(staging.size(), src.total() * src.elemSize()));
+    });
+    measure("texture_gray", in.name, [&](int i) {
+        cv::cvtColor(masks.frames.at(i % masks.frames.size()), converted, cv::COLOR_GRAY2BGR);
+        std::memcpy(staging.data(), converted.data, std::min(staging.size(), converted.total() * converted.elemSize()));
+    });
+}
+
+void CZoomyBench::bench_pipeline(const input_set &in) {
+    // what one frame costs across the pipeline stages: warp, mask with preview, then finding the car in the mask
+    CWarpEngine warp(ARENA_DIM);
+    warp.set_corners(_corners);
+    CHSVMask hsv_mask;
+    hsv_mask.set_thresholds(_hsv_low, _hsv_high);
+    cv::Mat warped, mask, preview;
+    CCarLocalizer localizer;
+    measure("pipeline", in.name, [&](int i) {
+        warp.apply(in.frames.at(i % in.frames.size()), warped);
+        hsv_mask.apply(warped, mask, &preview);
+        localizer.locate(mask);
+    });
+
+    // what autonomy costs in camera space: raw frame masked coarse-to-fine inside the corners, only the car's
+    // centroid is warped
+    CPyramidMask pyramid(2);
+    CCarLocalizer camera_localizer;
+    std::vector<cv::Point2f> centroid(1), warped_centroid;
+    cv::Mat region = cv::Mat::zeros(in.frames.front().size(), CV_8UC1);
+    std::vector<std::vector<cv::Point>> outline = {_corners};
+    cv::fillPoly(region, outline, cv::Scalar(255));
+    measure("pipeline_camera", in.name, [&](int i) {
+        pyramid.apply(hsv_mask, in.frames.at(i % in.frames.size()), mask, region);
+        CCarLocalizer::result car = camera_localizer.locate(mask);
+        if (car.found) {
+            centroid.front() = car.centroid;
+            cv::perspectiveTransform(centroid, warped_centroid, warp.homography());
+        }
+    });
+}
+
+void CZoomyBench::bench_aruco(const input_set &in) {
+    std::vector<std::vector<cv::Point2f>> corners;
+    std::vector<int> ids;
+
+    // a full scan every frame, as before markers were tracked, and the tracker as the client uses it
+    CMarkerTracker full(1);
+    measure("aruco_full", in.name, [&](int i) {
+        full.detect(in.frames.at(i % in.frames.size()), corners, ids);
+    });
+    CMarkerTracker tracked;
+    measure("aruco_tracked", in.name, [&](int i) {
+        tracked.detect(in.frames.at(i % in.frames.size()), corners, ids);
+    });
+}
+
+void CZoomyBench::bench_control_packet() {
+    std::vector<int> values = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    CControlPacket text, binary;
+    text.set_format(CControlPacket::FORMAT_TEXT);
+    binary.set_format(CControlPacket::FORMAT_BINARY);
+
+    // values change every packet like a moving stick, so nothing can be cached between packets
+    auto wiggle = [&values](int i) {
+        values.at(value_type::GC_LEFTX) = (i * 37) % 65536 - 32768;
+        values.at(value_type::GC_LEFTY) = (i * 91) % 65536 - 32768;
+        values.at(value_type::GC_LTRIG) = i % 360;
+        values.at(value_type::GC_A) = i & 1;
+    };
+    measure("control_text", "synthetic", [&](int i) {
+        wiggle(i);
+        text.encode(values);
+    }, CONTROL_BATCH);
+    measure("control_binary", "synthetic", [&](int i) {
+        wiggle(i);
+        binary.encode(values);
+    }, CONTROL_BATCH);
+}
+
+bool CZoomyBench::enabled(const std::string &name) const {
+    return _filter.empty() || name.find(_filter) != std::string::npos;
+}
+
+bool CZoomyBench::write_results() {
+    nlohmann::json j = {
+            {"version", 1},
+            {"arena_dim", ARENA_DIM},
+            {"opencv", CV_VERSION},
+            {"threads", cv::getNumThreads()},
+            {"iterations", _iterations},
+            {"warmup", _warmup},
+            {"hsv_kernel", CHSVMask().get_kernel_name()},
+#ifdef NDEBUG
+            {"build", "release"},
+#else
+            {"build", "debug"},
+#endif
+            {"results", nlohmann::json::array()}
+    };
+    for (const auto &r: _results) {
+        j["results"].push_back({
+                {"name", r.name},
+                {"input", r.input},
+                {"iterations", r.iterations},
+                {"ns_per_frame", r.ns_median},
+                {"ns_mean", r.ns_mean},
+                {"ns_min", r.ns_min},
+                {"ns_p99", r.ns_p99},
+                {"allocs_per_frame", r.allocs_per_frame},
+                {"bytes_per_frame", r.bytes_per_frame},
+                {"pool_allocs_per_frame", r.pool_allocs_per_frame}
+        });
+    }
+
+    if (_output_path.empty()) {
+        std::cout << std::setw(4) << j << std::endl;
+        return true;
+    }
+    std::ofstream o(_output_path);
+    if (!o.good()) {
+        spdlog::error("Could not write results to {}", _output_path);
+        return false;
+    }
+    o << std::setw(4) << j << std::endl;
+    o.close();
+    spdlog::info("Results written to {}", _output_path);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    // results go to stdout, keep the log out of them
+    spdlog::set_default_logger(spdlog::stderr_color_mt("zoomy-bench"));
+    CZoomyBench b(argc, argv);
+    return b.run();
+}
@@ -6,16 +6,25 @@
 
 #include "../include/CZoomyClient.hpp"
 
-#define PING_TIMEOUT 1000
-#define NET_DELAY 35
 #define DEADZONE 4096
-#define ARENA_DIM 1440
 #define DEMO_SPEED 0.3
 #define DEMO_ROTATE 0.7
-
-// increase this value if malloc_error_break happens too often
-#define TCP_DELAY 30
-//#define TCP_DELAY 15 // only if over ssh forwarding
+#define LATENCY_WINDOW 5        // seconds of latency shown in the debug panel
+#define INPUT_SETTLE_FRAMES 3   // frames drawn after input so hover and animations catch up
+
+static const int PERF_DASHCAM = CPerfStats::add_stage("update.dashcam");
+static const int PERF_DRAW = CPerfStats::add_stage("draw");
+static const int PERF_EVENTS = CPerfStats::add_stage("draw.events");
+static const int PERF_UI = CPerfStats::add_stage("draw.ui");
+static const int PERF_RENDER = CPerfStats::add_stage("draw.render");
+
+// recorded by the core and autonomous controller, in the order a frame reaches them
+static const int PERF_LATENCY[] = {
+        CPerfStats::add_stage("latency.warped"),
+        CPerfStats::add_stage("latency.masked"),
+        CPerfStats::add_stage("latency.autonomy"),
+        CPerfStats::add_stage("latency.command"),
+};
 
 CZoomyClient::CZoomyClient(cv::Size s) {
     _window_size = s;
@@ -32,10 +41,6 @@ CZoomyClient::CZoomyClient(cv::Size s) {
         exit(-1);
     }
 
-//    // control init
-
-    _values = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
     // dear imgui init
     // Decide GL+GLSL versions
 #if defined(IMGUI_IMPL_OPENGL_ES2)
@@ -68,7 +73,28 @@ CZoomyClient::CZoomyClient(cv::Size s) {
     }
 
     SDL_GL_MakeCurrent(_window->get_native_window(), _window->get_native_context());
-    SDL_GL_SetSwapInterval(1); // Enable vsync
+
+    // frame pacing, the window already enables vsync
+    nlohmann::json &ui = _core.ui_settings();
+    int max_fps = ui.value("max_fps", 60);
+    int idle_fps = ui.value("idle_fps", 5);
+    bool vsync = ui.value("vsync", true);
+    ui["max_fps"] = max_fps;
+    ui["idle_fps"] = idle_fps;
+    ui["vsync"] = vsync;
+    if (!vsync) SDL_GL_SetSwapInterval(0);
+    _pacer.set_max_fps(max_fps);
+    _pacer.set_idle_fps(idle_fps);
+    // images are asked for once per frame drawn, which can be further apart than a request lasts at a low idle rate
+    _core.set_request_interval(1000 / std::max(1, idle_fps));
+    _new_frame_event = SDL_RegisterEvents(1);
+
+    // update runs when a new arena frame or mask arrives, and at the configured rate for everything else
+    _core.set_frame_signal(&_update_signal);
+    set_update_rate(_core.get_update_rate());
+    _new_frame_event_queued = false;
+    _notified_generation = 0;
+    _drawn_generation = 0;
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -93,27 +119,8 @@ CZoomyClient::CZoomyClient(cv::Size s) {
     // OpenCV init
     _use_dashcam = false;
     _dashcam_img = cv::Mat::ones(cv::Size(20, 20), CV_8UC3);
-    _arena_img = cv::Mat::ones(cv::Size(ARENA_DIM, ARENA_DIM), CV_8UC3);
+    _dashcam_generation = 1;
     _show_preview = true;
-    bool white = true;
-    cv::Vec3b pix_white(255,255,255);
-    cv::Vec3b pix_black(0,0,0);
-    int skip = ARENA_DIM / 8.0f;
-    for (int y = 0; y < _arena_img.rows; y++) {
-        if (!(y % skip)) white = !white;
-        for (int x = 0; x < _arena_img.cols; x++) {
-            if (!(x % skip)) white = !white;
-            if (white) {
-                _arena_img.at<cv::Vec3b>(y,x) = pix_white;
-            } else {
-                _arena_img.at<cv::Vec3b>(y,x) = pix_black;
-            }
-        }
-    }
-    _arena_raw_img = _arena_img.clone();
-    _arena_mask_img = _arena_img.clone();
-    _raw_mask = _arena_img.clone();
-    _arena_warped_img = _arena_img.clone();
     _flip_image = false;
     _arena_mouse_pos = ImVec2(0, 0);
     _hsv_slider_names = {
@@ -125,264 +132,88 @@ CZoomyClient::CZoomyClient(cv::Size s) {
             "Value (upper)",
             "Autonomy  speed",
     };
+    _core.get_hsv_thresholds(_hsv_low, _hsv_high);
     _pointer_hsv_thresholds = {
-            &_hsv_threshold_low[0],
-            &_hsv_threshold_high[0],
-            &_hsv_threshold_low[1],
-            &_hsv_threshold_high[1],
-            &_hsv_threshold_low[2],
-            &_hsv_threshold_high[2],
+            &_hsv_low[0],
+            &_hsv_high[0],
+            &_hsv_low[1],
+            &_hsv_high[1],
+            &_hsv_low[2],
+            &_hsv_high[2],
             &_autospeed
     };
 
-    _cam_location = 0; // 0 for local, 1 for remote
-
-    _homography_corners = {
-            cv::Point(100,100),
-            cv::Point(200,100),
-            cv::Point(200,200),
-            cv::Point(100,200)
-    };
+    _cam_location = _core.get_camera(); // 0 for local, 1 for remote
 
     _quad_points = std::vector<ImVec2>(4);
     _quad_points_scaled = std::vector<ImVec2>(4);
     _dist_quad_points = std::vector<double>(4);
 
-    // control init
-    // pass dashcam and masked arena image to autonomous
-    if (!_autonomous.init(&_dashcam_img, &_raw_mask)) {
-        spdlog::error("Error during CAutoController init.");
-        exit(-1);
-    }
-    _auto = false;
-    _step = 0;
-
     _joystick = std::vector<cv::Point>(2, cv::Point(0, 0));
+    _use_auto = false;
 
-    // waypoints
-    // check if json exists, load if so, create if not
-    std::ifstream i("waypoints.json");
-    if (!i.good()) {
-        i.close();
-        // create file wtih default waypoints
-        nlohmann::json j = {
-                // smaller rot value = ccw, larger rot value = cw
-                {"waypoints", {
-                {{"coords", {0,0}},     {"speed", 0},       {"rotation", 0},    {"enable_turret", false}},
-                {{"coords", {96,369}},  {"speed", 14000},   {"rotation", 0},    {"enable_turret", false}},
-                {{"coords", {245,450}}, {"speed", 14000},   {"rotation", 342},  {"enable_turret", false}},
-                {{"coords", {136,262}}, {"speed", 15000},   {"rotation", 90},   {"enable_turret", false}},
-                {{"coords", {137,130}}, {"speed", 14000},   {"rotation", 70},   {"enable_turret", false}},
-                {{"coords", {327,115}}, {"speed", 14000},   {"rotation", 210},  {"enable_turret", false}},
-                {{"coords", {511,147}}, {"speed", 14000},   {"rotation", 180},  {"enable_turret", false}},
-                {{"coords", {458,334}}, {"speed", 15000},   {"rotation", 270},  {"enable_turret", false}},
-                {{"coords", {578,421}}, {"speed", 14000},   {"rotation", 270},  {"enable_turret", false}},
-                {{"coords", {572,535}}, {"speed", 20000},   {"rotation", 270},  {"enable_turret", false}},
-        }}};
-
-        std::ofstream o("waypoints.json");
-        o << std::setw(4) << j << std::endl;
-        o.close();
-        i = std::ifstream("waypoints.json");
-    }
-
-    i >> _json_data;
-    for (auto it : _json_data["waypoints"]) {
-        _waypoints.push_back(CAutoController::waypoint{
-            cv::Point((int) it["coords"][0], (int) it["coords"][1]),
-            (int) it["speed"],
-            (int) it["rotation"],
-            (bool) it["enable_turret"]});
-    }
-    i.close();
-
-    // settings
-    i = std::ifstream("settings.json");
-    if (!i.good()) {
-        i.close();
-        // create file wtih default waypoints
-        nlohmann::json j = {
-                // smaller rot value = ccw, larger rot value = cw
-                {"settings", {
-                        {"networking", {
-                                {"udp", {
-                                        {"host", "192.168.1.104"},
-                                        {"port", "46188"}}
-                                        },
-                                {"tcp", {
-                                         {"host", "192.168.1.156"},
-                                         {"port", "4006"}
-                                 }}
-                        }},
-                        {"opencv", {
-                                {"hue", {8, 18}},
-                                {"sat", {122,255}},
-                                {"val", {141,255}},
-                                {"corners", {{100,100},
-                                             {100,200},
-                                             {200,200},
-                                             {200,100}}}
-                        }},
-                }}};
-        std::ofstream o("settings.json");
-        o << std::setw(4) << j << std::endl;
-        o.close();
-        i = std::ifstream("settings.json");
-    }
-
-    _json_data.clear();
-    i >> _json_data;
-    i.close();
-
-    // read in settings
-    snprintf(_host_udp,64,"%s",((std::string) _json_data["settings"]["networking"]["udp"]["host"]).c_str());
-    snprintf(_port_udp,64,"%s",((std::string) _json_data["settings"]["networking"]["udp"]["port"]).c_str());
-    snprintf(_host_tcp,64,"%s",((std::string) _json_data["settings"]["networking"]["tcp"]["host"]).c_str());
-    snprintf(_port_tcp,64,"%s",((std::string) _json_data["settings"]["networking"]["tcp"]["port"]).c_str());
-
-    _hsv_threshold_low = {_json_data["settings"]["opencv"]["hue"][0],
-                          _json_data["settings"]["opencv"]["sat"][0],
-                          _json_data["settings"]["opencv"]["val"][0]};
-
-    _hsv_threshold_high = {_json_data["settings"]["opencv"]["hue"][1],
-                           _json_data["settings"]["opencv"]["sat"][1],
-                           _json_data["settings"]["opencv"]["val"][1]};
-
-    _quad_points = {ImVec2(_json_data["settings"]["opencv"]["corners"][0][0],_json_data["settings"]["opencv"]["corners"][0][1]),
-                    ImVec2(_json_data["settings"]["opencv"]["corners"][1][0],_json_data["settings"]["opencv"]["corners"][1][1]),
-                    ImVec2(_json_data["settings"]["opencv"]["corners"][2][0],_json_data["settings"]["opencv"]["corners"][2][1]),
-                    ImVec2(_json_data["settings"]["opencv"]["corners"][3][0],_json_data["settings"]["opencv"]["corners"][3][1])};
-
-    _homography_corners = {
-            cv::Point((int) _quad_points.at(0).x,(int) _quad_points.at(0).y),
-            cv::Point((int) _quad_points.at(1).x,(int) _quad_points.at(1).y),
-            cv::Point((int) _quad_points.at(2).x,(int) _quad_points.at(2).y),
-            cv::Point((int) _quad_points.at(3).x,(int) _quad_points.at(3).y),
-    };
-
-    // preallocate texture handle
-    glGenTextures(1, &_dashcam_tex);
-    glGenTextures(1, &_arena_tex);
-    glGenTextures(1, &_preview_tex);
-
-    // net init
-    // TODO: thread network update separately from
-
-    _udp_req_ready = false;
-    _tcp_req_ready = false;
-
-    // start udp update thread
-    _thread_update_udp = std::thread(thread_update_udp, this);
-    _thread_update_udp.detach();
-
-    // start tcp update thread
-    _thread_update_tcp = std::thread(thread_update_tcp, this);
-    _thread_update_tcp.detach();
+    // settings were loaded by the core, copy addresses into the text inputs
+    snprintf(_host_udp,64,"%s",_core.get_udp_host().c_str());
+    snprintf(_port_udp,64,"%s",_core.get_udp_port().c_str());
+    snprintf(_host_tcp,64,"%s",_core.get_tcp_host().c_str());
+    snprintf(_port_tcp,64,"%s",_core.get_tcp_port().c_str());
 }
 
 CZoomyClient::~CZoomyClient() {
-    spdlog::info("Saving config...");
-
-    std::ifstream i("settings.json");
-    _json_data.clear();
-    i >> _json_data;
-    i.close();
-
-    // retrieve settings from program and save
-    _json_data["settings"]["networking"]["udp"]["host"] = _host_udp;
-    _json_data["settings"]["networking"]["udp"]["port"] = _port_udp;
-    _json_data["settings"]["networking"]["tcp"]["host"] = _host_tcp;
-    _json_data["settings"]["networking"]["tcp"]["port"] = _port_tcp;
-
-    _json_data["settings"]["opencv"]["hue"] = {_hsv_threshold_low[0], _hsv_threshold_high[0]};
-    _json_data["settings"]["opencv"]["sat"] = {_hsv_threshold_low[1], _hsv_threshold_high[1]};
-    _json_data["settings"]["opencv"]["val"] = {_hsv_threshold_low[2], _hsv_threshold_high[2]};
-
-    _json_data["settings"]["opencv"]["corners"][0] = {_quad_points.at(0).x,_quad_points.at(0).y};
-    _json_data["settings"]["opencv"]["corners"][1] = {_quad_points.at(1).x,_quad_points.at(1).y};
-    _json_data["settings"]["opencv"]["corners"][2] = {_quad_points.at(2).x,_quad_points.at(2).y};
-    _json_data["settings"]["opencv"]["corners"][3] = {_quad_points.at(3).x,_quad_points.at(3).y};
-
-    std::ofstream o("settings.json");
-    o << std::setw(4) << _json_data << std::endl;
-    o.close();
-    spdlog::info("Done");
+    // remembered even if never connected, saved with the rest of the settings when the core is destroyed
+    _core.set_udp_address(_host_udp, _port_udp);
+    _core.set_tcp_address(_host_tcp, _port_tcp);
 }
 
 void CZoomyClient::update() {
 
     if (_use_dashcam) {
+        CPerfTimer dashcam_timer(PERF_DASHCAM);
         // if video capture not set up, connect here
-        if (!_video_capture.isOpened()) {
+        if (!_dashcam_capture.is_opened()) {
             _dashcam_gst_string = "udpsrc port=5200 ! watchdog timeout=1000 ! application/x-rtp, media=video, clock-rate=90000, payload=96 ! rtpjpegdepay ! jpegdec ! videoconvert ! appsink";
             // attempt to connect to udp source, timeout at 1 second
-            _video_capture = cv::VideoCapture(_dashcam_gst_string, cv::CAP_GSTREAMER);
-        }
-
-        // if source still not opened (timeout reached), default source to videotestsrc
-        if (!_video_capture.isOpened()) {
-            spdlog::warn("Could not open gstreamer pipeline. Defaulting to videotestsrc");
-            _dashcam_gst_string = "videotestsrc ! appsink";
-            _video_capture = cv::VideoCapture(_dashcam_gst_string, cv::CAP_GSTREAMER);
-        }
-
-        _video_capture.read(_dashcam_raw_img);
-
-        if (_flip_image) cv::rotate(_dashcam_raw_img, _dashcam_raw_img, cv::ROTATE_180);
-
-        if (!_dashcam_raw_img.empty()) {
-            _detector_params = cv::aruco::DetectorParameters();
-            _dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
-            _detector.setDetectorParameters(_detector_params);
-            _detector.setDictionary(_dictionary);
-            _detector.detectMarkers(_dashcam_raw_img, _marker_corners, _marker_ids, _rejected_candidates);
-        }
-        if (!_dashcam_raw_img.empty()) cv::aruco::drawDetectedMarkers(_dashcam_raw_img, _marker_corners, _marker_ids);
-        _dashcam_img = _dashcam_raw_img;
-    } else {
-        _video_capture.release();
-    }
-
-    if (!_cam_location) {
-        if (_use_local) {
-            // if video capture not set up, connect here
-            if (!_arena_capture.isOpened()) {
-                _arena_capture = cv::VideoCapture(_arena_gst_string, cv::CAP_GSTREAMER);
-            }
-
             // if source still not opened (timeout reached), default source to videotestsrc
-            if (!_arena_capture.isOpened()) {
+            if (!_dashcam_capture.open(_dashcam_gst_string)) {
                 spdlog::warn("Could not open gstreamer pipeline. Defaulting to videotestsrc");
-                _arena_gst_string = "videotestsrc ! aspectratiocrop aspect-ratio=1 ! appsink";
-                _arena_capture = cv::VideoCapture(_arena_gst_string, cv::CAP_GSTREAMER);
+                _dashcam_gst_string = "videotestsrc ! appsink";
+                _dashcam_capture.open(_dashcam_gst_string);
             }
+        }
 
-            // crop incoming arena image so it is 1:1 aspect ratio
-            cv::Mat temp;
-            cv::Size temp_size;
-            cv::Rect roi;
-            _arena_capture.read(temp);
-            temp_size.height = temp.rows;
-            temp_size.width = temp.cols;
-            roi.x = (temp_size.width / 2) / 2;
-            roi.y = 0;
-            roi.width = temp_size.width - ((temp_size.width / 2) / 2);
-            roi.height = temp_size.height;
-
-            _arena_raw_img = temp(roi).clone();
-//            if (_flip_image) cv::rotate(_dashcam_raw_img, _dashcam_raw_img, cv::ROTATE_180);
-        } else {
-            _arena_capture.release();
+        // markers are drawn on the image, so it is copied out of the gstreamer buffer, rotated on the way if flipped
+        // each frame gets a buffer of its own from the pool, the one being drawn is never written to here
+        // no new frame means nothing new to show, the last one stays up
+        cv::Mat frame;
+        if (_dashcam_capture.read(frame)) {
+            cv::Mat image;
+            if (_flip_image) {
+                cv::rotate(frame, image, cv::ROTATE_180);
+            } else {
+                frame.copyTo(image);
+            }
+            frame.release();
+
+            // detector is configured once, only searches around known markers between full scans
+            _marker_tracker.detect(image, _marker_corners, _marker_ids);
+            cv::aruco::drawDetectedMarkers(image, _marker_corners, _marker_ids);
+            _mutex_dashcam.lock();
+            _dashcam_img = image;
+            _dashcam_generation++;
+            _mutex_dashcam.unlock();
         }
+    } else {
+        _dashcam_capture.release();
     }
 
     // calculate values for homography
     // make vector of points for quad
+    std::vector<cv::Point> corners = _core.get_corners();
     _quad_points = {
-            ImVec2((float) _homography_corners.at(0).x, (float) _homography_corners.at(0).y),
-            ImVec2((float) _homography_corners.at(1).x, (float) _homography_corners.at(1).y),
-            ImVec2((float) _homography_corners.at(2).x, (float) _homography_corners.at(2).y),
-            ImVec2((float) _homography_corners.at(3).x, (float) _homography_corners.at(3).y)
+            ImVec2((float) corners.at(0).x, (float) corners.at(0).y),
+            ImVec2((float) corners.at(1).x, (float) corners.at(1).y),
+            ImVec2((float) corners.at(2).x, (float) corners.at(2).y),
+            ImVec2((float) corners.at(3).x, (float) corners.at(3).y)
     };
 
     // get scale between real arena image and imgui texture dimensions
@@ -405,82 +236,48 @@ void CZoomyClient::update() {
     auto it = std::min_element(std::begin(_dist_quad_points), std::end(_dist_quad_points));
     _closest_quad_point = (int) std::distance(std::begin(_dist_quad_points),it);
 
-    cv::Mat image_to_warp = _arena_raw_img.clone();
-    std::vector<cv::Point2f> end = {cv::Point2f(0, 0), cv::Point2f(ARENA_DIM, 0), cv::Point2f(ARENA_DIM, ARENA_DIM),
-                                    cv::Point2f(0, ARENA_DIM)};
-    cv::Mat arena_homography = cv::findHomography(_homography_corners, end);
-    cv::warpPerspective(image_to_warp, image_to_warp, arena_homography, cv::Size(ARENA_DIM, ARENA_DIM));
-    _arena_warped_img = image_to_warp.clone();
-
-    // select region to mask
-    cv::Mat pregen = _show_homography ? _arena_warped_img.clone() : _arena_raw_img.clone();
-    cv::Mat hsv, inrange, mask, anded;
-
-    cv::cvtColor(pregen, hsv, cv::COLOR_BGR2HSV);
-    cv::inRange(hsv, (cv::Scalar) _hsv_threshold_low, (cv::Scalar) _hsv_threshold_high ,inrange);
-    inrange.convertTo(mask, CV_8UC1);
-    cv::bitwise_and(pregen, pregen, anded, mask);
-
-    // copy raw mask to buffer for autonomous
-    _raw_mask = mask.clone();
-
-    // update mask shown to UI
-    if (_show_mask) _arena_mask_img = anded.clone();
-
     // handle controller events for auto control
-    if (_values.at(value_type::GC_Y) && !_demo) _use_auto = true;
-    if (_values.at(value_type::GC_B)) _use_auto = false;
-
-    // handle gui events for auto control
-    if (_use_auto) {
-        // only enable auto if not already disabled
-        if (!_auto) {
-            _auto = true;
-            _step = 0;
-        }
-    } else {
-        // only disable auto if already enabled
-        if (_auto) {
-            _auto = false;
-            _values.at(value_type::GC_A) = 0;
-            _autonomous.endAutoTarget();
-            _autonomous.endRunToPoint();
-        }
-    }
+    if (_core.values().at(value_type::GC_Y) && !_demo) _use_auto = true;
+    if (_core.values().at(value_type::GC_B)) _use_auto = false;
 
-    _values.at(value_type::GC_X) = _relation;
+    _core.values().at(value_type::GC_X) = _relation;
 
-    // update last known car position if auto enabled
-    if (_auto) {
-        _last_car_pos.x = (float) _autonomous.get_car().x;
-        _last_car_pos.y = (float) _autonomous.get_car().y;
-    }
+    // mask whatever is shown, the masked image is only produced while it is on screen
+    _core.set_use_auto(_use_auto);
+    _core.set_mask_options(_show_homography);
+    _core.update();
 
-    if (!_autonomous.isRunning() && _auto) {
-        switch (_step) {
-            case 0:
-                _step++;
-                break;
-            default:
-                if (_step < _waypoints.size()) {
-                    _autonomous.startRunToPoint(_waypoints.at(_step).coordinates, _waypoints.at(_step).speed);
-                    _values.at(value_type::GC_LTRIG) = _waypoints.at(_step).rotation;
-                    _values.at(value_type::GC_A) = _waypoints.at(_step).turret;
-                    _step++;
-                } else {
-                    _auto = false;
-                }
-                break;
-        }
+    // wake the draw loop for new camera frames, it sleeps until then
+    uint64_t generation = get_frame_generation();
+    if (generation != _notified_generation && !_new_frame_event_queued.exchange(true)) {
+        _notified_generation = generation;
+        SDL_Event e{};
+        e.type = _new_frame_event;
+        SDL_PushEvent(&e);
     }
 }
 
+uint64_t CZoomyClient::get_frame_generation() {
+    // warp and mask are redone every update, only new source frames change what they show
+    std::lock_guard<std::mutex> lock(_mutex_dashcam);
+    return _core.arena_source().latest_generation() + _dashcam_generation;
+}
+
 void CZoomyClient::draw() {
+    // sleep until the next frame is due, input or a new camera frame wakes this up early
+    bool has_event = SDL_WaitEventTimeout(&_evt, _pacer.get_wait_ms(std::chrono::steady_clock::now()));
+
     float delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _deltaTime).count() / 18.0;
     _deltaTime = std::chrono::steady_clock::now();
     // handle all events
-    while (SDL_PollEvent(&_evt)) {
+    CPerfTimer events_timer(PERF_EVENTS);
+    for (; has_event; has_event = SDL_PollEvent(&_evt)) {
+        if (_evt.type == _new_frame_event) {
+            _new_frame_event_queued = false;
+            continue;
+        }
         ImGui_ImplSDL2_ProcessEvent(&_evt);
+        _pacer.request_frames(INPUT_SETTLE_FRAMES);
         switch (_evt.type) {
             case SDL_QUIT:
                 spdlog::info("Quit");
@@ -494,10 +291,10 @@ void CZoomyClient::draw() {
                 break;
             case SDL_CONTROLLERBUTTONDOWN:
             case SDL_CONTROLLERBUTTONUP:
-                //_values.at(value_type::GC_A) = SDL_GameControllerGetButton(_gc, SDL_CONTROLLER_BUTTON_A);
-                //_values.at(value_type::GC_B) = SDL_GameControllerGetButton(_gc, SDL_CONTROLLER_BUTTON_B);
-                //_values.at(value_type::GC_X) = SDL_GameControllerGetButton(_gc, SDL_CONTROLLER_BUTTON_X);
-                //_values.at(value_type::GC_Y) = SDL_GameControllerGetButton(_gc, SDL_CONTROLLER_BUTTON_Y);
+                //_core.values().at(value_type::GC_A) = SDL_GameControllerGetButton(_gc, SDL_CONTROLLER_BUTTON_A);
+                //_core.values().at(value_type::GC_B) = SDL_GameControllerGetButton(_gc, SDL_CONTROLLER_BUTTON_B);
+                //_core.values().at(value_type::GC_X) = SDL_GameControllerGetButton(_gc, SDL_CONTROLLER_BUTTON_X);
+                //_core.values().at(value_type::GC_Y) = SDL_GameControllerGetButton(_gc, SDL_CONTROLLER_BUTTON_Y);
                 break;
             case SDL_CONTROLLERAXISMOTION:
                 _joystick[0].x = SDL_GameControllerGetAxis(_gc, SDL_CONTROLLER_AXIS_LEFTX);
@@ -507,19 +304,19 @@ void CZoomyClient::draw() {
 
                 if (hypot(_joystick[0].x, _joystick[0].y) > DEADZONE) {
                     if (_demo) {
-                        _values.at(value_type::GC_LEFTX) = _joystick[0].x * DEMO_SPEED;
-                        _values.at(value_type::GC_LEFTY) = _joystick[0].y * DEMO_SPEED;
+                        _core.values().at(value_type::GC_LEFTX) = _joystick[0].x * DEMO_SPEED;
+                        _core.values().at(value_type::GC_LEFTY) = _joystick[0].y * DEMO_SPEED;
                     }
                     else {
-                        _values.at(value_type::GC_LEFTX) = _joystick[0].x;
-                        _values.at(value_type::GC_LEFTY) = _joystick[0].y;
+                        _core.values().at(value_type::GC_LEFTX) = _joystick[0].x;
+                        _core.values().at(value_type::GC_LEFTY) = _joystick[0].y;
                     }
-                } else if (_auto) {
-                    _values.at(value_type::GC_LEFTX) = _autonomous.getAutoInput(CAutoController::MOVE_X);
-                    _values.at(value_type::GC_LEFTY) = _autonomous.getAutoInput(CAutoController::MOVE_Y);
+                } else if (_core.is_auto()) {
+                    _core.values().at(value_type::GC_LEFTX) = _core.get_auto_input(CAutoController::MOVE_X);
+                    _core.values().at(value_type::GC_LEFTY) = _core.get_auto_input(CAutoController::MOVE_Y);
                 } else {
-                    _values.at(value_type::GC_LEFTX) = 0;
-                    _values.at(value_type::GC_LEFTY) = 0;
+                    _core.values().at(value_type::GC_LEFTX) = 0;
+                    _core.values().at(value_type::GC_LEFTY) = 0;
                 }
 
                 if (_angle > 360.0)
@@ -534,22 +331,22 @@ void CZoomyClient::draw() {
                     else
                         _angle += delta * _joystick[1].x / 32768.0;
                     // nevermind, doesn't look that bad
-                    _values.at(value_type::GC_RIGHTX) = _joystick[1].x;
-                    _values.at(value_type::GC_RIGHTY) = _joystick[1].y;
-                } else if (_auto) {
-                    _values.at(value_type::GC_RIGHTX) = _autonomous.getAutoInput(CAutoController::ROTATE);
-                    _values.at(value_type::GC_RIGHTY) = 0;
+                    _core.values().at(value_type::GC_RIGHTX) = _joystick[1].x;
+                    _core.values().at(value_type::GC_RIGHTY) = _joystick[1].y;
+                } else if (_core.is_auto()) {
+                    _core.values().at(value_type::GC_RIGHTX) = _core.get_auto_input(CAutoController::ROTATE);
+                    _core.values().at(value_type::GC_RIGHTY) = 0;
                 } else if (!_relation) {
-                    _values.at(value_type::GC_RIGHTX) = SDL_GameControllerGetAxis(_gc, SDL_CONTROLLER_AXIS_RIGHTX);
-                    _values.at(value_type::GC_RIGHTY) = 0;
+                    _core.values().at(value_type::GC_RIGHTX) = SDL_GameControllerGetAxis(_gc, SDL_CONTROLLER_AXIS_RIGHTX);
+                    _core.values().at(value_type::GC_RIGHTY) = 0;
                 } else {
-                    _values.at(value_type::GC_RIGHTX) = 0;
-                    _values.at(value_type::GC_RIGHTY) = 0;
+                    _core.values().at(value_type::GC_RIGHTX) = 0;
+                    _core.values().at(value_type::GC_RIGHTY) = 0;
                 }
 
-                _values.at(value_type::GC_RTRIG) = SDL_GameControllerGetAxis(_gc, SDL_CONTROLLER_AXIS_TRIGGERRIGHT);
-                if (!_auto) {
-                    _values.at(value_type::GC_LTRIG) = _angle;
+                _core.values().at(value_type::GC_RTRIG) = SDL_GameControllerGetAxis(_gc, SDL_CONTROLLER_AXIS_TRIGGERRIGHT);
+                if (!_core.is_auto()) {
+                    _core.values().at(value_type::GC_LTRIG) = _angle;
                 }
                 break;
             default:
@@ -557,10 +354,33 @@ void CZoomyClient::draw() {
         }
     }
 
-    // if viewport is minimized, don't draw
-    if (SDL_GetWindowFlags(_window->get_native_window()) & SDL_WINDOW_MINIMIZED) return;
+    events_timer.stop();
+
+    // draw slowly while in the background, the laptop is likely on battery
+    Uint32 window_flags = SDL_GetWindowFlags(_window->get_native_window());
+    _pacer.set_idle(!(window_flags & SDL_WINDOW_INPUT_FOCUS) || (window_flags & SDL_WINDOW_MINIMIZED));
+
+    // if viewport is minimized, don't draw, but still wait an idle interval before looking again
+    if (window_flags & SDL_WINDOW_MINIMIZED) {
+        auto now = std::chrono::steady_clock::now();
+        if (_pacer.should_draw(now)) _pacer.skipped(now);
+        return;
+    }
+
+    // only draw when something changed, or for the periodic refresh that keeps the stats moving
+    uint64_t generation = get_frame_generation();
+    if (generation != _drawn_generation) {
+        _drawn_generation = generation;
+        _pacer.request_frames();
+    }
+    auto frame_start = std::chrono::steady_clock::now();
+    if (!_pacer.should_draw(frame_start)) return;
+    _pacer.drawn(frame_start);
+    // only frames that are drawn are timed, draw() otherwise mostly waits for events
+    CPerfTimer draw_timer(PERF_DRAW);
 
     ImGuiIO &io = ImGui::GetIO();
+    CPerfTimer ui_timer(PERF_UI);
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplSDL2_NewFrame();
     ImGui::NewFrame();
@@ -574,8 +394,10 @@ void CZoomyClient::draw() {
     imgui_draw_debug();
 
     ImGui::Render();
+    ui_timer.stop();
 
     // render ImGui with OpenGL
+    CPerfTimer render_timer(PERF_RENDER);
     glViewport(0, 0, (int) io.DisplaySize.x, (int) io.DisplaySize.y);
     glClearColor(0.5F, 0.5F, 0.5F, 1.00F);
     glClear(GL_COLOR_BUFFER_BIT);
@@ -591,29 +413,26 @@ void CZoomyClient::draw() {
 //    }
 
     SDL_GL_SwapWindow(_window->get_native_window());
-
-    // limit to 1000 FPS
-    while ((int) std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::steady_clock::now() - _perf_draw_start).count() < 1);
+    render_timer.stop();
 }
 
 void CZoomyClient::imgui_draw_settings() {
     ImGui::Begin("Settings", nullptr);
     // camera settings
     ImGui::SeparatorText("Camera");
-    ImGui::BeginDisabled(_use_local);
+    ImGui::BeginDisabled(_core.is_local_camera_open());
     ImGui::RadioButton("Local", &_cam_location, 0); ImGui::SameLine();
     ImGui::RadioButton("Remote", &_cam_location, 1);
     ImGui::EndDisabled();
+    _core.set_camera(_cam_location);
     if (!_cam_location) {
         static char gst_string[64] = "avfvideosrc device-index=1 ! appsink";
         ImGui::PushItemWidth(-FLT_MIN);
         ImGui::Text("GStreamer string:");
-        ImGui::BeginDisabled(_use_local);
+        ImGui::BeginDisabled(_core.is_local_camera_open());
         ImGui::InputText("###gst_string", gst_string, 64);
         if (ImGui::Button("Open GStreamer camera")) {
-            _arena_gst_string = gst_string;
-            _use_local = true;
+            _core.open_local_camera(gst_string);
         }
         ImGui::EndDisabled();
         ImGui::PopItemWidth();
@@ -664,7 +483,7 @@ void CZoomyClient::imgui_draw_settings() {
     ImGui::BeginGroup();
 
     // draw udp conn details table
-    ImGui::BeginDisabled(_udp_req_ready);
+    ImGui::BeginDisabled(_core.is_udp_requested());
     ImGui::BeginTable("##udp_item_table", 2, ImGuiTableFlags_SizingFixedFit);
     ImGui::TableSetupColumn("##udp_item_title", ImGuiTableColumnFlags_WidthFixed);
     ImGui::TableSetupColumn("##udp_item_value", ImGuiTableColumnFlags_WidthStretch);
@@ -688,9 +507,8 @@ void CZoomyClient::imgui_draw_settings() {
 
     ImGui::PushItemWidth(-FLT_MIN);
     if (ImGui::Button("Connect to UDP")) {
-        _udp_host = _host_udp;
-        _udp_port = _port_udp;
-        _udp_req_ready = true;
+        _core.set_udp_address(_host_udp, _port_udp);
+        _core.connect_udp();
     }
     ImGui::PopItemWidth();
     ImGui::EndDisabled();
@@ -698,7 +516,7 @@ void CZoomyClient::imgui_draw_settings() {
     // if use remote camera
     if (_cam_location) {
         // draw tcp conn details table
-        ImGui::BeginDisabled(_tcp_req_ready);
+        ImGui::BeginDisabled(_core.is_tcp_requested());
         ImGui::BeginTable("##tcp_item_table", 2, ImGuiTableFlags_SizingFixedFit);
         ImGui::TableSetupColumn("##tcp_item_title", ImGuiTableColumnFlags_WidthFixed);
         ImGui::TableSetupColumn("##tcp_item_value", ImGuiTableColumnFlags_WidthStretch);
@@ -722,9 +540,8 @@ void CZoomyClient::imgui_draw_settings() {
 
         ImGui::PushItemWidth(-FLT_MIN);
         if (ImGui::Button("Connect to TCP")) {
-            _tcp_host = _host_tcp;
-            _tcp_port = _port_tcp;
-            _tcp_req_ready = true;
+            _core.set_tcp_address(_host_tcp, _port_tcp);
+            _core.connect_tcp();
         }
         ImGui::PopItemWidth();
         ImGui::EndDisabled();
@@ -742,10 +559,19 @@ void CZoomyClient::imgui_draw_settings() {
 
     // TODO: determine maximum number of values to send and remove stringstream
     std::stringstream ss;
-    for (auto &i: _values) {
+    for (auto &i: _core.values()) {
         ss << i << " ";
     }
     ImGui::Text("%s", ("Values to be sent: " + ss.str()).c_str());
+    CZoomyCore::net_stats net = _core.get_net_stats();
+    ImGui::Text("Control packets: %s", net.udp_binary ? "binary v1" : "text");
+    ImGui::Text("Arena feed: %s", net.tcp_streaming ? "streaming" : "polling");
+    const char *reductions[] = {"Full", "1/2", "1/4", "1/8"};
+    int reduction_index = 0;
+    while ((1 << reduction_index) < _core.get_decode_reduction()) reduction_index++;
+    if (ImGui::Combo("Remote resolution", &reduction_index, reductions, IM_ARRAYSIZE(reductions))) {
+        _core.set_decode_reduction(1 << reduction_index);
+    }
 
     // opencv parameters
     ImGui::SeparatorText("OpenCV");
@@ -775,6 +601,7 @@ void CZoomyClient::imgui_draw_settings() {
     }
     ImGui::EndTable();
     ImGui::EndGroup();
+    _core.set_hsv_thresholds(_hsv_low, _hsv_high);
 
     ImGui::End();
 }
@@ -791,7 +618,7 @@ void CZoomyClient::imgui_draw_waypoints() {
         int wp_id = 0;  // keep track of current waypoint
         char label[32];
         bool was_hovered = false;   // remember if row inside table was hovered
-        for (auto &i: _waypoints) {
+        for (auto &i: _core.waypoints()) {
             snprintf(label, 32, "##waypoint_%d", wp_id);
             ImGui::PushID(label);
             ImGui::TableNextRow();
@@ -841,7 +668,7 @@ void CZoomyClient::imgui_draw_dashcam() {
     }
 
     _mutex_dashcam.lock();
-    fit_texture_to_window(_dashcam_img, _dashcam_tex);
+    fit_texture_to_window(_dashcam_img, _dashcam_generation, _dashcam_tex);
     _mutex_dashcam.unlock();
 
     ImGui::End();
@@ -852,7 +679,7 @@ void CZoomyClient::imgui_draw_arena() {
     ImGui::Begin("Arena", nullptr, ImGuiWindowFlags_MenuBar);
 
     if (ImGui::BeginMenuBar()) {
-        ImGui::BeginDisabled(_arena_raw_img.empty());
+        ImGui::BeginDisabled(_core.arena_source().latest_generation() == 0);
         ImGui::Checkbox("Mask", &_show_mask);
         ImGui::Checkbox("Waypoints", &_show_waypoints);
         ImGui::Checkbox("Homography", &_show_homography);
@@ -861,19 +688,20 @@ void CZoomyClient::imgui_draw_arena() {
         ImGui::EndMenuBar();
     }
 
-    // copy out latest arena image
-    if (_show_mask) {
-        _mutex_mask_gen.lock();
-        _arena_img = _arena_mask_img.clone();
-        _mutex_mask_gen.unlock();
-    } else if (_show_homography) {
-        _arena_img = _arena_warped_img.clone();
-    } else {
-        _arena_img = _arena_raw_img.clone();
-    }
+    // only what is on screen is produced, nothing is asked for while minimized since this isn't drawn then
+    // warped frames are shown full size, or in the minimap while the corners are being set
+    if (_show_mask) _core.request(CZoomyCore::PRODUCT_MASK_PREVIEW);
+    if (_show_homography || (_show_preview && !_core.is_auto())) _core.request(CZoomyCore::PRODUCT_WARPED);
+
+    // pin latest arena images, no copies needed while they are pinned
+    CFrameRing &warped_ring = _core.arena_warped();
+    CFrameRing &shown_ring = _show_mask ? _core.arena_mask() : _show_homography ? warped_ring : _core.arena_source();
+    shown_ring.acquire(FR_DRAW);
+    warped_ring.acquire(FR_DRAW);
 
     // fit arena texture to window size
-    fit_texture_to_window(_arena_img, _arena_tex, _arena_scale_factor, _arena_last_cursor_pos);
+    fit_texture_to_window(shown_ring.view(FR_DRAW), shown_ring.generation(FR_DRAW), _arena_tex, _arena_scale_factor,
+                          _arena_last_cursor_pos);
 
     if (ImGui::IsItemHovered()) {
         // get position of cursor relative to actual image size
@@ -905,12 +733,12 @@ void CZoomyClient::imgui_draw_arena() {
             }
 
             // convert imgui quad coords to opencv coords for imgproc
-            _homography_corners = {
+            _core.set_corners({
                     cv::Point((int) _quad_points.at(0).x,(int) _quad_points.at(0).y),
                     cv::Point((int) _quad_points.at(1).x,(int) _quad_points.at(1).y),
                     cv::Point((int) _quad_points.at(2).x,(int) _quad_points.at(2).y),
                     cv::Point((int) _quad_points.at(3).x,(int) _quad_points.at(3).y),
-            };
+            });
         }
     }
 
@@ -932,18 +760,16 @@ void CZoomyClient::imgui_draw_arena() {
 //        }
 
 
-        if (!_auto && _show_preview) {
+        if (!_core.is_auto() && _show_preview) {
             // minimap for homography preview
             ImGuiWindowFlags window_flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav;
             ImVec2 window_pos = _arena_last_cursor_pos;
             ImGui::SetNextWindowPos(window_pos, ImGuiCond_Always, ImVec2(0.0f,0.0f));
             window_flags |= ImGuiWindowFlags_NoMove;
             ImGui::SetNextWindowBgAlpha(0.35f);
-            cv::Mat copied = _arena_warped_img.clone();
-            mat_to_tex(copied, _preview_tex);
-            copied.release();
+            _preview_tex.update(warped_ring.view(FR_DRAW), warped_ring.generation(FR_DRAW));
             if (ImGui::Begin("Homography preview", nullptr, window_flags)) {
-                ImGui::Image((ImTextureID) (intptr_t) _preview_tex, ImVec2(ARENA_DIM / 10.0f, ARENA_DIM / 10.0f));
+                ImGui::Image((ImTextureID) (intptr_t) _preview_tex.get_texture(), ImVec2(ARENA_DIM / 10.0f, ARENA_DIM / 10.0f));
                 ImGui::End();
             }
             ImGui::SetNextWindowBgAlpha(1.0f);
@@ -954,7 +780,7 @@ void CZoomyClient::imgui_draw_arena() {
         // plot waypoints in ImGui instead of OpenCV
         int wp = 0; // keep track of which waypoint plotted
         ImGui::GetWindowDrawList()->ChannelsSplit(2);
-        for (auto &i: _waypoints) {
+        for (auto &i: _core.waypoints()) {
             ImGui::GetWindowDrawList()->ChannelsSetCurrent(1);
 
             // modify waypoint coords to fit on image
@@ -989,15 +815,17 @@ void CZoomyClient::imgui_draw_arena() {
     }
 
     // show auto points in imgui
-    if (_auto) {
+    if (_core.is_auto()) {
         // show car position
-        ImVec2 pt_ctr = ImVec2(((float) _last_car_pos.x / _coord_scale) + _arena_last_cursor_pos.x,
-                               ((float) _last_car_pos.y / _coord_scale) + _arena_last_cursor_pos.y);
+        cv::Point car = _core.get_car();
+        ImVec2 pt_ctr = ImVec2(((float) car.x / _coord_scale) + _arena_last_cursor_pos.x,
+                               ((float) car.y / _coord_scale) + _arena_last_cursor_pos.y);
         ImGui::GetWindowDrawList()->AddCircleFilled(pt_ctr, 10, ImColor(
                 ImVec4(0.0f, 1.0f, 0.0f, 1.0f)));
         // show next point
-        pt_ctr = ImVec2(((float) _autonomous.get_destination().x / _coord_scale) + _arena_last_cursor_pos.x,
-                        ((float) _autonomous.get_destination().y / _coord_scale) + _arena_last_cursor_pos.y);
+        cv::Point destination = _core.get_destination();
+        pt_ctr = ImVec2(((float) destination.x / _coord_scale) + _arena_last_cursor_pos.x,
+                        ((float) destination.y / _coord_scale) + _arena_last_cursor_pos.y);
         ImGui::GetWindowDrawList()->AddCircleFilled(pt_ctr, 10, ImColor(
                 ImVec4(0.0f, 0.0f, 1.0f, 1.0f)));
     }
@@ -1016,180 +844,136 @@ void CZoomyClient::imgui_draw_debug() {
                 _dist_quad_points.at(2),
                 _dist_quad_points.at(3));
     ImGui::Text("Closest to: %d", _closest_quad_point + 1);
-//    ImGui::Text("Viewport %f %f", ImGui::GetMainViewport()->Size.x, ImGui::GetMainViewport()->Size.y);
-//    ImGui::SeparatorText("OpenCV Build Information");
-//    ImGui::Text("%s", cv::getBuildInformation().c_str());
-    ImGui::ShowDemoWindow();
-
-    ImGui::End();
-}
-
-void CZoomyClient::udp_rx() {
-    _udp_rx_bytes = 0;
-    _udp_rx_buf.clear();
-    _udp_client.do_rx(_udp_rx_buf, _udp_rx_bytes);
-    std::vector<uint8_t> temp(_udp_rx_buf.begin(), _udp_rx_buf.begin() + _udp_rx_bytes);
-    // only add to udp_rx queue if data is not empty and not ping response
-    if (!temp.empty() && (temp.front() != '\6')) _udp_rx_queue.emplace(temp);
-    std::this_thread::sleep_until(std::chrono::system_clock::now() + std::chrono::milliseconds(1));
-}
-
-void CZoomyClient::udp_tx() {
-    for (; !_udp_tx_queue.empty(); _udp_tx_queue.pop()) {
-//        spdlog::info("Sending" + std::string(_udp_tx_queue.front().begin(), _udp_tx_queue.front().end()));
-        _udp_client.do_tx(_udp_tx_queue.front());
-    }
-    std::this_thread::sleep_until(std::chrono::system_clock::now() + std::chrono::milliseconds(NET_DELAY));
-}
-
-void CZoomyClient::update_udp() {
-    if (!_udp_client.get_socket_status()) {
-        if (_udp_req_ready) {
-            _udp_client.ping();
-            _udp_client.setup(_udp_host, _udp_port);
-
-            _udp_timeout_count = std::chrono::steady_clock::now();
-            _udp_send_data = _udp_client.get_socket_status();
-
-            // start listen thread
-            _thread_udp_rx = std::thread(thread_udp_rx, this);
-            _thread_udp_rx.detach();
-
-            // start send thread
-            _thread_udp_tx = std::thread(thread_udp_tx, this);
-            _thread_udp_tx.detach();
-        }
-        std::this_thread::sleep_until(std::chrono::system_clock::now() + std::chrono::milliseconds(NET_DELAY));
-    } else {
-        for (; !_udp_rx_queue.empty(); _udp_rx_queue.pop()) {
-            // acknowledge next data in queue
-            spdlog::info("New in RX queue with size: " + std::to_string(_udp_rx_queue.front().size()));
-
-            // reset timeout
-            // placement of this may be a source of future bug
-            _udp_timeout_count = std::chrono::steady_clock::now();
-        }
-        // do stuff...
-        std::string payload;
-        for (auto &i: _values) {
-            payload += std::to_string(i) + " ";
+    ImGui::SeparatorText("Pipeline");
+    for (int st = 0; st < CZoomyCore::STAGE_COUNT; st++) {
+        CZoomyCore::stage_stats stats = _core.get_stage_stats((CZoomyCore::stage) st);
+        ImGui::Text("%s: %lu, %.2f ms avg", CZoomyCore::get_stage_name((CZoomyCore::stage) st),
+                    (unsigned long) stats.count, stats.count ? (double) stats.total_us / 1000.0 / (double) stats.count : 0.0);
+        // the busiest stage sets the frame rate of the whole pipeline
+        if (stats.occupancy >= 0) {
+            ImGui::SameLine();
+            ImGui::Text(", %.0f%% busy", stats.occupancy * 100.0);
         }
-
-        _udp_tx_queue.emplace(payload.begin(), payload.end());
-        spdlog::info("Last response time (ms): " + std::to_string(_udp_client.get_last_response_time()));
-        std::this_thread::sleep_until(std::chrono::system_clock::now() + std::chrono::milliseconds(NET_DELAY));
-    }
-}
-
-void CZoomyClient::thread_update_udp(CZoomyClient *who_called) {
-    while (!who_called->_do_exit) {
-        who_called->update_udp();
-    }
-}
-
-void CZoomyClient::thread_udp_rx(CZoomyClient *who_called) {
-    while (who_called->_udp_client.get_socket_status()) {
-        who_called->udp_rx();
-    }
-}
-
-void CZoomyClient::thread_udp_tx(CZoomyClient *who_called) {
-    while (who_called->_udp_client.get_socket_status()) {
-        who_called->udp_tx();
     }
-}
-
-void CZoomyClient::tcp_rx() {
-    _tcp_rx_bytes = 0;
-    _tcp_rx_buf.clear();
-    _tcp_client.do_rx(_tcp_rx_buf, _tcp_rx_bytes);
-    std::vector<uint8_t> temp(_tcp_rx_buf.begin(), _tcp_rx_buf.begin() + _tcp_rx_bytes);
-    // only add to tcp_rx queue if data is not empty and not ping response
-    if (!temp.empty() && (temp.front() != '\6')) _tcp_rx_queue.emplace(temp);
-    // don't check for new packets too often
-    std::this_thread::sleep_until(std::chrono::system_clock::now() + std::chrono::milliseconds(TCP_DELAY));
-
-}
-
-void CZoomyClient::tcp_tx() {
-    for (; !_tcp_tx_queue.empty(); _tcp_tx_queue.pop()) {
-//        spdlog::info("Sending" + std::string(_tcp_tx_queue.front().begin(), _tcp_tx_queue.front().end()));
-        _tcp_client.do_tx(_tcp_tx_queue.front());
-    }
-    std::this_thread::sleep_until(std::chrono::system_clock::now() + std::chrono::milliseconds(TCP_DELAY));
-}
-
-void CZoomyClient::update_tcp() {
-    if (!_tcp_client.get_socket_status()) {
-        if (_tcp_req_ready) {
-            _tcp_client.setup(_tcp_host, _tcp_port);
-            _tcp_send_data = _tcp_client.get_socket_status();
-
-            // start listen thread
-            _thread_tcp_rx = std::thread(thread_tcp_rx, this);
-            _thread_tcp_rx.detach();
-
-            // start send thread
-            _thread_tcp_tx = std::thread(thread_tcp_tx, this);
-            _thread_tcp_tx.detach();
-        }
-        std::this_thread::sleep_until(std::chrono::system_clock::now() + std::chrono::milliseconds(NET_DELAY));
-    } else {
-        for (; !_tcp_rx_queue.empty(); _tcp_rx_queue.pop()) {
-//            // acknowledge next data in queue
-            spdlog::info("New in RX queue with size: " + std::to_string(_tcp_rx_queue.front().size()));
-            cv::imdecode(_tcp_rx_queue.front(), cv::IMREAD_UNCHANGED, &_arena_raw_img);
+    CZoomyCore::net_stats net = _core.get_net_stats();
+    ImGui::SeparatorText("Network queues");
+    ImGui::Text("UDP TX: %zu queued, %lu dropped", net.udp_tx_queued, (unsigned long) net.udp_tx_dropped);
+    ImGui::Text("UDP RX: %zu queued, %lu dropped", net.udp_rx_queued, (unsigned long) net.udp_rx_dropped);
+    ImGui::Text("TCP TX: %zu queued, %lu dropped", net.tcp_tx_queued, (unsigned long) net.tcp_tx_dropped);
+    ImGui::Text("TCP RX: %zu queued, %lu dropped", net.tcp_rx_queued, (unsigned long) net.tcp_rx_dropped);
+    ImGui::Text("Pool exhausted: UDP %lu, TCP %lu", (unsigned long) net.udp_pool_exhausted,
+                (unsigned long) net.tcp_pool_exhausted);
+    ImGui::Text("Arena frame: %u, %lu missed, %lu resyncs", net.arena_seq, (unsigned long) net.arena_missed,
+                (unsigned long) net.arena_resyncs);
+    ImGui::Text("Arena decode: %.1f ms avg, %.1f ms last", net.decode_avg_ms, net.decode_last_ms);
+    ImGui::Text("Arena decode: %lu decoded, %lu skipped, %lu failed", (unsigned long) net.decoded,
+                (unsigned long) net.decode_skipped, (unsigned long) net.decode_failed);
+    ImGui::SeparatorText("Frame pool");
+    // heap allocations should stop climbing once every frame size has been seen
+    CFramePool::stats pool = CFramePool::instance().get_stats();
+    ImGui::Text("%lu heap allocations, %lu reused, %lu freed", (unsigned long) pool.heap_allocations,
+                (unsigned long) pool.reused, (unsigned long) pool.freed);
+    ImGui::Text("%.1f MB in use, %.1f MB pooled", (double) pool.live_bytes / 1048576.0,
+                (double) pool.pooled_bytes / 1048576.0);
+    ImGui::SeparatorText("Threads");
+    ImGui::Text("%.1f FPS%s", _pacer.get_fps(), _pacer.is_idle() ? ", idle" : "");
+    ImGui::Text("Update: %.0f/s, %.0f%% busy", get_update_rate(), get_update_duty_cycle() * 100.0);
+
+    ImGui::SeparatorText("Session log");
+    ImGui::Text("%lu records, %lu dropped", (unsigned long) net.log_written, (unsigned long) net.log_dropped);
+
+    // capture to command latency over a rolling window, compared against a snapshot from LATENCY_WINDOW seconds ago
+    std::vector<CPerfStats::snapshot> latency;
+    for (int id: PERF_LATENCY) latency.push_back(CPerfStats::get_snapshot(id));
+    auto now = std::chrono::steady_clock::now();
+    if (_latency_history.empty() || now - _latency_history_time >= std::chrono::seconds(1)) {
+        _latency_history.push_back(latency);
+        _latency_history_time = now;
+        if (_latency_history.size() > LATENCY_WINDOW) _latency_history.pop_front();
+    }
+    ImGui::SeparatorText("Latency from capture");
+    if (ImGui::BeginTable("##latency_table", 5,
+                          (ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders))) {
+        ImGui::TableSetupColumn("Reached##latency_stage", ImGuiTableColumnFlags_WidthStretch);
+        ImGui::TableSetupColumn("p50 ms##latency_p50", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableSetupColumn("p90 ms##latency_p90", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableSetupColumn("p99 ms##latency_p99", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableSetupColumn("Max ms##latency_max", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableHeadersRow();
+        for (int i = 0; i < (int) latency.size(); i++) {
+            CPerfStats::snapshot s = latency.at(i).since(_latency_history.front().at(i));
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            // stage names are "latency.<where>"
+            ImGui::Text("%s", s.name.substr(s.name.find('.') + 1).c_str());
+            if (!s.count) continue;
+            ImGui::TableSetColumnIndex(1);
+            ImGui::Text("%.1f", (double) s.percentile(50) / 1000.0);
+            ImGui::TableSetColumnIndex(2);
+            ImGui::Text("%.1f", (double) s.percentile(90) / 1000.0);
+            ImGui::TableSetColumnIndex(3);
+            ImGui::Text("%.1f", (double) s.percentile(99) / 1000.0);
+            ImGui::TableSetColumnIndex(4);
+            ImGui::Text("%.1f", (double) s.max_us / 1000.0);
         }
-        std::string payload = "G 1";
-        _tcp_tx_queue.emplace(payload.begin(), payload.end());
-        std::this_thread::sleep_until(std::chrono::system_clock::now() + std::chrono::milliseconds(TCP_DELAY));
-    }
-}
-
-void CZoomyClient::thread_update_tcp(CZoomyClient *who_called) {
-    while (!who_called->_do_exit) {
-        who_called->update_tcp();
+        ImGui::EndTable();
     }
-}
 
-void CZoomyClient::thread_tcp_rx(CZoomyClient *who_called) {
-    while (who_called->_tcp_client.get_socket_status()) {
-        who_called->tcp_rx();
+    ImGui::SeparatorText("Performance");
+    if (ImGui::Button("Reset##perf_reset")) _perf_baseline = CPerfStats::get_snapshots();
+    ImGui::SameLine();
+    if (ImGui::Button("Save snapshot##perf_save")) {
+        // always the totals since start, reset only affects what is shown here
+        char name[64];
+        std::time_t now = std::time(nullptr);
+        std::strftime(name, sizeof(name), "perf-%Y%m%d-%H%M%S.json", std::localtime(&now));
+        CPerfStats::dump(name);
     }
-}
-
-void CZoomyClient::thread_tcp_tx(CZoomyClient *who_called) {
-    while (who_called->_tcp_client.get_socket_status()) {
-        who_called->tcp_tx();
+    if (ImGui::BeginTable("##perf_table", 5,
+                          (ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders))) {
+        ImGui::TableSetupColumn("Stage##perf_stage", ImGuiTableColumnFlags_WidthStretch);
+        ImGui::TableSetupColumn("Count##perf_count", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableSetupColumn("p50 ms##perf_p50", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableSetupColumn("p99 ms##perf_p99", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableSetupColumn("Max ms##perf_max", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableHeadersRow();
+        std::vector<CPerfStats::snapshot> perf = CPerfStats::get_snapshots();
+        for (int i = 0; i < (int) perf.size(); i++) {
+            CPerfStats::snapshot s = i < (int) _perf_baseline.size() ? perf.at(i).since(_perf_baseline.at(i))
+                                                                     : perf.at(i);
+            if (!s.count) continue;
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            ImGui::Text("%s", s.name.c_str());
+            ImGui::TableSetColumnIndex(1);
+            ImGui::Text("%lu", (unsigned long) s.count);
+            ImGui::TableSetColumnIndex(2);
+            ImGui::Text("%.3f", (double) s.percentile(50) / 1000.0);
+            ImGui::TableSetColumnIndex(3);
+            ImGui::Text("%.3f", (double) s.percentile(99) / 1000.0);
+            ImGui::TableSetColumnIndex(4);
+            ImGui::Text("%.3f", (double) s.max_us / 1000.0);
+        }
+        ImGui::EndTable();
     }
-}
-
-void CZoomyClient::mat_to_tex(cv::Mat &input, GLuint &output) {
-    if (input.empty()) return;
-    cv::Mat flipped;
-    // might crash here if input array is somehow emptied
-    cv::cvtColor(input, flipped, cv::COLOR_BGR2RGB);
-
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
-                    GL_CLAMP_TO_EDGE); // This is required on WebGL for non power-of-two textures
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); // Same
+//    ImGui::Text("Viewport %f %f", ImGui::GetMainViewport()->Size.x, ImGui::GetMainViewport()->Size.y);
+//    ImGui::SeparatorText("OpenCV Build Information");
+//    ImGui::Text("%s", cv::getBuildInformation().c_str());
+    ImGui::ShowDemoWindow();
 
-    glBindTexture(GL_TEXTURE_2D, output);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, input.cols, input.rows, 0, GL_RGB, GL_UNSIGNED_BYTE, flipped.data);
+    ImGui::End();
 }
 
 // only call this from inside imgui window
-void CZoomyClient::fit_texture_to_window(cv::Mat &input_image, GLuint &output_texture, float &scale,
+void CZoomyClient::fit_texture_to_window(const cv::Mat &input_image, uint64_t generation,
+                                         CTextureStreamer &output_texture, float &scale,
                                          ImVec2 &cursor_screen_pos_before_image) {
     // from https://www.reddit.com/r/opengl/comments/114lxvr/imgui_viewport_texture_not_fitting_scaling_to/
     ImVec2 viewport_size = ImGui::GetContentRegionAvail();
     float ratio = ((float) input_image.cols) / ((float) input_image.rows);
     float viewport_ratio = viewport_size.x / viewport_size.y;
-    mat_to_tex(input_image, output_texture);
+    // only uploads if this frame is not already in the texture
+    output_texture.update(input_image, generation);
 
     // Scale the image horizontally if the content region is wider than the image
     if (viewport_ratio > ratio) {
@@ -1197,7 +981,7 @@ void CZoomyClient::fit_texture_to_window(cv::Mat &input_image, GLuint &output_te
         float xPadding = (viewport_size.x - imageWidth) / 2;
         ImGui::SetCursorPosX(ImGui::GetCursorPosX() + xPadding);
         cursor_screen_pos_before_image = ImGui::GetCursorScreenPos();
-        ImGui::Image((ImTextureID) (intptr_t) output_texture, ImVec2(imageWidth, viewport_size.y));
+        ImGui::Image((ImTextureID) (intptr_t) output_texture.get_texture(), ImVec2(imageWidth, viewport_size.y));
         scale = imageWidth;
     }
     // Scale the image vertically if the content region is taller than the image
@@ -1206,16 +990,17 @@ void CZoomyClient::fit_texture_to_window(cv::Mat &input_image, GLuint &output_te
         float yPadding = (viewport_size.y - imageHeight) / 2;
         ImGui::SetCursorPosY(ImGui::GetCursorPosY() + yPadding);
         cursor_screen_pos_before_image = ImGui::GetCursorScreenPos();
-        ImGui::Image((ImTextureID) (intptr_t) output_texture, ImVec2(viewport_size.x, imageHeight));
+        ImGui::Image((ImTextureID) (intptr_t) output_texture.get_texture(), ImVec2(viewport_size.x, imageHeight));
         scale = imageHeight;
     }
 }
 
 // only call this from inside imgui window
-void CZoomyClient::fit_texture_to_window(cv::Mat &input_image, GLuint &output_texture) {
+void CZoomyClient::fit_texture_to_window(const cv::Mat &input_image, uint64_t generation,
+                                         CTextureStreamer &output_texture) {
     float dont_care_float;
     ImVec2 dont_care_imvec;
-    fit_texture_to_window(input_image, output_texture, dont_care_float, dont_care_imvec);
+    fit_texture_to_window(input_image, generation, output_texture, dont_care_float, dont_care_imvec);
 }
 
 int main(int argc, char *argv[]) {
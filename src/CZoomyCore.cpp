@@ -0,0 +1,1153 @@
+/**
+ * CZoomyCore.cpp - vision, control and networking pipeline without any UI
+ * 2024-06-22
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CZoomyCore.hpp"
+
+#define PING_TIMEOUT 1000
+#define NET_DELAY 35
+#define WARP_CACHE_PATH "warp_cache.bin"
+
+// increase this value if malloc_error_break happens too often
+#define TCP_DELAY 30
+//#define TCP_DELAY 15 // only if over ssh forwarding
+#define STREAM_WINDOW 4         // frames the server may send ahead of the client
+#define STREAM_CREDIT_BATCH 2   // frames to finish before telling the server
+#define LOG_RECORD_SIZE 64
+#define PIPELINE_POLL 16        // ms between pipeline checks for changed settings while no frames arrive
+#define REQUEST_TIMEOUT 500     // ms a derived image is kept up to date after it was last asked for, at least
+
+static const int PERF_CAPTURE = CPerfStats::add_stage("core.capture");
+static const int PERF_WARP = CPerfStats::add_stage("core.warp");
+static const int PERF_MASK = CPerfStats::add_stage("core.mask");
+static const int PERF_AUTO = CPerfStats::add_stage("core.auto");
+static const int PERF_UDP_SEND = CPerfStats::add_stage("net.udp_send");
+static const int PERF_UDP_RX = CPerfStats::add_stage("net.udp_rx");
+static const int PERF_TCP_RX = CPerfStats::add_stage("net.tcp_rx");
+static const int PERF_TCP_PROCESS = CPerfStats::add_stage("net.tcp_process");
+static const int PERF_TCP_UPDATE = CPerfStats::add_stage("net.tcp_update");
+
+// time from an arena frame being captured to each point it reaches
+static const int PERF_LATENCY_WARPED = CPerfStats::add_stage("latency.warped");
+static const int PERF_LATENCY_MASKED = CPerfStats::add_stage("latency.masked");
+static const int PERF_LATENCY_COMMAND = CPerfStats::add_stage("latency.command");
+
+CZoomyCore::CZoomyCore(cv::Mat *car) : _warp(ARENA_DIM) {
+    // every frame buffer after this comes from the pool
+    CFramePool::install();
+
+    _values = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        _stage_count[i] = 0;
+        _stage_us[i] = 0;
+    }
+
+    // OpenCV init
+    _arena_img = cv::Mat::ones(cv::Size(ARENA_DIM, ARENA_DIM), CV_8UC3);
+    bool white = true;
+    cv::Vec3b pix_white(255,255,255);
+    cv::Vec3b pix_black(0,0,0);
+    int skip = ARENA_DIM / 8.0f;
+    for (int y = 0; y < _arena_img.rows; y++) {
+        if (!(y % skip)) white = !white;
+        for (int x = 0; x < _arena_img.cols; x++) {
+            if (!(x % skip)) white = !white;
+            if (white) {
+                _arena_img.at<cv::Vec3b>(y,x) = pix_white;
+            } else {
+                _arena_img.at<cv::Vec3b>(y,x) = pix_black;
+            }
+        }
+    }
+    // seed every stage with the placeholder so there is something to show, never captured so it has no age
+    _arena_img.copyTo(_arena_local_ring.begin_write());
+    _arena_local_ring.publish(std::chrono::steady_clock::time_point());
+    _arena_img.copyTo(_arena_remote_ring.begin_write());
+    _arena_remote_ring.publish(std::chrono::steady_clock::time_point());
+    _arena_img.copyTo(_arena_warped_ring.begin_write());
+    _arena_warped_ring.publish(std::chrono::steady_clock::time_point());
+    _arena_img.copyTo(_arena_mask_ring.begin_write());
+    _arena_mask_ring.publish(std::chrono::steady_clock::time_point());
+
+    _cam_location = 0; // 0 for local, 1 for remote
+    _use_local = false;
+    _mask_warped = false;
+    for (auto &r: _requested) r = 0;
+    _request_timeout = REQUEST_TIMEOUT;
+    _rectify_source = nullptr;
+    _localize_camera = false;
+    _frame_signal = nullptr;
+    spdlog::info("HSV mask kernel: {}", _hsv_mask.get_kernel_name());
+
+    _homography_corners = {
+            cv::Point(100,100),
+            cv::Point(200,100),
+            cv::Point(200,200),
+            cv::Point(100,200)
+    };
+
+    // control init
+    // pass dashcam and masked arena image to autonomous
+    if (!_autonomous.init(car, &_raw_mask_ring)) {
+        spdlog::error("Error during CAutoController init.");
+        exit(-1);
+    }
+    _auto = false;
+    _use_auto = false;
+    _step = 0;
+
+    load_waypoints();
+    load_settings();
+    open_session_log();
+
+    // reuse warp tables from last session, only rebuilt if corners were changed outside the program
+    _warp.load(WARP_CACHE_PATH);
+    _warp.set_corners(_homography_corners);
+
+    // each vision stage wakes when the ring it reads from gets a new frame
+    // masking may read either raw ring or the warped one, so it listens to all three
+    _arena_local_ring.add_signal(&_rectify_stage.signal());
+    _arena_remote_ring.add_signal(&_rectify_stage.signal());
+    _arena_local_ring.add_signal(&_segment_stage.signal());
+    _arena_remote_ring.add_signal(&_segment_stage.signal());
+    _arena_warped_ring.add_signal(&_segment_stage.signal());
+    _capture_stage.start([this] { return step_capture(); }, std::chrono::milliseconds(PIPELINE_POLL));
+    _rectify_stage.start([this] { return step_rectify(); }, std::chrono::milliseconds(PIPELINE_POLL));
+    _segment_stage.start([this] { return step_segment(); }, std::chrono::milliseconds(PIPELINE_POLL));
+
+    // net init
+    _udp_req_ready = false;
+    _tcp_req_ready = false;
+    _udp_connecting = false;
+    _tcp_connecting = false;
+    _tcp_subscribed = false;
+    _tcp_frames_done = 0;
+    _tcp_credits_returned = 0;
+    _arena_remote_seq_valid = false;
+    _arena_remote_seq = 0;
+    _arena_remote_capture_us = 0;
+    _arena_remote_missed = 0;
+
+    // all network updates and sends run on the reactor thread, received data is handed to it as soon as it arrives
+    // only connecting, which blocks, runs on threads of its own and hands the connection back to the reactor
+    _net_reactor.add_timer(std::chrono::milliseconds(NET_DELAY), [this] { update_udp(); });
+    _net_reactor.add_timer(std::chrono::milliseconds(TCP_DELAY), [this] { update_tcp(); });
+    _net_reactor.start();
+    _arena_decoder.start();
+}
+
+CZoomyCore::~CZoomyCore() {
+    // downstream first, so no stage is left waiting on one that has already stopped
+    _segment_stage.stop();
+    _rectify_stage.stop();
+    _capture_stage.stop();
+    _net_reactor.stop();
+    // a connect still in progress posts to the stopped reactor, which is harmless, but it has to finish first
+    if (_thread_udp_connect.joinable()) _thread_udp_connect.join();
+    if (_thread_tcp_connect.joinable()) _thread_tcp_connect.join();
+    _arena_decoder.stop();
+    _autonomous.endAutoTarget();
+    _autonomous.endRunToPoint();
+    _session_log.close();
+
+    spdlog::info("Saving config...");
+    save_settings();
+    _warp.save(WARP_CACHE_PATH);
+    spdlog::info("Done");
+}
+
+void CZoomyCore::load_waypoints() {
+    // check if json exists, load if so, create if not
+    std::ifstream i("waypoints.json");
+    if (!i.good()) {
+        i.close();
+        // create file wtih default waypoints
+        nlohmann::json j = {
+                // smaller rot value = ccw, larger rot value = cw
+                {"waypoints", {
+                {{"coords", {0,0}},     {"speed", 0},       {"rotation", 0},    {"enable_turret", false}},
+                {{"coords", {96,369}},  {"speed", 14000},   {"rotation", 0},    {"enable_turret", false}},
+                {{"coords", {245,450}}, {"speed", 14000},   {"rotation", 342},  {"enable_turret", false}},
+                {{"coords", {136,262}}, {"speed", 15000},   {"rotation", 90},   {"enable_turret", false}},
+                {{"coords", {137,130}}, {"speed", 14000},   {"rotation", 70},   {"enable_turret", false}},
+                {{"coords", {327,115}}, {"speed", 14000},   {"rotation", 210},  {"enable_turret", false}},
+                {{"coords", {511,147}}, {"speed", 14000},   {"rotation", 180},  {"enable_turret", false}},
+                {{"coords", {458,334}}, {"speed", 15000},   {"rotation", 270},  {"enable_turret", false}},
+                {{"coords", {578,421}}, {"speed", 14000},   {"rotation", 270},  {"enable_turret", false}},
+                {{"coords", {572,535}}, {"speed", 20000},   {"rotation", 270},  {"enable_turret", false}},
+        }}};
+
+        std::ofstream o("waypoints.json");
+        o << std::setw(4) << j << std::endl;
+        o.close();
+        i = std::ifstream("waypoints.json");
+    }
+
+    i >> _json_data;
+    for (auto it : _json_data["waypoints"]) {
+        _waypoints.push_back(CAutoController::waypoint{
+            cv::Point((int) it["coords"][0], (int) it["coords"][1]),
+            (int) it["speed"],
+            (int) it["rotation"],
+            (bool) it["enable_turret"]});
+    }
+    i.close();
+}
+
+void CZoomyCore::load_settings() {
+    // check if json exists, load if so, create if not
+    std::ifstream i("settings.json");
+    if (!i.good()) {
+        i.close();
+        // create file wtih default waypoints
+        nlohmann::json j = {
+                // smaller rot value = ccw, larger rot value = cw
+                {"settings", {
+                        {"networking", {
+                                {"udp", {
+                                        {"host", "192.168.1.104"},
+                                        {"port", "46188"},
+                                        {"protocol", "auto"}}
+                                        },
+                                {"tcp", {
+                                         {"host", "192.168.1.156"},
+                                         {"port", "4006"},
+                                         {"mode", "auto"},
+                                         {"decode_reduction", 1}
+                                 }}
+                        }},
+                        {"log", {
+                                {"enabled", true},
+                                {"path", "sessions"},
+                                {"max_mb", 64}
+                        }},
+                        {"update", {
+                                {"rate_hz", 60}
+                        }},
+                        {"autonomy", {
+                                {"rate_hz", 200}
+                        }},
+                        {"opencv", {
+                                {"hue", {8, 18}},
+                                {"sat", {122,255}},
+                                {"val", {141,255}},
+                                {"pyramid_level", 2},
+                                {"localize", "arena"},
+                                {"corners", {{100,100},
+                                             {100,200},
+                                             {200,200},
+                                             {200,100}}}
+                        }},
+                }}};
+        std::ofstream o("settings.json");
+        o << std::setw(4) << j << std::endl;
+        o.close();
+        i = std::ifstream("settings.json");
+    }
+
+    _json_data.clear();
+    i >> _json_data;
+    i.close();
+
+    // read in settings
+    _udp_host = _json_data["settings"]["networking"]["udp"]["host"];
+    _udp_port = _json_data["settings"]["networking"]["udp"]["port"];
+    _tcp_host = _json_data["settings"]["networking"]["tcp"]["host"];
+    _tcp_port = _json_data["settings"]["networking"]["tcp"]["port"];
+
+    // settings files from before the binary protocol don't have this, default to negotiating
+    _udp_packet.set_format(CControlPacket::format_from_string(
+            _json_data["settings"]["networking"]["udp"].value("protocol", "auto")));
+    _tcp_stream.set_mode(CFrameStream::mode_from_string(
+            _json_data["settings"]["networking"]["tcp"].value("mode", "auto")));
+    _arena_decoder.set_reduction(_json_data["settings"]["networking"]["tcp"].value("decode_reduction", 1));
+
+    // older settings files have no log section, log by default
+    nlohmann::json log = _json_data["settings"].value("log", nlohmann::json::object());
+    _log_enabled = log.value("enabled", true);
+    _log_path = log.value("path", "sessions");
+    _log_max_mb = std::max(1, log.value("max_mb", 64));
+    _ui_settings = _json_data["settings"].value("ui", nlohmann::json::object());
+    _update_rate = std::max(0, _json_data["settings"].value("update", nlohmann::json::object()).value("rate_hz", 60));
+    _autonomous.setControlRate(_json_data["settings"].value("autonomy", nlohmann::json::object()).value("rate_hz", 200));
+
+    _hsv_threshold_low = {_json_data["settings"]["opencv"]["hue"][0],
+                          _json_data["settings"]["opencv"]["sat"][0],
+                          _json_data["settings"]["opencv"]["val"][0]};
+
+    _hsv_threshold_high = {_json_data["settings"]["opencv"]["hue"][1],
+                           _json_data["settings"]["opencv"]["sat"][1],
+                           _json_data["settings"]["opencv"]["val"][1]};
+
+    // older settings files have no pyramid level, find the car on a quarter size mask by default
+    _pyramid_mask.set_level(_json_data["settings"]["opencv"].value("pyramid_level", 2));
+    // localizing in camera space is opt in until it has been tried on the table
+    _localize_camera = _json_data["settings"]["opencv"].value("localize", "arena") == "camera";
+
+    // corners are saved as floats by older versions
+    for (int c = 0; c < 4; c++) {
+        _homography_corners.at(c) = cv::Point((int) (float) _json_data["settings"]["opencv"]["corners"][c][0],
+                                              (int) (float) _json_data["settings"]["opencv"]["corners"][c][1]);
+    }
+}
+
+void CZoomyCore::open_session_log() {
+    _logged_auto_input[0] = _logged_auto_input[1] = _logged_auto_input[2] = 0;
+    _logged_car = _logged_destination = cv::Point(-1, -1);
+    _logged_rtt = -1;
+    if (!_log_enabled) return;
+
+    std::error_code ec;
+    std::filesystem::create_directories(_log_path, ec);
+    if (ec) {
+        spdlog::warn("Could not create session log directory {}: {}", _log_path, ec.message());
+        return;
+    }
+
+    // one file per run, named for when it started
+    char name[64];
+    std::time_t now = std::time(nullptr);
+    std::strftime(name, sizeof(name), "session-%Y%m%d-%H%M%S.zlog", std::localtime(&now));
+    _session_log.open((std::filesystem::path(_log_path) / name).string(),
+                      (uint64_t) _log_max_mb * 1024 * 1024 / LOG_RECORD_SIZE);
+}
+
+void CZoomyCore::save_settings() {
+    std::ifstream i("settings.json");
+    _json_data.clear();
+    i >> _json_data;
+    i.close();
+
+    // retrieve settings from program and save
+    _json_data["settings"]["networking"]["udp"]["host"] = _udp_host;
+    _json_data["settings"]["networking"]["udp"]["port"] = _udp_port;
+    _json_data["settings"]["networking"]["udp"]["protocol"] = CControlPacket::format_to_string(_udp_packet.get_format());
+    _json_data["settings"]["networking"]["tcp"]["host"] = _tcp_host;
+    _json_data["settings"]["networking"]["tcp"]["port"] = _tcp_port;
+    _json_data["settings"]["networking"]["tcp"]["mode"] = CFrameStream::mode_to_string(_tcp_stream.get_mode());
+    _json_data["settings"]["networking"]["tcp"]["decode_reduction"] = _arena_decoder.get_reduction();
+
+    _json_data["settings"]["log"]["enabled"] = _log_enabled;
+    _json_data["settings"]["log"]["path"] = _log_path;
+    _json_data["settings"]["log"]["max_mb"] = _log_max_mb;
+    _json_data["settings"]["ui"] = _ui_settings;
+    _json_data["settings"]["update"]["rate_hz"] = _update_rate;
+    _json_data["settings"]["autonomy"]["rate_hz"] = _autonomous.getControlRate();
+
+    cv::Scalar_<int> low, high;
+    get_hsv_thresholds(low, high);
+    _json_data["settings"]["opencv"]["hue"] = {low[0], high[0]};
+    _json_data["settings"]["opencv"]["sat"] = {low[1], high[1]};
+    _json_data["settings"]["opencv"]["val"] = {low[2], high[2]};
+    _json_data["settings"]["opencv"]["pyramid_level"] = _pyramid_mask.get_level();
+    _json_data["settings"]["opencv"]["localize"] = _localize_camera ? "camera" : "arena";
+
+    std::vector<cv::Point> corners = get_corners();
+    for (int c = 0; c < 4; c++) {
+        _json_data["settings"]["opencv"]["corners"][c] = {corners.at(c).x, corners.at(c).y};
+    }
+
+    std::ofstream o("settings.json");
+    o << std::setw(4) << _json_data << std::endl;
+    o.close();
+}
+
+void CZoomyCore::update() {
+    // capture, warp and mask run on the pipeline threads, only autonomy is left
+    CPerfTimer auto_timer(PERF_AUTO);
+    update_auto();
+}
+
+bool CZoomyCore::step_capture() {
+    // remote frames arrive through the decoder, nothing to do here
+    if (_cam_location) return false;
+    CPerfTimer capture_timer(PERF_CAPTURE);
+    return capture_local();
+}
+
+bool CZoomyCore::step_rectify() {
+    // warp for display, or for a mask made from warped frames, forget the source so asking again warps straight away
+    // in camera space autonomy never needs the warp
+    bool wanted = is_requested(PRODUCT_WARPED) ||
+                  (_mask_warped && ((!_localize_camera && is_requested(PRODUCT_MASK)) ||
+                                    is_requested(PRODUCT_MASK_PREVIEW)));
+    if (!wanted) {
+        _rectify_source = nullptr;
+        return false;
+    }
+
+    // pin newest raw arena frame, stays valid until the next acquire
+    CFrameRing &source = arena_source();
+    bool fresh = source.acquire(FR_UPDATE);
+    bool switched = &source != _rectify_source;
+    _rectify_source = &source;
+    const cv::Mat &arena_raw = source.view(FR_UPDATE);
+    if (arena_raw.empty()) return false;
+
+    // homography and remap tables are only rebuilt when the corners move
+    bool moved = _warp.set_corners(get_corners());
+    if (!fresh && !switched && !moved) return false;
+
+    // warp straight into the next free slot, no intermediate copies
+    CPerfTimer warp_timer(PERF_WARP);
+    std::chrono::steady_clock::time_point captured = source.captured(FR_UPDATE);
+    _warp.apply(arena_raw, _arena_warped_ring.begin_write());
+    _arena_warped_ring.publish(captured);
+    count_stage(STAGE_WARP, warp_timer.stop());
+    if (fresh) record_latency(PERF_LATENCY_WARPED, captured);
+    return true;
+}
+
+bool CZoomyCore::step_segment() {
+    bool view_warped = _mask_warped;
+    bool want_mask = is_requested(PRODUCT_MASK);
+    bool preview = is_requested(PRODUCT_MASK_PREVIEW);
+
+    // in camera space autonomy masks the raw frame and only the car's position is warped
+    bool mask_warped = view_warped && !_localize_camera;
+    if (_localize_camera) {
+        std::vector<cv::Point> corners = get_corners();
+        if (corners != _segment_corners) {
+            cv::Mat h = CWarpEngine::find_homography(corners, ARENA_DIM);
+            if (!h.empty()) _autonomous.setOverheadTransform(h, ARENA_DIM);
+            _segment_corners = corners;
+            // the region is redrawn for the next frame, and the current one masked again with it
+            _arena_region.release();
+            _segment_mask_input.source = nullptr;
+        }
+    }
+
+    // lookup table is only rebuilt when the sliders move
+    cv::Scalar_<int> low, high;
+    get_hsv_thresholds(low, high);
+    bool rebuilt = _hsv_mask.set_thresholds(low, high);
+
+    // a preview of the same frame is made in the same pass, otherwise (e.g. a warped one while autonomy masks raw frames)
+    // in its own. raw frames are read through a reader id of their own so the warp isn't disturbed
+    // forget the source of whatever isn't asked for, so asking again masks straight away
+    bool preview_separate = preview && (!want_mask || view_warped != mask_warped);
+    bool worked = false;
+    if (want_mask) {
+        worked |= segment(mask_warped ? _arena_warped_ring : arena_source(), mask_warped ? FR_UPDATE : FR_SEGMENT,
+                          true, preview && !preview_separate, rebuilt, _segment_mask_input);
+    } else {
+        _segment_mask_input.source = nullptr;
+    }
+    if (preview_separate) {
+        worked |= segment(view_warped ? _arena_warped_ring : arena_source(), view_warped ? FR_UPDATE : FR_SEGMENT,
+                          false, true, rebuilt, _segment_preview_input);
+    } else {
+        _segment_preview_input.source = nullptr;
+    }
+    return worked;
+}
+
+bool CZoomyCore::segment(CFrameRing &input, int reader, bool for_autonomy, bool preview, bool rebuilt,
+                         segment_input &last) {
+    bool fresh = input.acquire(reader);
+    bool switched = &input != last.source;
+    last.source = &input;
+    const cv::Mat &pregen = input.view(reader);
+    if (pregen.empty()) return false;
+
+    // check the lookup table against opencv on debug builds
+#ifndef NDEBUG
+    if (rebuilt) _hsv_mask.verify(pregen);
+#endif
+    if (!fresh && !switched && !rebuilt && preview == last.preview) return false;
+    last.preview = preview;
+
+    CPerfTimer mask_timer(PERF_MASK);
+    std::chrono::steady_clock::time_point captured = input.captured(reader);
+    if (!for_autonomy) {
+        _hsv_mask.apply(pregen, _segment_preview_mask, &_arena_mask_ring.begin_write());
+        _arena_mask_ring.publish(captured);
+        count_stage(STAGE_MASK, mask_timer.stop());
+        return true;
+    }
+
+    // the raw frame shows more than the table, anything orange off it mustn't be taken for the car
+    static const cv::Mat no_region;
+    bool camera_space = _localize_camera && &input != &_arena_warped_ring;
+    if (camera_space && _arena_region.size() != pregen.size()) {
+        _arena_region.create(pregen.size(), CV_8UC1);
+        _arena_region.setTo(cv::Scalar(0));
+        std::vector<std::vector<cv::Point>> outline = {_segment_corners};
+        cv::fillPoly(_arena_region, outline, cv::Scalar(255));
+    }
+    const cv::Mat &region = camera_space ? _arena_region : no_region;
+
+    // write raw mask for autonomous and, if shown, masked image for UI in a single pass
+    // the preview has to be masked everywhere, without one only the car needs full resolution
+    cv::Mat &mask = _raw_mask_ring.begin_write();
+    if (preview) {
+        _hsv_mask.apply(pregen, mask, &_arena_mask_ring.begin_write());
+        _arena_mask_ring.publish(captured);
+        if (!region.empty()) cv::bitwise_and(mask, region, mask);
+    } else {
+        _pyramid_mask.apply(_hsv_mask, pregen, mask, region);
+    }
+    _raw_mask_ring.publish(captured);
+    count_stage(STAGE_MASK, mask_timer.stop());
+
+    // moving the corners warps the same frame again, only count each capture once
+    if (captured != last.captured) record_latency(PERF_LATENCY_MASKED, captured);
+    last.captured = captured;
+    return true;
+}
+
+bool CZoomyCore::capture_local() {
+    if (_use_local) {
+        // if video capture not set up, connect here
+        if (!_arena_capture.is_opened()) {
+            // opening waits for a first frame, the UI must not wait behind it to set a new pipeline
+            std::string gst_string;
+            {
+                std::lock_guard<std::mutex> lock(_mutex_capture);
+                gst_string = _arena_gst_string;
+            }
+
+            // if source could not be opened (no frame before the timeout), default source to videotestsrc
+            if (!_arena_capture.open(gst_string)) {
+                spdlog::warn("Could not open gstreamer pipeline. Defaulting to videotestsrc");
+                std::string fallback = "videotestsrc ! aspectratiocrop aspect-ratio=1 ! appsink";
+                {
+                    // keep a pipeline the UI set while this one was failing
+                    std::lock_guard<std::mutex> lock(_mutex_capture);
+                    if (_arena_gst_string == gst_string) _arena_gst_string = fallback;
+                }
+                _arena_capture.open(fallback);
+            }
+        }
+
+        // the frame is the gstreamer buffer itself, released as soon as the crop is copied out of it
+        cv::Mat frame;
+        std::chrono::steady_clock::time_point captured;
+        if (!_arena_capture.read(frame, &captured)) return false;
+
+        // crop incoming arena image so it is 1:1 aspect ratio
+        cv::Size temp_size;
+        cv::Rect roi;
+        temp_size.height = frame.rows;
+        temp_size.width = frame.cols;
+        roi.x = (temp_size.width / 2) / 2;
+        roi.y = 0;
+        roi.width = temp_size.width - ((temp_size.width / 2) / 2);
+        roi.height = temp_size.height;
+
+        frame(roi).copyTo(_arena_local_ring.begin_write());
+        _arena_local_ring.publish(captured);
+        return true;
+    } else {
+        _arena_capture.release();
+    }
+    return false;
+}
+
+void CZoomyCore::update_auto() {
+    // handle gui events for auto control
+    if (_use_auto) {
+        // only enable auto if not already disabled
+        if (!_auto) {
+            _auto = true;
+            _step = 0;
+        }
+    } else {
+        // only disable auto if already enabled
+        if (_auto) {
+            _auto = false;
+            _values.at(value_type::GC_A) = 0;
+            _autonomous.endAutoTarget();
+            _autonomous.endRunToPoint();
+            _session_log.log_waypoint(0, 0, 0, 0, 0, false);
+        }
+    }
+
+    // autonomy is the only thing that needs the mask, keep it coming while driving
+    if (_auto) request(PRODUCT_MASK);
+
+    // update last known car position if auto enabled
+    if (_auto) {
+        _last_car_pos = _autonomous.get_car();
+
+        // this runs far more often than autonomy changes its mind, only log what changed
+        int input[3] = {get_auto_input(CAutoController::MOVE_X), get_auto_input(CAutoController::MOVE_Y),
+                        get_auto_input(CAutoController::ROTATE)};
+        if (!std::equal(input, input + 3, _logged_auto_input)) {
+            _session_log.log_auto_input(input[0], input[1], input[2]);
+            std::copy(input, input + 3, _logged_auto_input);
+        }
+        cv::Point destination = _autonomous.get_destination();
+        if (_last_car_pos != _logged_car || destination != _logged_destination) {
+            _session_log.log_car(_last_car_pos.x, _last_car_pos.y, destination.x, destination.y);
+            _logged_car = _last_car_pos;
+            _logged_destination = destination;
+        }
+    }
+
+    if (!_autonomous.isRunning() && _auto) {
+        switch (_step) {
+            case 0:
+                _step++;
+                break;
+            default:
+                if (_step < _waypoints.size()) {
+                    const CAutoController::waypoint &w = _waypoints.at(_step);
+                    // queue full, the same waypoint is tried again next update
+                    if (!_autonomous.startRunToPoint(w.coordinates, w.speed)) break;
+                    _values.at(value_type::GC_LTRIG) = w.rotation;
+                    _values.at(value_type::GC_A) = w.turret;
+                    _session_log.log_waypoint((int) _step, w.coordinates.x, w.coordinates.y, w.speed, w.rotation,
+                                              w.turret);
+                    _step++;
+                } else {
+                    _auto = false;
+                    _session_log.log_waypoint(0, 0, 0, 0, 0, false);
+                }
+                break;
+        }
+    }
+
+    // control iterations run on the autonomous thread, pick up its totals
+    _stage_count[STAGE_AUTONOMY] = _autonomous.get_iteration_count();
+    _stage_us[STAGE_AUTONOMY] = _autonomous.get_iteration_us();
+}
+
+void CZoomyCore::record_latency(int perf_stage, std::chrono::steady_clock::time_point captured) {
+    // nothing captured yet, e.g. the placeholder image
+    if (captured == std::chrono::steady_clock::time_point()) return;
+    CPerfStats::record(perf_stage, (uint64_t) std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - captured).count()));
+}
+
+void CZoomyCore::count_stage(stage s, uint64_t us) {
+    _stage_count[s].fetch_add(1, std::memory_order_relaxed);
+    _stage_us[s].fetch_add(us, std::memory_order_relaxed);
+}
+
+void CZoomyCore::set_camera(int location) {
+    _cam_location = location;
+    _rectify_stage.signal().notify();
+    _segment_stage.signal().notify();
+}
+
+int CZoomyCore::get_camera() const {
+    return _cam_location;
+}
+
+void CZoomyCore::open_local_camera(const std::string &gst_string) {
+    std::lock_guard<std::mutex> lock(_mutex_capture);
+    _arena_gst_string = gst_string;
+    _use_local = true;
+}
+
+bool CZoomyCore::is_local_camera_open() const {
+    return _use_local;
+}
+
+// raw arena frames come from local gstreamer capture or the remote tcp camera
+CFrameRing &CZoomyCore::arena_source() {
+    return _cam_location ? _arena_remote_ring : _arena_local_ring;
+}
+
+CFrameRing &CZoomyCore::arena_warped() {
+    return _arena_warped_ring;
+}
+
+CFrameRing &CZoomyCore::arena_mask() {
+    return _arena_mask_ring;
+}
+
+void CZoomyCore::set_corners(const std::vector<cv::Point> &corners) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex_corners);
+        _homography_corners = corners;
+    }
+    // rewarp straight away while the corners are dragged, not at the next poll
+    _rectify_stage.signal().notify();
+}
+
+std::vector<cv::Point> CZoomyCore::get_corners() {
+    std::lock_guard<std::mutex> lock(_mutex_corners);
+    return _homography_corners;
+}
+
+void CZoomyCore::set_mask_options(bool warped) {
+    _mask_warped = warped;
+    _rectify_stage.signal().notify();
+    _segment_stage.signal().notify();
+}
+
+void CZoomyCore::request(product p) {
+    int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    int64_t last = _requested[p].exchange(now, std::memory_order_relaxed);
+
+    // newly asked for, make it now rather than at the next poll
+    if (std::chrono::steady_clock::duration(now - last) > std::chrono::milliseconds(_request_timeout.load())) {
+        _rectify_stage.signal().notify();
+        _segment_stage.signal().notify();
+    }
+}
+
+bool CZoomyCore::is_requested(product p) const {
+    std::chrono::steady_clock::duration since(std::chrono::steady_clock::now().time_since_epoch().count() -
+                                              _requested[p].load(std::memory_order_relaxed));
+    return since <= std::chrono::milliseconds(_request_timeout.load());
+}
+
+void CZoomyCore::set_request_interval(int ms) {
+    // a request has to outlast the gap to the next one, with room for a late frame
+    _request_timeout = std::max(REQUEST_TIMEOUT, 2 * ms);
+}
+
+bool CZoomyCore::is_localizing_in_camera() const {
+    return _localize_camera;
+}
+
+void CZoomyCore::set_hsv_thresholds(const cv::Scalar_<int> &low, const cv::Scalar_<int> &high) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex_hsv);
+        if (low == _hsv_threshold_low && high == _hsv_threshold_high) return;
+        _hsv_threshold_low = low;
+        _hsv_threshold_high = high;
+    }
+    // remask the current frame while the sliders move, not at the next poll
+    _segment_stage.signal().notify();
+}
+
+void CZoomyCore::get_hsv_thresholds(cv::Scalar_<int> &low, cv::Scalar_<int> &high) {
+    std::lock_guard<std::mutex> lock(_mutex_hsv);
+    low = _hsv_threshold_low;
+    high = _hsv_threshold_high;
+}
+
+std::vector<int> &CZoomyCore::values() {
+    return _values;
+}
+
+void CZoomyCore::set_use_auto(bool enable) {
+    _use_auto = enable;
+}
+
+bool CZoomyCore::is_auto() const {
+    return _auto;
+}
+
+int CZoomyCore::get_auto_input(int type) {
+    return _autonomous.getAutoInput(type);
+}
+
+void CZoomyCore::drive_from_autonomy() {
+    if (!_auto) return;
+    _values.at(value_type::GC_LEFTX) = get_auto_input(CAutoController::MOVE_X);
+    _values.at(value_type::GC_LEFTY) = get_auto_input(CAutoController::MOVE_Y);
+    _values.at(value_type::GC_RIGHTX) = get_auto_input(CAutoController::ROTATE);
+    _values.at(value_type::GC_RIGHTY) = 0;
+}
+
+const std::vector<CAutoController::waypoint> &CZoomyCore::waypoints() const {
+    return _waypoints;
+}
+
+cv::Point CZoomyCore::get_car() const {
+    return _last_car_pos;
+}
+
+cv::Point CZoomyCore::get_destination() {
+    return _autonomous.get_destination();
+}
+
+void CZoomyCore::set_udp_address(const std::string &host, const std::string &port) {
+    _udp_host = host;
+    _udp_port = port;
+}
+
+void CZoomyCore::set_tcp_address(const std::string &host, const std::string &port) {
+    _tcp_host = host;
+    _tcp_port = port;
+}
+
+const std::string &CZoomyCore::get_udp_host() const {
+    return _udp_host;
+}
+
+const std::string &CZoomyCore::get_udp_port() const {
+    return _udp_port;
+}
+
+const std::string &CZoomyCore::get_tcp_host() const {
+    return _tcp_host;
+}
+
+const std::string &CZoomyCore::get_tcp_port() const {
+    return _tcp_port;
+}
+
+void CZoomyCore::connect_udp() {
+    _udp_req_ready = true;
+}
+
+void CZoomyCore::connect_tcp() {
+    _tcp_req_ready = true;
+}
+
+bool CZoomyCore::is_udp_requested() const {
+    return _udp_req_ready;
+}
+
+bool CZoomyCore::is_tcp_requested() const {
+    return _tcp_req_ready;
+}
+
+void CZoomyCore::set_decode_reduction(int reduction) {
+    // corners are in remote image pixels, move them with the resolution so they stay on the arena
+    int old_reduction = _arena_decoder.get_reduction();
+    _arena_decoder.set_reduction(reduction);
+    if (_cam_location) {
+        double ratio = (double) old_reduction / (double) _arena_decoder.get_reduction();
+        std::lock_guard<std::mutex> lock(_mutex_corners);
+        for (auto &c: _homography_corners) c = cv::Point((int) (c.x * ratio), (int) (c.y * ratio));
+    }
+}
+
+nlohmann::json &CZoomyCore::ui_settings() {
+    return _ui_settings;
+}
+
+// raw frames for display, masks for autonomy, which are only made while it asks for them
+void CZoomyCore::set_frame_signal(CWakeSignal *signal) {
+    for (CFrameRing *ring: {&_arena_local_ring, &_arena_remote_ring, &_raw_mask_ring}) {
+        if (_frame_signal) ring->remove_signal(_frame_signal);
+        if (signal) ring->add_signal(signal);
+    }
+    _frame_signal = signal;
+}
+
+int CZoomyCore::get_update_rate() const {
+    return _update_rate;
+}
+
+int CZoomyCore::get_decode_reduction() const {
+    return _arena_decoder.get_reduction();
+}
+
+CZoomyCore::stage_stats CZoomyCore::get_stage_stats(stage s) const {
+    // every frame published by either camera, less the placeholder each ring starts with
+    if (s == STAGE_CAPTURE) {
+        return stage_stats{_arena_local_ring.latest_generation() + _arena_remote_ring.latest_generation() - 2, 0,
+                           _capture_stage.get_occupancy()};
+    }
+
+    double occupancy = -1;
+    switch (s) {
+        case STAGE_WARP:
+            occupancy = _rectify_stage.get_occupancy();
+            break;
+        case STAGE_MASK:
+            occupancy = _segment_stage.get_occupancy();
+            break;
+        default:
+            break;
+    }
+    return stage_stats{_stage_count[s].load(std::memory_order_relaxed), _stage_us[s].load(std::memory_order_relaxed),
+                       occupancy};
+}
+
+const char *CZoomyCore::get_stage_name(stage s) {
+    switch (s) {
+        case STAGE_CAPTURE:
+            return "capture";
+        case STAGE_WARP:
+            return "warp";
+        case STAGE_MASK:
+            return "mask";
+        case STAGE_AUTONOMY:
+            return "autonomy";
+        case STAGE_UDP:
+            return "udp tx";
+        default:
+            return "?";
+    }
+}
+
+CZoomyCore::net_stats CZoomyCore::get_net_stats() const {
+    net_stats n{};
+    n.udp_tx_queued = _udp_tx_queue.size();
+    n.udp_rx_queued = _udp_rx_queue.size();
+    n.tcp_tx_queued = _tcp_tx_queue.size();
+    n.tcp_rx_queued = _tcp_rx_queue.size();
+    n.udp_tx_dropped = _udp_tx_queue.get_dropped_count();
+    n.udp_rx_dropped = _udp_rx_queue.get_dropped_count();
+    n.tcp_tx_dropped = _tcp_tx_queue.get_dropped_count();
+    n.tcp_rx_dropped = _tcp_rx_queue.get_dropped_count();
+    n.udp_pool_exhausted = _udp_packet_pool.get_exhausted_count();
+    n.tcp_pool_exhausted = _tcp_packet_pool.get_exhausted_count();
+    n.udp_binary = _udp_packet.is_binary();
+    n.tcp_streaming = _tcp_stream.is_streaming();
+    n.arena_seq = _arena_remote_seq;
+    n.arena_missed = _arena_remote_missed;
+    n.arena_resyncs = _tcp_stream.get_resync_count();
+    n.decode_avg_ms = _arena_decoder.get_average_decode_ms();
+    n.decode_last_ms = _arena_decoder.get_last_decode_ms();
+    n.decoded = _arena_decoder.get_decoded_count();
+    n.decode_skipped = _arena_decoder.get_skipped_count();
+    n.decode_failed = _arena_decoder.get_failed_count();
+    n.log_written = _session_log.get_written_count();
+    n.log_dropped = _session_log.get_dropped_count();
+    return n;
+}
+
+void CZoomyCore::udp_rx() {
+    // receive straight into a pooled buffer, or into scratch to drain the socket if every buffer is in use
+    packet *p = _udp_packet_pool.acquire();
+    packet &buf = p ? *p : _udp_rx_buf;
+    _udp_rx_bytes = 0;
+    buf.clear();
+    _udp_client.do_rx(buf, _udp_rx_bytes);
+    buf.resize(_udp_rx_bytes > 0 ? _udp_rx_bytes : 0);
+    bool received = !buf.empty();
+
+    // only add to udp_rx queue if data is not empty and not ping response
+    if (p && received && (buf.front() != '\6')) {
+        // queue is lock-free, the reactor thread is only woken up to process it
+        _udp_rx_queue.push(p);
+        _net_reactor.post([this] { udp_process_rx(); });
+    } else {
+        _udp_packet_pool.release(p);
+    }
+
+    // nothing received, don't spin if the socket doesn't block
+    if (!received) std::this_thread::sleep_until(std::chrono::system_clock::now() + std::chrono::milliseconds(1));
+}
+
+void CZoomyCore::udp_tx() {
+    for (packet *p = _udp_tx_queue.pop(); p; p = _udp_tx_queue.pop()) {
+//        spdlog::info("Sending" + std::string(p->begin(), p->end()));
+        _udp_client.do_tx(*p);
+        _udp_tx_queue.release(p);
+        _stage_count[STAGE_UDP].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void CZoomyCore::udp_process_rx() {
+    CPerfTimer t(PERF_UDP_RX);
+    for (packet *p = _udp_rx_queue.pop(); p; p = _udp_rx_queue.pop()) {
+        // acknowledge next data in queue
+        spdlog::info("New in RX queue with size: " + std::to_string(p->size()));
+
+        // switch to binary packets if the robot says it understands them
+        _udp_packet.accept_response(p->data(), p->size());
+        _udp_rx_queue.release(p);
+
+        // reset timeout
+        // placement of this may be a source of future bug
+        _udp_timeout_count = std::chrono::steady_clock::now();
+    }
+}
+
+// runs on the reactor thread every NET_DELAY
+void CZoomyCore::update_udp() {
+    // the rest of setting up waits for the connect thread to hand the connection back
+    if (_udp_connecting) return;
+    if (!_udp_client.get_socket_status()) {
+        if (_udp_req_ready) {
+            // connecting can block for seconds, sends from the other timers must not wait behind it
+            if (_thread_udp_connect.joinable()) _thread_udp_connect.join();
+            _udp_connecting = true;
+            _thread_udp_connect = std::thread(thread_udp_connect, this, _udp_host, _udp_port);
+        }
+    } else {
+        // robot went quiet after switching, it may have been replaced by one running old firmware
+        if (_udp_packet.is_binary() && std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - _udp_timeout_count).count() > PING_TIMEOUT) {
+            _udp_packet.fall_back();
+        }
+
+        // encode into reused buffer, text or binary depending on what the robot supports
+        CPerfTimer send_timer(PERF_UDP_SEND);
+        const std::vector<uint8_t> &payload = _udp_packet.encode(_values);
+        _session_log.log_control(_values, _udp_packet.is_binary());
+        packet *p = _udp_packet_pool.acquire();
+        if (p) {
+            p->assign(payload.begin(), payload.end());
+            _udp_tx_queue.push(p);
+        }
+
+        // send right away instead of waiting for a tx thread to wake up
+        udp_tx();
+        send_timer.stop();
+
+        // age of the frame the autonomous controller last steered from, as the robot receives it
+        if (_auto) record_latency(PERF_LATENCY_COMMAND, _autonomous.getInputCaptured());
+        long rtt = _udp_client.get_last_response_time();
+        if (rtt != _logged_rtt) {
+            _session_log.log_rtt(rtt);
+            _logged_rtt = rtt;
+        }
+        spdlog::info("Last response time (ms): " + std::to_string(rtt));
+    }
+}
+
+void CZoomyCore::udp_connected() {
+    _udp_timeout_count = std::chrono::steady_clock::now();
+    _udp_send_data = _udp_client.get_socket_status();
+
+    // start listen thread
+    _thread_udp_rx = std::thread(thread_udp_rx, this);
+    _thread_udp_rx.detach();
+    _udp_connecting = false;
+}
+
+void CZoomyCore::thread_udp_connect(CZoomyCore *who_called, std::string host, std::string port) {
+    who_called->_udp_client.ping();
+    who_called->_udp_client.setup(host, port);
+    who_called->_net_reactor.post([who_called] { who_called->udp_connected(); });
+}
+
+void CZoomyCore::thread_udp_rx(CZoomyCore *who_called) {
+    while (who_called->_udp_client.get_socket_status()) {
+        who_called->udp_rx();
+    }
+}
+
+void CZoomyCore::tcp_rx() {
+    _tcp_rx_bytes = 0;
+    _tcp_rx_buf.clear();
+    _tcp_client.do_rx(_tcp_rx_buf, _tcp_rx_bytes);
+    std::chrono::steady_clock::time_point arrived = std::chrono::steady_clock::now();
+    size_t received = std::min(_tcp_rx_buf.size(), (size_t) std::max(0L, _tcp_rx_bytes));
+
+    // time reassembly only, the read itself mostly waits for the server
+    CPerfTimer reassembly_timer(PERF_TCP_RX);
+
+    // a read can end part way through a frame or hold several, the stream puts them back together
+    _tcp_stream.feed(_tcp_rx_buf.data(), received);
+    bool queued = false;
+    while (_tcp_stream.has_frame()) {
+        // no buffer free, the frame still has to be taken out of the stream
+        packet *p = _tcp_packet_pool.acquire();
+        _tcp_stream.take_frame(p);
+        if (p) {
+            // the frame's age starts here, the server's capture time is on a different clock
+            _tcp_packet_pool.stamp(p, arrived);
+            // queue is lock-free, the reactor thread is only woken up to process it
+            _tcp_rx_queue.push(p);
+            queued = true;
+        }
+    }
+    if (queued) _net_reactor.post([this] { tcp_process_rx(); });
+    reassembly_timer.stop();
+
+    // nothing received, don't spin if the socket doesn't block
+    if (!received) std::this_thread::sleep_until(std::chrono::system_clock::now() + std::chrono::milliseconds(1));
+}
+
+void CZoomyCore::tcp_tx() {
+    for (packet *p = _tcp_tx_queue.pop(); p; p = _tcp_tx_queue.pop()) {
+//        spdlog::info("Sending" + std::string(p->begin(), p->end()));
+        _tcp_client.do_tx(*p);
+        _tcp_tx_queue.release(p);
+    }
+}
+
+void CZoomyCore::tcp_process_rx() {
+    CPerfTimer t(PERF_TCP_PROCESS);
+    for (packet *p = _tcp_rx_queue.pop(); p; p = _tcp_rx_queue.pop()) {
+//            // acknowledge next data in queue
+        spdlog::info("New in RX queue with size: " + std::to_string(p->size()));
+
+        // streamed frames carry a header, polled frames are a bare jpeg
+        CFrameStream::header h{};
+        size_t offset = 0;
+        if (CFrameStream::parse_header(p->data(), p->size(), h)) {
+            // gaps in the sequence are frames dropped on either side, a jump backwards is a restarted server
+            uint32_t gap = h.sequence - _arena_remote_seq - 1;
+            if (_arena_remote_seq_valid && gap < 0x80000000u) _arena_remote_missed += gap;
+            _arena_remote_seq_valid = true;
+            _arena_remote_seq = h.sequence;
+            _arena_remote_capture_us = h.capture_us;
+            offset = CFrameStream::HEADER_SIZE;
+            // only pushed frames take up the window, polls answered after subscribing must not earn the server credits
+            _tcp_frames_done++;
+        }
+
+        // decoded on the worker pool, a frame still waiting there is replaced by this one
+        _arena_decoder.submit(p, offset);
+    }
+
+    // let the server send more now that the frames are off the network thread
+    tcp_return_credits();
+    tcp_tx();
+}
+
+bool CZoomyCore::tcp_queue_command(char command, int arg) {
+    packet *p = _tcp_packet_pool.acquire();
+    if (!p) return false;
+    CFrameStream::encode_command(*p, command, arg);
+    return _tcp_tx_queue.push(p);
+}
+
+void CZoomyCore::tcp_return_credits() {
+    if (!_tcp_subscribed || !_tcp_stream.is_streaming()) return;
+
+    // frames are finished with once decoded or dropped anywhere on the way
+    uint64_t finished = _tcp_frames_done + _tcp_rx_queue.get_dropped_count() + _tcp_stream.get_discarded_count();
+    uint64_t owed = finished - _tcp_credits_returned;
+    if (owed < STREAM_CREDIT_BATCH) return;
+    if (tcp_queue_command('C', (int) owed)) _tcp_credits_returned = finished;
+}
+
+// runs on the reactor thread every TCP_DELAY
+void CZoomyCore::update_tcp() {
+    CPerfTimer t(PERF_TCP_UPDATE);
+    // the rest of setting up waits for the connect thread to hand the connection back
+    if (_tcp_connecting) return;
+    if (!_tcp_client.get_socket_status()) {
+        if (_tcp_req_ready) {
+            // an unreachable camera host can block the connect for seconds, udp must keep sending meanwhile
+            if (_thread_tcp_connect.joinable()) _thread_tcp_connect.join();
+            _tcp_connecting = true;
+            _thread_tcp_connect = std::thread(thread_tcp_connect, this, _tcp_host, _tcp_port);
+        }
+    } else {
+        // ask for the stream once per connection, frames already finished with don't count against the window
+        if (!_tcp_subscribed && _tcp_stream.get_mode() != CFrameStream::MODE_POLL) {
+            _tcp_subscribed = tcp_queue_command('S', STREAM_WINDOW);
+            _tcp_credits_returned = _tcp_frames_done + _tcp_rx_queue.get_dropped_count() + _tcp_stream.get_discarded_count();
+        }
+
+        // keep requesting frames until the server pushes them, old servers never will
+        if (_tcp_stream.wants_polling()) tcp_queue_command('G', 1);
+
+        // frames dropped in the rx thread are only noticed here
+        tcp_return_credits();
+        tcp_tx();
+    }
+}
+
+void CZoomyCore::tcp_connected() {
+    _tcp_send_data = _tcp_client.get_socket_status();
+
+    // new connection, nothing carried over from the last one
+    _tcp_stream.reset();
+    _tcp_subscribed = false;
+    _arena_remote_seq_valid = false;
+
+    // start listen thread
+    _thread_tcp_rx = std::thread(thread_tcp_rx, this);
+    _thread_tcp_rx.detach();
+    _tcp_connecting = false;
+}
+
+void CZoomyCore::thread_tcp_connect(CZoomyCore *who_called, std::string host, std::string port) {
+    who_called->_tcp_client.setup(host, port);
+    who_called->_net_reactor.post([who_called] { who_called->tcp_connected(); });
+}
+
+void CZoomyCore::thread_tcp_rx(CZoomyCore *who_called) {
+    while (who_called->_tcp_client.get_socket_status()) {
+        who_called->tcp_rx();
+    }
+}
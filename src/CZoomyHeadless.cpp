@@ -0,0 +1,145 @@
+/**
+ * CZoomyHeadless.cpp - runs the arena pipeline without a window
+ * 2024-06-22
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include "../include/CZoomyHeadless.hpp"
+
+#define REPORT_INTERVAL 1000    // ms between throughput reports
+#define DRAW_DELAY 50           // nothing to draw, only check for exit and report
+
+static const int PERF_LATENCY_COMMAND = CPerfStats::add_stage("latency.command");
+
+std::atomic<bool> CZoomyHeadless::_interrupted{false};
+
+CZoomyHeadless::CZoomyHeadless(int argc, char *argv[]) {
+    _drive_auto = false;
+    _run_seconds = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--remote") {
+            _core.set_camera(1);
+        } else if (arg == "--local" && i + 1 < argc) {
+            _core.set_camera(0);
+            _core.open_local_camera(argv[++i]);
+        } else if (arg == "--udp") {
+            _core.connect_udp();
+        } else if (arg == "--tcp") {
+            _core.connect_tcp();
+        } else if (arg == "--auto") {
+            _drive_auto = true;
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            _run_seconds = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--perf" && i + 1 < argc) {
+            _perf_path = argv[++i];
+        } else {
+            spdlog::warn("Unknown argument: {}", arg);
+        }
+    }
+
+    _core.set_use_auto(_drive_auto);
+    // autonomy's mask is made whether or not it drives, nothing asks for the preview
+    _core.set_mask_options(true);
+
+    // update runs when a new arena frame or mask arrives, and at the configured rate for autonomy
+    _core.set_frame_signal(&_update_signal);
+    set_update_rate(_core.get_update_rate());
+    // images are asked for once per update, a slow update rate mustn't let the requests lapse in between
+    if (_core.get_update_rate() > 0) _core.set_request_interval(1000 / _core.get_update_rate());
+
+    for (auto &s: _last_stats) s = CZoomyCore::stage_stats{0, 0, -1};
+    _last_latency = CPerfStats::get_snapshot(PERF_LATENCY_COMMAND);
+    _last_pool_allocs = 0;
+    _start = std::chrono::steady_clock::now();
+    _last_report = _start;
+
+    std::signal(SIGINT, handle_signal);
+    std::signal(SIGTERM, handle_signal);
+    spdlog::info("Running headless, camera: {}", _core.get_camera() ? "remote" : "local");
+}
+
+CZoomyHeadless::~CZoomyHeadless() {
+    if (!_perf_path.empty()) CPerfStats::dump(_perf_path);
+}
+
+void CZoomyHeadless::update() {
+    // keep the stages autonomy needs running even when it isn't driving, so the report measures them
+    // in camera space the mask is made from raw frames, so the warp is only needed in arena space
+    _core.request(CZoomyCore::PRODUCT_MASK);
+    if (!_core.is_localizing_in_camera()) _core.request(CZoomyCore::PRODUCT_WARPED);
+    _core.update();
+    if (_drive_auto) _core.drive_from_autonomy();
+}
+
+void CZoomyHeadless::draw() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(DRAW_DELAY));
+
+    auto now = std::chrono::steady_clock::now();
+    auto since_report = std::chrono::duration_cast<std::chrono::milliseconds>(now - _last_report).count();
+    if (since_report >= REPORT_INTERVAL) {
+        // per stage: how often it ran and how long it took since the last report
+        std::string line;
+        char text[96];
+        for (int i = 0; i < CZoomyCore::STAGE_COUNT; i++) {
+            CZoomyCore::stage_stats stats = _core.get_stage_stats((CZoomyCore::stage) i);
+            uint64_t count = stats.count - _last_stats[i].count;
+            uint64_t us = stats.total_us - _last_stats[i].total_us;
+            _last_stats[i] = stats;
+
+            snprintf(text, sizeof(text), "%s%s %.1f/s", line.empty() ? "" : " | ",
+                     CZoomyCore::get_stage_name((CZoomyCore::stage) i), (double) count * 1000.0 / (double) since_report);
+            line += text;
+            if (us && count) {
+                snprintf(text, sizeof(text), " %.2f ms", (double) us / 1000.0 / (double) count);
+                line += text;
+            }
+            if (stats.occupancy >= 0) {
+                snprintf(text, sizeof(text), " %.0f%%", stats.occupancy * 100.0);
+                line += text;
+            }
+        }
+
+        // capture to command latency since the last report, only there while autonomy is driving
+        CPerfStats::snapshot latency = CPerfStats::get_snapshot(PERF_LATENCY_COMMAND);
+        CPerfStats::snapshot recent = latency.since(_last_latency);
+        _last_latency = latency;
+        if (recent.count) {
+            snprintf(text, sizeof(text), " | latency p50 %.1f ms p99 %.1f ms", (double) recent.percentile(50) / 1000.0,
+                     (double) recent.percentile(99) / 1000.0);
+            line += text;
+        }
+
+        // buffers that had to come from the heap since the last report, 0 once the pool has every frame size
+        CFramePool::stats pool = CFramePool::instance().get_stats();
+        snprintf(text, sizeof(text), " | pool %lu allocs %.0f MB",
+                 (unsigned long) (pool.heap_allocations - _last_pool_allocs),
+                 (double) (pool.live_bytes + pool.pooled_bytes) / 1048576.0);
+        line += text;
+        _last_pool_allocs = pool.heap_allocations;
+
+        // how much of the update thread's time went to work rather than waiting for frames
+        snprintf(text, sizeof(text), " | update %.0f/s %.0f%% busy", get_update_rate(),
+                 get_update_duty_cycle() * 100.0);
+        line += text;
+
+        spdlog::info(line);
+        _last_report = now;
+    }
+
+    if (_interrupted) _do_exit = true;
+    if (_run_seconds && std::chrono::duration_cast<std::chrono::seconds>(now - _start).count() >= _run_seconds) {
+        _do_exit = true;
+    }
+}
+
+void CZoomyHeadless::handle_signal(int sig) {
+    _interrupted = true;
+}
+
+int main(int argc, char *argv[]) {
+    CZoomyHeadless h(argc, argv);
+    h.run();
+    return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * CZoomyLogReader.cpp - converts session logs to csv
+ * 2024-06-24
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include "../include/CZoomyLogReader.hpp"
+
+CZoomyLogReader::CZoomyLogReader(int argc, char *argv[]) {
+    _type = -1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--type" && i + 1 < argc) {
+            std::string name = argv[++i];
+            for (int t = CSessionLog::REC_CONTROL; t < CSessionLog::REC_TYPE_COUNT; t++) {
+                if (name == CSessionLog::get_type_name(t)) _type = t;
+            }
+            if (_type < 0) spdlog::warn("Unknown record type: {}", name);
+        } else if (arg == "--output" && i + 1 < argc) {
+            _output_path = argv[++i];
+        } else if (_input_path.empty()) {
+            _input_path = arg;
+        } else {
+            spdlog::warn("Unknown argument: {}", arg);
+        }
+    }
+}
+
+CZoomyLogReader::~CZoomyLogReader() = default;
+
+int CZoomyLogReader::run() {
+    if (_input_path.empty()) {
+        spdlog::error("Usage: zoomy-log-csv <session log> [--type <name>] [--output <file.csv>]");
+        return 1;
+    }
+
+    std::ifstream in(_input_path, std::ios::binary);
+    CSessionLog::header h{};
+    if (!in.read((char *) &h, sizeof(h)) || std::string(h.magic, 4) != "ZLOG") {
+        spdlog::error("{} is not a session log", _input_path);
+        return 1;
+    }
+    if (h.version != CSessionLog::VERSION || h.record_size != sizeof(CSessionLog::record)) {
+        spdlog::error("{} is version {} with {} byte records, only version {} is supported", _input_path,
+                      h.version, h.record_size, CSessionLog::VERSION);
+        return 1;
+    }
+
+    std::ofstream file;
+    if (!_output_path.empty()) {
+        file.open(_output_path);
+        if (!file.good()) {
+            spdlog::error("Could not write {}", _output_path);
+            return 1;
+        }
+    }
+    std::ostream &out = _output_path.empty() ? std::cout : file;
+
+    write_header(out);
+    uint64_t rows = 0, records = 0, unused = 0, skipped = 0;
+    CSessionLog::record r{};
+    // a log that was not closed cleanly is still full length, and a record another thread never finished leaves an
+    // unused one between whole ones, so read to the capacity and only the unused records at the end are dropped
+    for (uint64_t i = 0; i < h.capacity && in.read((char *) &r, sizeof(r)); i++) {
+        if (r.type == CSessionLog::REC_END) {
+            unused++;
+            continue;
+        }
+        skipped += unused;
+        unused = 0;
+        records++;
+        if (_type >= 0 && r.type != _type) continue;
+        write_record(out, h, r);
+        rows++;
+    }
+
+    if (skipped) spdlog::warn("Skipped {} unfinished records", skipped);
+    spdlog::info("{} records, {} written", records, rows);
+    return 0;
+}
+
+void CZoomyLogReader::write_header(std::ostream &out) const {
+    out << "time_s,unix_us,type,aux";
+    if (_type >= 0) {
+        for (const auto &name: CSessionLog::get_value_names(_type)) out << "," << name;
+    } else {
+        for (int i = 0; i < CSessionLog::MAX_VALUES; i++) out << ",v" << i;
+    }
+    out << "\n";
+}
+
+void CZoomyLogReader::write_record(std::ostream &out, const CSessionLog::header &h,
+                                   const CSessionLog::record &r) const {
+    char time[32];
+    snprintf(time, sizeof(time), "%.6f", (double) r.time_us / 1e6);
+    out << time << "," << (h.start_unix_us + r.time_us) << "," << CSessionLog::get_type_name(r.type) << "," << r.aux;
+
+    // fixed number of columns so every row lines up, unused values are left empty
+    int columns = _type >= 0 ? (int) CSessionLog::get_value_names(_type).size() : CSessionLog::MAX_VALUES;
+    for (int i = 0; i < columns; i++) {
+        out << ",";
+        if (i < r.count && i < CSessionLog::MAX_VALUES) out << r.values[i];
+    }
+    out << "\n";
+}
+
+int main(int argc, char *argv[]) {
+    // csv may go to stdout, keep the log out of it
+    spdlog::set_default_logger(spdlog::stderr_color_mt("zoomy-log-csv"));
+    CZoomyLogReader r(argc, argv);
+    return r.run();
+}
@@ -0,0 +1,195 @@
+/**
+ * CZoomyStreamCheck.cpp - feeds synthetic arena streams through CFrameStream in random-sized chunks
+ * 2024-07-02
+ * vika <https://github.com/hi-im-vika>
+ */
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include "../include/CZoomyStreamCheck.hpp"
+
+#define SEED 0x2F00D
+#define ROUNDS 50
+#define FRAMES_PER_ROUND 40
+#define MAX_CHUNK 4096
+#define MAX_FRAME (256 * 1024)
+
+CZoomyStreamCheck::CZoomyStreamCheck(int argc, char *argv[]) {
+    _seed = SEED;
+    _rounds = ROUNDS;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--seed" && has_value) {
+            _seed = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (arg == "--rounds" && has_value) {
+            _rounds = std::max(1, atoi(argv[++i]));
+        } else {
+            spdlog::warn("Unknown argument: {}", arg);
+        }
+    }
+    _rng.seed(_seed);
+}
+
+CZoomyStreamCheck::~CZoomyStreamCheck() = default;
+
+int CZoomyStreamCheck::run() {
+    int failed = 0;
+    for (int round = 0; round < _rounds; round++) {
+        if (!run_round(round)) failed++;
+    }
+    if (failed) {
+        spdlog::error("{} of {} rounds failed, seed {:#x}", failed, _rounds, _seed);
+        return 1;
+    }
+    spdlog::info("{} rounds passed, seed {:#x}", _rounds, _seed);
+    return 0;
+}
+
+bool CZoomyStreamCheck::run_round(int round) {
+    std::vector<uint8_t> stream;
+    std::vector<expected> frames;
+    int garbage_runs = 0;
+
+    for (uint32_t i = 0; i < FRAMES_PER_ROUND; i++) {
+        int kind = (int) (_rng() % 8);
+        if (kind == 0) {
+            add_garbage(stream);
+            garbage_runs++;
+        } else if (kind == 1) {
+            // ping response, expected between frames and not a resync
+            stream.push_back('\6');
+        } else if (kind == 2 && i == FRAMES_PER_ROUND / 2) {
+            // a header from a newer server, skipped byte by byte until the real frame behind it
+            uint8_t bad[CFrameStream::HEADER_SIZE];
+            CFrameStream::encode_header(CFrameStream::header{16, i, 0}, bad);
+            bad[2] = CFrameStream::VERSION + 1;
+            stream.insert(stream.end(), bad, bad + sizeof(bad));
+            garbage_runs++;
+        }
+
+        if (_rng() % 4 == 0) {
+            std::vector<uint8_t> jpeg = make_jpeg(_rng() % 2);
+            stream.insert(stream.end(), jpeg.begin(), jpeg.end());
+            frames.push_back(expected{jpeg, false});
+        } else {
+            add_framed(stream, frames, i);
+        }
+    }
+
+    // the first round is fed whole, so every resync is one of the inserted runs
+    CFrameStream parser(MAX_FRAME);
+    std::uniform_int_distribution<size_t> chunk_size(1, MAX_CHUNK);
+    size_t fed = 0;
+    size_t next = 0;
+    packet out;
+    while (fed < stream.size()) {
+        size_t n = round ? std::min(chunk_size(_rng), stream.size() - fed) : stream.size();
+        parser.feed(stream.data() + fed, n);
+        fed += n;
+
+        while (parser.has_frame()) {
+            parser.take_frame(&out);
+            if (next >= frames.size()) {
+                spdlog::error("Round {}: extra frame of {} bytes", round, out.size());
+                return false;
+            }
+            const expected &e = frames.at(next);
+            if (out != e.bytes) {
+                spdlog::error("Round {}: frame {} is {} bytes, expected {} {} bytes", round, next, out.size(),
+                              e.framed ? "framed" : "jpeg", e.bytes.size());
+                return false;
+            }
+            if (e.framed) {
+                CFrameStream::header h{};
+                if (!CFrameStream::parse_header(out.data(), out.size(), h) ||
+                    h.length != out.size() - CFrameStream::HEADER_SIZE) {
+                    spdlog::error("Round {}: frame {} has a bad header", round, next);
+                    return false;
+                }
+            }
+            next++;
+        }
+    }
+
+    if (next != frames.size()) {
+        spdlog::error("Round {}: {} of {} frames came out", round, next, frames.size());
+        return false;
+    }
+    // chunk boundaries inside a run of garbage can split it into more than one resync, never fewer
+    uint64_t resyncs = parser.get_resync_count();
+    if (resyncs < (uint64_t) garbage_runs || (!round && resyncs != (uint64_t) garbage_runs)) {
+        spdlog::error("Round {}: {} resyncs for {} runs of garbage", round, resyncs, garbage_runs);
+        return false;
+    }
+    if (parser.is_streaming() != std::any_of(frames.begin(), frames.end(), [](const expected &e) {
+        return e.framed;
+    })) {
+        spdlog::error("Round {}: streaming state is wrong", round);
+        return false;
+    }
+    return true;
+}
+
+std::vector<uint8_t> CZoomyStreamCheck::make_jpeg(bool thumbnail) {
+    std::vector<uint8_t> j = {0xFF, 0xD8};
+    auto segment = [&j](uint8_t marker, const std::vector<uint8_t> &body) {
+        size_t len = body.size() + 2;
+        j.insert(j.end(), {0xFF, marker, (uint8_t) (len >> 8), (uint8_t) len});
+        j.insert(j.end(), body.begin(), body.end());
+    };
+
+    segment(0xE0, {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0});
+    if (thumbnail) {
+        // an exif thumbnail is a whole jpeg inside APP1, its end marker is not the end of this one
+        segment(0xE1, {'E', 'x', 'i', 'f', 0, 0, 0xFF, 0xD8, 0xFF, 0xDA, 0x12, 0x34, 0xFF, 0xD9});
+    }
+    std::vector<uint8_t> table(64);
+    for (auto &t: table) t = (uint8_t) (_rng() % 255 + 1);
+    table.insert(table.begin(), 0);
+    segment(0xDB, table);
+    segment(0xDA, {1, 1, 0, 0, 63, 0});
+
+    // entropy coded data, every 0xFF stuffed with 0x00 or followed by a restart marker
+    size_t length = 200 + _rng() % (32 * 1024);
+    for (size_t i = 0; i < length; i++) {
+        auto b = (uint8_t) _rng();
+        j.push_back(b);
+        if (b == 0xFF) j.push_back(_rng() % 4 ? 0x00 : (uint8_t) (0xD0 + _rng() % 8));
+    }
+    j.insert(j.end(), {0xFF, 0xD9});
+    return j;
+}
+
+void CZoomyStreamCheck::add_framed(std::vector<uint8_t> &stream, std::vector<expected> &frames, uint32_t sequence) {
+    // framed payloads are normally jpegs, but the header alone has to be enough to delimit them
+    std::vector<uint8_t> payload = _rng() % 2 ? make_jpeg(false) : std::vector<uint8_t>(_rng() % 4096);
+    for (auto &b: payload) if (!b) b = (uint8_t) _rng();
+
+    expected e{std::vector<uint8_t>(CFrameStream::HEADER_SIZE), true};
+    CFrameStream::encode_header(CFrameStream::header{(uint32_t) payload.size(), sequence,
+                                                     (uint64_t) sequence * 33333 + ((uint64_t) 1 << 40)},
+                                e.bytes.data());
+    e.bytes.insert(e.bytes.end(), payload.begin(), payload.end());
+    stream.insert(stream.end(), e.bytes.begin(), e.bytes.end());
+    frames.push_back(e);
+}
+
+void CZoomyStreamCheck::add_garbage(std::vector<uint8_t> &stream) {
+    // bytes that can't start a frame or a ping, so each run is exactly one resync when fed whole
+    size_t length = 1 + _rng() % 300;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t b;
+        do {
+            b = (uint8_t) _rng();
+        } while (b == CFrameStream::MAGIC_0 || b == 0xFF || b == '\6');
+        stream.push_back(b);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_default_logger(spdlog::stderr_color_mt("zoomy-stream-check"));
+    CZoomyStreamCheck c(argc, argv);
+    return c.run();
+}